@@ -0,0 +1,19 @@
+#ifndef   _FLASHCRC32_H
+#define   _FLASHCRC32_H
+
+#include <stdint.h>
+
+// Plain C++ (no Arduino dependency) so host-side tools can share it
+
+/*
+Method: flashCRC32()
+Description: CRC-32 (IEEE 802.3, same as zlib) of a buffer, can be chained over several buffers
+Input:
+    const uint8_t data[]: Bytes to checksum
+    uint32_t length: Number of bytes
+    uint32_t crc: Result of the previous chunk (0 for the first chunk)
+Output: uint32_t CRC
+*/
+uint32_t flashCRC32(const uint8_t data[], uint32_t length, uint32_t crc = 0);
+
+#endif // _FLASHCRC32_H
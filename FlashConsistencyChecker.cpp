@@ -0,0 +1,1115 @@
+#include "FlashConsistencyChecker.h"
+#include "FlashCRC32.h"
+
+#define FSCK_NO_SECTOR 0xFFFFFFFF
+#define FSCK_ENTRY_SIZE 32
+#define FSCK_ENTRIES_PER_SECTOR (QSPI_FLASH_FSCK_SECTOR_SIZE / FSCK_ENTRY_SIZE)
+#define FSCK_CLUSTERS_PER_UNIT 64
+
+// Repair actions for a directory entry
+#define FSCK_FIX_SIZE 0         // set the file size
+#define FSCK_FIX_TRUNCATE 1     // end the chain at truncateAt and set the file size
+#define FSCK_FIX_CLEAR 2        // detach the chain, size 0
+#define FSCK_FIX_DELETE 3       // mark the entry deleted
+
+static uint32_t readLE(const uint8_t data[], uint8_t bytes) {
+    uint32_t value = 0;
+    for (int8_t i = bytes - 1 ; i >= 0 ; i--) {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+static void writeLE(uint8_t data[], uint8_t bytes, uint32_t value) {
+    for (uint8_t i = 0 ; i < bytes ; i++) {
+        data[i] = value & 0xFF;
+        value >>= 8;
+    }
+}
+
+FlashConsistencyChecker::FlashConsistencyChecker(QSPIFlashMemory &flashMemory) : _flashMemory(flashMemory) {
+}
+
+/*
+Method: begin()
+Description: Start a read-only check, see begin(repair)
+Input: None
+Output: See begin(repair)
+*/
+int FlashConsistencyChecker::begin() {
+    return begin(false);
+}
+
+/*
+Method: begin()
+Description: Read the volume geometry and start a check. Call fsckStep() until it returns 0
+Input:
+    bool repair: true = fix what is found once the check completes
+Output:
+     0: success
+    -2: error reading the boot sector
+    -3: Filesystem could not be mounted/accessed
+    -4: volume isn't a supported FAT layout, or has more than QSPI_FLASH_FSCK_MAX_CLUSTERS clusters
+*/
+int FlashConsistencyChecker::begin(bool repair) {
+    _repair = repair;
+    _report = FlashCheckReport();
+    _havePrevious = false;
+    _result = 0;
+    _phase = FLASH_CHECK_FAILED;
+    if (_flashMemory.mount() != 0) {
+        return _result = -3;
+    }
+    FlashLockGuard volumeGuard(_flashMemory.getVolumeLock());
+    _dirBufferSector = FSCK_NO_SECTOR;
+    _fatBufferSector = FSCK_NO_SECTOR;
+    _fatBufferDirty = false;
+    int result = readGeometry();
+    if (result != 0) {
+        return _result = result;
+    }
+    _report.clusters = _clusterCount;
+    startPass();
+    return 0;
+}
+
+/*
+Method: fsckStep()
+Description: Do check work until the time budget is used (at least one unit of work is done,
+             and a repair always runs to completion)
+Input:
+    uint32_t budgetMicros: Time allowed for this step
+Output:
+     1: more work remains
+     0: check complete, see getReport()
+    -1: begin() not called
+    -2: error reading
+    -3: Filesystem could not be remounted after repair
+    -4: volume not supported (from begin())
+    -5: error writing a repair
+*/
+int FlashConsistencyChecker::fsckStep(uint32_t budgetMicros) {
+    if (_phase == FLASH_CHECK_IDLE) {
+        return -1;
+    }
+    if (_phase == FLASH_CHECK_FAILED) {
+        return _result;
+    }
+    if (_phase == FLASH_CHECK_DONE) {
+        return 0;
+    }
+
+    FlashLockGuard volumeGuard(_flashMemory.getVolumeLock());
+    unsigned long start = micros();
+    unsigned long elapsed = 0;
+    do {
+        int result = work();
+        if (result < 0) {
+            _phase = FLASH_CHECK_FAILED;
+            _result = result;
+        }
+        elapsed = micros() - start;
+    } while (_phase != FLASH_CHECK_DONE && _phase != FLASH_CHECK_FAILED && elapsed < budgetMicros);
+
+    _report.steps++;
+    _report.totalMicros += elapsed;
+    if (elapsed > _report.maxStepMicros) {
+        _report.maxStepMicros = elapsed;
+    }
+    if (_phase == FLASH_CHECK_FAILED) {
+        return _result;
+    }
+    return (_phase == FLASH_CHECK_DONE) ? 0 : 1;
+}
+
+/*
+Method: isDone()
+Description: Check if the check has finished (successfully or not)
+Input: None
+Output:
+    true: finished
+    false: not started or still running
+*/
+bool FlashConsistencyChecker::isDone() {
+    return _phase == FLASH_CHECK_DONE || _phase == FLASH_CHECK_FAILED;
+}
+
+/*
+Method: hasProblems()
+Description: Check if the last pass found anything wrong (skipped directories aren't counted)
+Input: None
+Output:
+    true: problems found
+    false: volume is consistent so far
+*/
+bool FlashConsistencyChecker::hasProblems() {
+    return countFindings() > 0;
+}
+
+/*
+Method: getProgress()
+Description: Estimated progress through the current pass
+Input: None
+Output: uint8_t percentage (0 - 100), 0 before begin()
+*/
+uint8_t FlashConsistencyChecker::getProgress() {
+    // No geometry read yet, nothing to measure the passes against
+    if (_clusterCount == 0 || _fatSectors == 0) {
+        return (_phase == FLASH_CHECK_DONE || _phase == FLASH_CHECK_FAILED) ? 100 : 0;
+    }
+    switch (_phase) {
+        case FLASH_CHECK_IDLE:
+            return 0;
+        case FLASH_CHECK_FAT_COUNT:
+            return (5 * _position) / _clusterCount;
+        case FLASH_CHECK_FAT_COPIES:
+            return 5 + (5 * _position) / _fatSectors;
+        case FLASH_CHECK_DIRECTORIES:
+            if (_markedClusters >= _report.allocatedClusters) {
+                return 70;
+            }
+            return 10 + (60 * _markedClusters) / _report.allocatedClusters;
+        case FLASH_CHECK_LOST:
+            return 70 + (30 * _position) / _clusterCount;
+        default:
+            return 100;
+    }
+}
+
+/*
+Method: getPhase()
+Description: Get the current phase of the check
+Input: None
+Output: FlashCheckPhase
+*/
+FlashCheckPhase FlashConsistencyChecker::getPhase() {
+    return _phase;
+}
+
+/*
+Method: getReport()
+Description: Get the findings so far
+Input: None
+Output: FlashCheckReport struct
+*/
+FlashCheckReport FlashConsistencyChecker::getReport() {
+    return _report;
+}
+
+/*
+Method: readGeometry()
+Description: Locate the FAT volume (directly at sector 0, or in the first partition as
+             format() creates it) and read its layout from the boot sector
+Input: None
+Output:
+     0: success
+    -2: error reading
+    -4: not a supported FAT volume
+*/
+int FlashConsistencyChecker::readGeometry() {
+    uint8_t *boot = _dirBuffer;
+    uint32_t volumeStart = 0;
+    for (uint8_t attempt = 0 ; attempt < 2 ; attempt++) {
+        if (disk_read(0, boot, volumeStart, 1) != RES_OK) {
+            return -2;
+        }
+        if (boot[510] != 0x55 || boot[511] != 0xAA) {
+            return -4;
+        }
+        if ((boot[0] == 0xEB || boot[0] == 0xE9 || boot[0] == 0xE8) && readLE(&boot[11], 2) == QSPI_FLASH_FSCK_SECTOR_SIZE) {
+            break;
+        }
+        if (attempt == 1) {
+            return -4;
+        }
+        // Master boot record, the volume is the first partition
+        volumeStart = readLE(&boot[0x1BE + 8], 4);
+        if (volumeStart == 0) {
+            return -4;
+        }
+    }
+
+    _clusterSectors = boot[13];
+    _fatCount = boot[16];
+    uint32_t reservedSectors = readLE(&boot[14], 2);
+    uint32_t rootEntries = readLE(&boot[17], 2);
+    uint32_t totalSectors = readLE(&boot[19], 2);
+    if (totalSectors == 0) {
+        totalSectors = readLE(&boot[32], 4);
+    }
+    _fatSectors = readLE(&boot[22], 2);
+    if (_fatSectors == 0) {
+        _fatSectors = readLE(&boot[36], 4);
+    }
+    if (_clusterSectors == 0 || (_clusterSectors & (_clusterSectors - 1)) != 0
+        || _fatCount == 0 || _fatCount > 2 || reservedSectors == 0 || _fatSectors == 0) {
+        return -4;
+    }
+
+    _fatStart = volumeStart + reservedSectors;
+    _rootStart = _fatStart + _fatCount * _fatSectors;
+    _rootSectors = (rootEntries * FSCK_ENTRY_SIZE + QSPI_FLASH_FSCK_SECTOR_SIZE - 1) / QSPI_FLASH_FSCK_SECTOR_SIZE;
+    _dataStart = _rootStart + _rootSectors;
+    if (totalSectors <= _dataStart - volumeStart) {
+        return -4;
+    }
+    _clusterCount = (totalSectors - (_dataStart - volumeStart)) / _clusterSectors;
+    if (_clusterCount == 0) {
+        return -4;
+    }
+
+    // FAT type is decided by the cluster count alone
+    if (_clusterCount < 4085) {
+        _fatType = 12;
+    } else if (_clusterCount < 65525) {
+        _fatType = 16;
+    } else {
+        _fatType = 32;
+        _rootCluster = readLE(&boot[44], 4);
+        if (_rootSectors != 0 || !isValidCluster(_rootCluster)) {
+            return -4;
+        }
+    }
+    if (_clusterCount > QSPI_FLASH_FSCK_MAX_CLUSTERS || _fatSectors * QSPI_FLASH_FSCK_SECTOR_SIZE * 8 < (_clusterCount + 2) * _fatType) {
+        return -4;
+    }
+    _dirBufferSector = FSCK_NO_SECTOR;
+    return 0;
+}
+
+/*
+Method: startPass()
+Description: Clear the findings and cluster bitmap and start a pass from the FAT count
+Input: None
+Output: N/A
+*/
+void FlashConsistencyChecker::startPass() {
+    memset(_bitmap, 0, sizeof(_bitmap));
+    _report.allocatedClusters = 0;
+    _report.directories = 0;
+    _report.files = 0;
+    _report.lostClusters = 0;
+    _report.lostChains = 0;
+    _report.crossLinks = 0;
+    _report.badChains = 0;
+    _report.badEntries = 0;
+    _report.sizeMismatches = 0;
+    _report.fatMismatches = 0;
+    _report.skippedDirectories = 0;
+    _report.unrepaired = 0;
+    _report.passes++;
+    _fixCount = 0;
+    _depth = 0;
+    _walking = false;
+    _position = 0;
+    _markedClusters = 0;
+    _fingerprint = 0;
+    _phase = FLASH_CHECK_FAT_COUNT;
+}
+
+/*
+Method: finishPass()
+Description: Decide what follows a complete pass: done, another pass, or repair.
+             Repair needs two passes in a row with the same findings and the same
+             FAT and directory contents
+Input: None
+Output: See repair()
+*/
+int FlashConsistencyChecker::finishPass() {
+    if (!_repair) {
+        _report.unrepaired = countFindings();
+    }
+    if (!_repair || !hasProblems()) {
+        _phase = FLASH_CHECK_DONE;
+        return 0;
+    }
+    Summary current = { _fingerprint, {
+        _report.directories, _report.files, _report.lostClusters, _report.lostChains, _report.crossLinks,
+        _report.badChains, _report.badEntries, _report.sizeMismatches, _report.fatMismatches
+    } };
+    if (_havePrevious && memcmp(&current, &_previous, sizeof(current)) == 0) {
+        return repair();
+    }
+    if (_report.passes >= QSPI_FLASH_FSCK_MAX_PASSES) {
+        // The volume keeps changing under the check, leave it alone
+        _report.unrepaired = countFindings();
+        _phase = FLASH_CHECK_DONE;
+        return 0;
+    }
+    _previous = current;
+    _havePrevious = true;
+    startPass();
+    return 0;
+}
+
+/*
+Method: work()
+Description: Do one unit of work for the current phase
+Input: None
+Output:
+     0: success
+    <0: error (see fsckStep())
+*/
+int FlashConsistencyChecker::work() {
+    switch (_phase) {
+        case FLASH_CHECK_FAT_COUNT:
+            return countStep();
+        case FLASH_CHECK_FAT_COPIES:
+            return copiesStep();
+        case FLASH_CHECK_DIRECTORIES:
+            return directoryStep();
+        case FLASH_CHECK_LOST:
+            return lostStep();
+        default:
+            return 0;
+    }
+}
+
+/*
+Method: countStep()
+Description: Count allocated clusters (used to estimate directory walk progress)
+Input: None
+Output:
+     0: success
+    -2: error reading
+*/
+int FlashConsistencyChecker::countStep() {
+    for (uint8_t i = 0 ; i < FSCK_CLUSTERS_PER_UNIT ; i++) {
+        if (_position >= _clusterCount) {
+            _position = 0;
+            _phase = FLASH_CHECK_FAT_COPIES;
+            return 0;
+        }
+        uint32_t value;
+        if (readFatEntry(_position + 2, value) != 0) {
+            return -2;
+        }
+        if (value != 0) {
+            _report.allocatedClusters++;
+        }
+        _position++;
+    }
+    return 0;
+}
+
+/*
+Method: copiesStep()
+Description: Compare one FAT sector with its copies. The first FAT is what FatFs reads,
+             so it is also what the pass fingerprint covers
+Input: None
+Output:
+     0: success
+    -2: error reading
+*/
+int FlashConsistencyChecker::copiesStep() {
+    if (_position >= _fatSectors) {
+        _position = 0;
+        _phase = FLASH_CHECK_DIRECTORIES;
+        if (_fatType == 32) {
+            startWalk(0, 0, _rootCluster, 0, true);
+        } else {
+            _stack[0].cluster = 0;
+            _stack[0].clustersLeft = 0;
+            _stack[0].sector = 0;
+            _stack[0].entry = 0;
+            _depth = 1;
+        }
+        return 0;
+    }
+    if (flushFatSector() != 0) {
+        return -5;
+    }
+    _fatBufferSector = FSCK_NO_SECTOR;
+    _dirBufferSector = FSCK_NO_SECTOR;
+    if (disk_read(0, _dirBuffer, _fatStart + _position, 1) != RES_OK) {
+        return -2;
+    }
+    _fingerprint = flashCRC32(_dirBuffer, QSPI_FLASH_FSCK_SECTOR_SIZE, _fingerprint);
+    for (uint8_t copy = 1 ; copy < _fatCount ; copy++) {
+        if (disk_read(0, _fatBuffer, _fatStart + copy * _fatSectors + _position, 1) != RES_OK) {
+            return -2;
+        }
+        if (memcmp(_dirBuffer, _fatBuffer, QSPI_FLASH_FSCK_SECTOR_SIZE) != 0) {
+            _report.fatMismatches++;
+            break;
+        }
+    }
+    _position++;
+    return 0;
+}
+
+/*
+Method: directoryStep()
+Description: Continue the current chain walk, or check the entries of the next directory
+             sector until one needs its chain walked
+Input: None
+Output:
+     0: success
+    -2: error reading
+*/
+int FlashConsistencyChecker::directoryStep() {
+    if (_walking) {
+        return walkStep();
+    }
+    if (_depth == 0) {
+        _position = 0;
+        _phase = FLASH_CHECK_LOST;
+        return 0;
+    }
+
+    Frame &frame = _stack[_depth - 1];
+    uint32_t sector;
+    if (frame.cluster == 0) {
+        if (frame.sector >= _rootSectors) {
+            _depth--;
+            return 0;
+        }
+        sector = _rootStart + frame.sector;
+    } else {
+        if (frame.sector >= _clusterSectors) {
+            uint32_t next;
+            if (readFatEntry(frame.cluster, next) != 0) {
+                return -2;
+            }
+            frame.clustersLeft--;
+            if (frame.clustersLeft == 0 || !isValidCluster(next)) {
+                _depth--;
+                return 0;
+            }
+            frame.cluster = next;
+            frame.sector = 0;
+        }
+        sector = _dataStart + (frame.cluster - 2) * _clusterSectors + frame.sector;
+    }
+    if (loadDirectorySector(sector) != 0) {
+        return -2;
+    }
+    if (frame.entry == 0) {
+        _fingerprint = flashCRC32(_dirBuffer, QSPI_FLASH_FSCK_SECTOR_SIZE, _fingerprint);
+    }
+
+    while (frame.entry < FSCK_ENTRIES_PER_SECTOR) {
+        uint8_t index = frame.entry++;
+        uint8_t *entry = &_dirBuffer[index * FSCK_ENTRY_SIZE];
+        uint8_t attributes = entry[11];
+        if (entry[0] == 0x00) {
+            // End of directory
+            _depth--;
+            return 0;
+        }
+        if (entry[0] == 0xE5 || entry[0] == '.' || (attributes & 0x3F) == 0x0F || (attributes & 0x08)) {
+            // Deleted, dot entry, long filename part or volume label
+            continue;
+        }
+
+        bool directory = (attributes & 0x10) != 0;
+        uint32_t start = entryCluster(entry);
+        uint32_t size = readLE(&entry[28], 4);
+        if (directory) {
+            _report.directories++;
+        } else {
+            _report.files++;
+        }
+        if (!isValidName(entry) || (attributes & 0xC0) || (directory && start == 0)) {
+            // Half-written entry, its clusters are left for the lost cluster check
+            _report.badEntries++;
+            addFix(sector, index, start, 0, 0, FSCK_FIX_DELETE);
+            continue;
+        }
+        if (start == 0) {
+            if (size != 0) {
+                _report.sizeMismatches++;
+                addFix(sector, index, start, 0, 0, FSCK_FIX_SIZE);
+            }
+            continue;
+        }
+        if (!isValidCluster(start)) {
+            _report.badEntries++;
+            addFix(sector, index, start, 0, 0, directory ? FSCK_FIX_DELETE : FSCK_FIX_CLEAR);
+            continue;
+        }
+        startWalk(sector, index, start, size, directory);
+        return 0;
+    }
+    frame.sector++;
+    frame.entry = 0;
+    return 0;
+}
+
+/*
+Method: walkStep()
+Description: Follow the current entry's cluster chain, marking each cluster as in use
+Input: None
+Output:
+     0: success
+    -2: error reading
+*/
+int FlashConsistencyChecker::walkStep() {
+    uint32_t clusterBytes = (uint32_t) _clusterSectors * QSPI_FLASH_FSCK_SECTOR_SIZE;
+    for (uint8_t i = 0 ; i < FSCK_CLUSTERS_PER_UNIT ; i++) {
+        uint32_t chainBytes = _walkCount * clusterBytes;
+        uint32_t clampedSize = (_walkSize < chainBytes) ? _walkSize : chainBytes;
+        if (_walkCount == _walkLimit) {
+            // Chain is longer than the file, the rest becomes lost and is freed
+            _report.sizeMismatches++;
+            if (_walkPrevious == 0) {
+                addFix(_walkEntrySector, _walkEntryIndex, _walkStart, 0, 0, FSCK_FIX_CLEAR);
+            } else {
+                addFix(_walkEntrySector, _walkEntryIndex, _walkStart, _walkPrevious, _walkSize, FSCK_FIX_TRUNCATE);
+            }
+            finishWalk();
+            return 0;
+        }
+
+        uint32_t cluster = _walkCluster;
+        if (isMarked(cluster)) {
+            _report.crossLinks++;
+            if (_walkPrevious == 0) {
+                addFix(_walkEntrySector, _walkEntryIndex, _walkStart, 0, 0, _walkDirectory ? FSCK_FIX_DELETE : FSCK_FIX_CLEAR);
+            } else {
+                addFix(_walkEntrySector, _walkEntryIndex, _walkStart, _walkPrevious, clampedSize, FSCK_FIX_TRUNCATE);
+            }
+            finishWalk();
+            return 0;
+        }
+        uint32_t next;
+        if (readFatEntry(cluster, next) != 0) {
+            return -2;
+        }
+        if (next == 0) {
+            // Chain runs into a free cluster, whatever it holds isn't this file's
+            _report.badChains++;
+            if (_walkPrevious == 0) {
+                addFix(_walkEntrySector, _walkEntryIndex, _walkStart, 0, 0, _walkDirectory ? FSCK_FIX_DELETE : FSCK_FIX_CLEAR);
+            } else {
+                addFix(_walkEntrySector, _walkEntryIndex, _walkStart, _walkPrevious, clampedSize, FSCK_FIX_TRUNCATE);
+            }
+            finishWalk();
+            return 0;
+        }
+        setMarked(cluster, true);
+        _markedClusters++;
+        _walkCount++;
+        _walkPrevious = cluster;
+        chainBytes += clusterBytes;
+        clampedSize = (_walkSize < chainBytes) ? _walkSize : chainBytes;
+
+        if (isEndOfChain(next)) {
+            if (!_walkDirectory && chainBytes < _walkSize) {
+                _report.sizeMismatches++;
+                addFix(_walkEntrySector, _walkEntryIndex, _walkStart, 0, chainBytes, FSCK_FIX_SIZE);
+            }
+            finishWalk();
+            return 0;
+        }
+        if (!isValidCluster(next)) {
+            // Bad cluster marker or out of range value in the middle of a chain
+            _report.badChains++;
+            addFix(_walkEntrySector, _walkEntryIndex, _walkStart, cluster, clampedSize, FSCK_FIX_TRUNCATE);
+            finishWalk();
+            return 0;
+        }
+        _walkCluster = next;
+    }
+    return 0;
+}
+
+/*
+Method: lostStep()
+Description: Find allocated clusters that no chain reached. The bitmap is rewritten in place
+             to hold the lost clusters, which is what repair() frees
+Input: None
+Output:
+     0: success
+    -2: error reading
+    <0: see repair()
+*/
+int FlashConsistencyChecker::lostStep() {
+    uint32_t badCluster = (_fatType == 12) ? 0xFF7 : (_fatType == 16) ? 0xFFF7 : 0x0FFFFFF7;
+    for (uint8_t i = 0 ; i < FSCK_CLUSTERS_PER_UNIT ; i++) {
+        if (_position >= _clusterCount) {
+            return finishPass();
+        }
+        uint32_t cluster = _position + 2;
+        uint32_t value;
+        if (readFatEntry(cluster, value) != 0) {
+            return -2;
+        }
+        bool lost = value != 0 && value != badCluster && !isMarked(cluster);
+        if (lost) {
+            _report.lostClusters++;
+            if (isEndOfChain(value)) {
+                _report.lostChains++;
+            }
+        }
+        setMarked(cluster, lost);
+        _position++;
+    }
+    return 0;
+}
+
+/*
+Method: startWalk()
+Description: Begin following a directory entry's cluster chain
+Input:
+    uint32_t entrySector: Sector holding the entry (0 = FAT32 root directory, no entry)
+    uint8_t entryIndex: Entry within the sector
+    uint32_t startCluster: First cluster of the chain
+    uint32_t size: File size from the entry
+    bool directory: true = entry is a directory, its size isn't checked
+Output: N/A
+*/
+void FlashConsistencyChecker::startWalk(uint32_t entrySector, uint8_t entryIndex, uint32_t startCluster, uint32_t size, bool directory) {
+    uint32_t clusterBytes = (uint32_t) _clusterSectors * QSPI_FLASH_FSCK_SECTOR_SIZE;
+    _walking = true;
+    _walkDirectory = directory;
+    _walkStart = startCluster;
+    _walkCluster = startCluster;
+    _walkPrevious = 0;
+    _walkCount = 0;
+    _walkSize = directory ? 0 : size;
+    _walkLimit = directory ? 0xFFFFFFFF : (size / clusterBytes) + ((size % clusterBytes) ? 1 : 0);
+    _walkEntrySector = entrySector;
+    _walkEntryIndex = entryIndex;
+}
+
+/*
+Method: finishWalk()
+Description: End the chain walk, a directory is then read (depth permitting)
+Input: None
+Output: N/A
+*/
+void FlashConsistencyChecker::finishWalk() {
+    _walking = false;
+    if (_walkDirectory) {
+        pushDirectory(_walkStart, _walkCount);
+    }
+}
+
+/*
+Method: pushDirectory()
+Description: Queue a directory for reading, limited to the clusters its walk accepted
+Input:
+    uint32_t cluster: First cluster of the directory
+    uint32_t clusterCount: Clusters in its chain
+Output: N/A
+*/
+void FlashConsistencyChecker::pushDirectory(uint32_t cluster, uint32_t clusterCount) {
+    if (clusterCount == 0) {
+        return;
+    }
+    if (_depth >= QSPI_FLASH_FSCK_MAX_DEPTH) {
+        _report.skippedDirectories++;
+        return;
+    }
+    Frame &frame = _stack[_depth++];
+    frame.cluster = cluster;
+    frame.clustersLeft = clusterCount;
+    frame.sector = 0;
+    frame.entry = 0;
+}
+
+/*
+Method: addFix()
+Description: Remember a directory entry repair (only when repair is enabled)
+Input:
+    uint32_t entrySector: Sector holding the entry (0 = no entry, can't be repaired)
+    uint8_t entryIndex: Entry within the sector
+    uint32_t startCluster: Start cluster the entry has now
+    uint32_t truncateAt: Cluster that becomes the end of the chain (FSCK_FIX_TRUNCATE)
+    uint32_t size: New file size
+    uint8_t action: FSCK_FIX_*
+Output: N/A
+*/
+void FlashConsistencyChecker::addFix(uint32_t entrySector, uint8_t entryIndex, uint32_t startCluster, uint32_t truncateAt, uint32_t size, uint8_t action) {
+    if (!_repair) {
+        return;
+    }
+    if (entrySector == 0 || _fixCount >= QSPI_FLASH_FSCK_MAX_REPAIRS) {
+        _report.unrepaired++;
+        return;
+    }
+    Fix &fix = _fixes[_fixCount++];
+    fix.entrySector = entrySector;
+    fix.entryIndex = entryIndex;
+    fix.startCluster = startCluster;
+    fix.truncateAt = truncateAt;
+    fix.size = size;
+    fix.action = action;
+}
+
+/*
+Method: countFindings()
+Description: Total problems found by the last pass
+Input: None
+Output: uint32_t count
+*/
+uint32_t FlashConsistencyChecker::countFindings() {
+    return _report.lostClusters + _report.crossLinks + _report.badChains + _report.badEntries
+         + _report.sizeMismatches + _report.fatMismatches;
+}
+
+/*
+Method: isValidName()
+Description: Check a short name for characters FatFs never writes
+Input:
+    uint8_t entry[]: Directory entry
+Output:
+    true: plausible name
+    false: corrupt or half-written
+*/
+bool FlashConsistencyChecker::isValidName(uint8_t entry[]) {
+    if (entry[0] == ' ') {
+        return false;
+    }
+    for (uint8_t i = 0 ; i < 11 ; i++) {
+        uint8_t c = entry[i];
+        if (c < 0x20 && !(i == 0 && c == 0x05)) {
+            return false;
+        }
+        if (c == 0x7F || strchr("\"*+,/:;<=>?[\\]|", c) != NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+Method: repair()
+Description: Apply the remembered fixes, free lost clusters, resync the FAT copies and
+             remount so FatFs drops its cached sectors. Runs to completion
+Input: None
+Output:
+     0: success
+    -2: error reading
+    -3: Filesystem could not be remounted
+    -5: error writing
+*/
+int FlashConsistencyChecker::repair() {
+    // Directory entries, skipped if the entry has changed since it was checked
+    for (uint8_t i = 0 ; i < _fixCount ; i++) {
+        Fix &fix = _fixes[i];
+        if (loadDirectorySector(fix.entrySector) != 0) {
+            return -2;
+        }
+        uint8_t *entry = &_dirBuffer[fix.entryIndex * FSCK_ENTRY_SIZE];
+        if (entry[0] == 0x00 || entry[0] == 0xE5 || entryCluster(entry) != fix.startCluster) {
+            _report.unrepaired++;
+            continue;
+        }
+        if (fix.action == FSCK_FIX_DELETE) {
+            entry[0] = 0xE5;
+        } else {
+            if (fix.action == FSCK_FIX_CLEAR) {
+                writeLE(&entry[20], 2, 0);
+                writeLE(&entry[26], 2, 0);
+            } else if (fix.action == FSCK_FIX_TRUNCATE) {
+                if (writeFatEntry(fix.truncateAt, 0x0FFFFFFF) != 0) {
+                    return -5;
+                }
+            }
+            if ((entry[11] & 0x10) == 0) {
+                writeLE(&entry[28], 4, fix.size);
+            }
+        }
+        if (disk_write(0, _dirBuffer, fix.entrySector, 1) != RES_OK) {
+            return -5;
+        }
+        _report.repairs++;
+    }
+
+    // Lost clusters, only trusted when every directory was read
+    if (_report.skippedDirectories == 0) {
+        for (uint32_t cluster = 2 ; cluster < _clusterCount + 2 ; cluster++) {
+            if (!isMarked(cluster)) {
+                continue;
+            }
+            uint32_t value;
+            if (readFatEntry(cluster, value) != 0) {
+                return -2;
+            }
+            if (value != 0) {
+                if (writeFatEntry(cluster, 0) != 0) {
+                    return -5;
+                }
+                _report.repairs++;
+            }
+        }
+    } else {
+        _report.unrepaired += _report.lostClusters;
+    }
+    if (flushFatSector() != 0) {
+        return -5;
+    }
+
+    // FatFs writes the first FAT first, so it is the one to keep
+    _fatBufferSector = FSCK_NO_SECTOR;
+    _dirBufferSector = FSCK_NO_SECTOR;
+    for (uint32_t sector = 0 ; sector < _fatSectors ; sector++) {
+        if (disk_read(0, _dirBuffer, _fatStart + sector, 1) != RES_OK) {
+            return -2;
+        }
+        for (uint8_t copy = 1 ; copy < _fatCount ; copy++) {
+            uint32_t copySector = _fatStart + copy * _fatSectors + sector;
+            if (disk_read(0, _fatBuffer, copySector, 1) != RES_OK) {
+                return -2;
+            }
+            if (memcmp(_dirBuffer, _fatBuffer, QSPI_FLASH_FSCK_SECTOR_SIZE) != 0) {
+                if (disk_write(0, _dirBuffer, copySector, 1) != RES_OK) {
+                    return -5;
+                }
+                _report.repairs++;
+            }
+        }
+    }
+    _dirBufferSector = FSCK_NO_SECTOR;
+
+    _phase = FLASH_CHECK_DONE;
+    if (_flashMemory.remount() != 0) {
+        return -3;
+    }
+    return 0;
+}
+
+/*
+Method: loadDirectorySector()
+Description: Read a sector into the directory buffer (unless it is already there)
+Input:
+    uint32_t sector: Absolute sector number
+Output:
+     0: success
+    -2: error reading
+*/
+int FlashConsistencyChecker::loadDirectorySector(uint32_t sector) {
+    if (_dirBufferSector == sector) {
+        return 0;
+    }
+    _dirBufferSector = FSCK_NO_SECTOR;
+    if (disk_read(0, _dirBuffer, sector, 1) != RES_OK) {
+        return -2;
+    }
+    _dirBufferSector = sector;
+    return 0;
+}
+
+/*
+Method: loadFatSector()
+Description: Read a sector of the first FAT into the FAT buffer, writing back a modified one first
+Input:
+    uint32_t sector: Sector within the FAT
+Output:
+     0: success
+    -2: error reading
+    -5: error writing
+*/
+int FlashConsistencyChecker::loadFatSector(uint32_t sector) {
+    if (_fatBufferSector == sector) {
+        return 0;
+    }
+    if (flushFatSector() != 0) {
+        return -5;
+    }
+    _fatBufferSector = FSCK_NO_SECTOR;
+    if (disk_read(0, _fatBuffer, _fatStart + sector, 1) != RES_OK) {
+        return -2;
+    }
+    _fatBufferSector = sector;
+    return 0;
+}
+
+/*
+Method: flushFatSector()
+Description: Write a modified FAT buffer to every copy of the FAT
+Input: None
+Output:
+     0: success
+    -5: error writing
+*/
+int FlashConsistencyChecker::flushFatSector() {
+    if (!_fatBufferDirty) {
+        return 0;
+    }
+    for (uint8_t copy = 0 ; copy < _fatCount ; copy++) {
+        if (disk_write(0, _fatBuffer, _fatStart + copy * _fatSectors + _fatBufferSector, 1) != RES_OK) {
+            return -5;
+        }
+    }
+    _fatBufferDirty = false;
+    return 0;
+}
+
+/*
+Method: readFatEntry()
+Description: Read a cluster's FAT entry
+Input:
+    uint32_t cluster: Cluster number
+    uint32_t &value: Set to the entry (next cluster, 0 = free, or end of chain/bad marker)
+Output:
+     0: success
+    <0: error reading
+*/
+int FlashConsistencyChecker::readFatEntry(uint32_t cluster, uint32_t &value) {
+    uint32_t offset;
+    int result;
+    switch (_fatType) {
+        case 12: {
+            // 12 bit entries can straddle two sectors
+            offset = cluster + (cluster / 2);
+            if ((result = loadFatSector(offset / QSPI_FLASH_FSCK_SECTOR_SIZE)) != 0) {
+                return result;
+            }
+            uint32_t raw = _fatBuffer[offset % QSPI_FLASH_FSCK_SECTOR_SIZE];
+            offset++;
+            if ((result = loadFatSector(offset / QSPI_FLASH_FSCK_SECTOR_SIZE)) != 0) {
+                return result;
+            }
+            raw |= (uint32_t) _fatBuffer[offset % QSPI_FLASH_FSCK_SECTOR_SIZE] << 8;
+            value = (cluster & 1) ? (raw >> 4) : (raw & 0xFFF);
+            return 0;
+        }
+        case 16:
+            offset = cluster * 2;
+            if ((result = loadFatSector(offset / QSPI_FLASH_FSCK_SECTOR_SIZE)) != 0) {
+                return result;
+            }
+            value = readLE(&_fatBuffer[offset % QSPI_FLASH_FSCK_SECTOR_SIZE], 2);
+            return 0;
+        default:
+            offset = cluster * 4;
+            if ((result = loadFatSector(offset / QSPI_FLASH_FSCK_SECTOR_SIZE)) != 0) {
+                return result;
+            }
+            value = readLE(&_fatBuffer[offset % QSPI_FLASH_FSCK_SECTOR_SIZE], 4) & 0x0FFFFFFF;
+            return 0;
+    }
+}
+
+/*
+Method: writeFatEntry()
+Description: Change a cluster's FAT entry (written to every FAT copy when the buffer moves on)
+Input:
+    uint32_t cluster: Cluster number
+    uint32_t value: New entry, end of chain values are cut to the FAT width
+Output:
+     0: success
+    <0: error reading/writing
+*/
+int FlashConsistencyChecker::writeFatEntry(uint32_t cluster, uint32_t value) {
+    uint32_t offset;
+    int result;
+    uint8_t *data;
+    switch (_fatType) {
+        case 12:
+            value &= 0xFFF;
+            offset = cluster + (cluster / 2);
+            if ((result = loadFatSector(offset / QSPI_FLASH_FSCK_SECTOR_SIZE)) != 0) {
+                return result;
+            }
+            data = &_fatBuffer[offset % QSPI_FLASH_FSCK_SECTOR_SIZE];
+            *data = (cluster & 1) ? ((*data & 0x0F) | (value << 4)) : (value & 0xFF);
+            _fatBufferDirty = true;
+            offset++;
+            if ((result = loadFatSector(offset / QSPI_FLASH_FSCK_SECTOR_SIZE)) != 0) {
+                return result;
+            }
+            data = &_fatBuffer[offset % QSPI_FLASH_FSCK_SECTOR_SIZE];
+            *data = (cluster & 1) ? (value >> 4) : ((*data & 0xF0) | (value >> 8));
+            _fatBufferDirty = true;
+            return 0;
+        case 16:
+            offset = cluster * 2;
+            if ((result = loadFatSector(offset / QSPI_FLASH_FSCK_SECTOR_SIZE)) != 0) {
+                return result;
+            }
+            writeLE(&_fatBuffer[offset % QSPI_FLASH_FSCK_SECTOR_SIZE], 2, value & 0xFFFF);
+            _fatBufferDirty = true;
+            return 0;
+        default:
+            offset = cluster * 4;
+            if ((result = loadFatSector(offset / QSPI_FLASH_FSCK_SECTOR_SIZE)) != 0) {
+                return result;
+            }
+            data = &_fatBuffer[offset % QSPI_FLASH_FSCK_SECTOR_SIZE];
+            // The top 4 bits are reserved and kept as they are
+            writeLE(data, 4, (readLE(data, 4) & 0xF0000000) | (value & 0x0FFFFFFF));
+            _fatBufferDirty = true;
+            return 0;
+    }
+}
+
+/*
+Method: isValidCluster()
+Description: Check a FAT value names a data cluster on this volume
+Input:
+    uint32_t cluster: Cluster number
+Output:
+    true: 2 .. clusterCount + 1
+    false: free, reserved, bad, end of chain or out of range
+*/
+bool FlashConsistencyChecker::isValidCluster(uint32_t cluster) {
+    return cluster >= 2 && cluster < _clusterCount + 2;
+}
+
+/*
+Method: isEndOfChain()
+Description: Check for an end of chain marker
+Input:
+    uint32_t value: FAT entry
+Output:
+    true: end of chain
+    false: anything else
+*/
+bool FlashConsistencyChecker::isEndOfChain(uint32_t value) {
+    switch (_fatType) {
+        case 12:
+            return value >= 0xFF8;
+        case 16:
+            return value >= 0xFFF8;
+        default:
+            return value >= 0x0FFFFFF8;
+    }
+}
+
+/*
+Method: isMarked()
+Description: Read a cluster's bit (in use while walking, lost after the lost cluster check)
+Input:
+    uint32_t cluster: Cluster number
+Output: bool bit
+*/
+bool FlashConsistencyChecker::isMarked(uint32_t cluster) {
+    uint32_t bit = cluster - 2;
+    return (_bitmap[bit / 8] >> (bit % 8)) & 1;
+}
+
+/*
+Method: setMarked()
+Description: Set or clear a cluster's bit
+Input:
+    uint32_t cluster: Cluster number
+    bool marked: New value
+Output: N/A
+*/
+void FlashConsistencyChecker::setMarked(uint32_t cluster, bool marked) {
+    uint32_t bit = cluster - 2;
+    if (marked) {
+        _bitmap[bit / 8] |= (1 << (bit % 8));
+    } else {
+        _bitmap[bit / 8] &= ~(1 << (bit % 8));
+    }
+}
+
+/*
+Method: entryCluster()
+Description: First cluster of a directory entry (the high word is only used by FAT32)
+Input:
+    uint8_t entry[]: Directory entry
+Output: uint32_t cluster (0 = no clusters)
+*/
+uint32_t FlashConsistencyChecker::entryCluster(uint8_t entry[]) {
+    uint32_t cluster = readLE(&entry[26], 2);
+    if (_fatType == 32) {
+        cluster |= readLE(&entry[20], 2) << 16;
+    }
+    return cluster;
+}
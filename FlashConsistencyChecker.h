@@ -0,0 +1,168 @@
+#ifndef   _FLASHCONSISTENCYCHECKER_H
+#define   _FLASHCONSISTENCYCHECKER_H
+
+#include <Arduino.h>
+#include "QSPI_Flash.h"
+
+#define QSPI_FLASH_FSCK_SECTOR_SIZE 512
+#define QSPI_FLASH_FSCK_MAX_PASSES 4
+
+enum FlashCheckPhase {
+    FLASH_CHECK_IDLE,
+    FLASH_CHECK_FAT_COUNT,      // count allocated clusters
+    FLASH_CHECK_FAT_COPIES,     // compare the FAT copies
+    FLASH_CHECK_DIRECTORIES,    // walk every directory entry's cluster chain
+    FLASH_CHECK_LOST,           // find allocated clusters nothing refers to
+    FLASH_CHECK_DONE,
+    FLASH_CHECK_FAILED
+};
+
+/*
+Findings of a consistency check. Counts are for the last complete pass
+*/
+struct FlashCheckReport {
+    uint32_t clusters;              // data clusters on the volume
+    uint32_t allocatedClusters;     // non-free FAT entries
+    uint32_t directories;
+    uint32_t files;
+    uint32_t lostClusters;          // allocated but not reachable from any directory entry
+    uint32_t lostChains;
+    uint32_t crossLinks;            // chains that run into a cluster already in use, or loop
+    uint32_t badChains;             // chains pointing at a free, bad or out of range cluster
+    uint32_t badEntries;            // half-written directory entries
+    uint32_t sizeMismatches;        // file size doesn't match the chain length
+    uint32_t fatMismatches;         // FAT sectors whose copies differ
+    uint32_t skippedDirectories;    // deeper than QSPI_FLASH_FSCK_MAX_DEPTH (lost clusters not freed)
+    uint32_t repairs;               // directory entries fixed + FAT sectors rewritten + clusters freed
+    uint32_t unrepaired;            // findings left as they are
+    uint32_t passes;
+    uint32_t steps;
+    uint32_t totalMicros;
+    uint32_t maxStepMicros;
+};
+
+/*
+Incremental FAT consistency check for the QSPI flash volume, for use after brown-outs.
+
+begin() reads the volume geometry, then each fsckStep(budgetMicros) does a slice of work
+(one sector or a few dozen clusters at a time) until the budget is used, so it can run from
+loop() without blocking boot. The volume lock is held for the length of one step.
+
+With repair enabled and problems found, a second pass is run and repairs are only made if
+both passes agree (so files changed between steps aren't mistaken for damage). Repair then
+runs to completion in a single step: lost clusters are freed, broken or cross-linked chains
+are cut at the last good cluster, file sizes are clamped to their chains, half-written
+entries are removed and FAT copies are resynchronised. The filesystem is remounted after a
+repair, so File objects open at the time (including FlashTimeSeries/FlashKeyValueStore) must
+be reopened.
+*/
+class FlashConsistencyChecker {
+
+    public:
+        FlashConsistencyChecker(QSPIFlashMemory &flashMemory);
+        int begin();
+        int begin(bool repair);
+        int fsckStep(uint32_t budgetMicros);
+        bool isDone();
+        bool hasProblems();
+        uint8_t getProgress();
+        FlashCheckPhase getPhase();
+        FlashCheckReport getReport();
+    private:
+        struct Frame {
+            uint32_t cluster;           // current cluster of the directory, 0 = FAT12/16 root region
+            uint32_t clustersLeft;      // clusters of the directory still to read
+            uint32_t sector;            // sector within the cluster or root region
+            uint16_t entry;             // next entry within the sector
+        };
+        struct Fix {
+            uint32_t entrySector;
+            uint32_t startCluster;      // start cluster the entry had when checked
+            uint32_t truncateAt;        // cluster that becomes the end of the chain (0 = none)
+            uint32_t size;              // new file size
+            uint8_t entryIndex;
+            uint8_t action;
+        };
+        struct Summary {
+            uint32_t fingerprint;
+            uint32_t counts[9];
+        };
+
+        QSPIFlashMemory &_flashMemory;
+        FlashCheckPhase _phase = FLASH_CHECK_IDLE;
+        FlashCheckReport _report = {};
+        bool _repair = false;
+        int _result = 0;
+
+        // Volume geometry, sector numbers are absolute
+        uint8_t _fatType = 0;
+        uint8_t _fatCount = 0;
+        uint8_t _clusterSectors = 0;
+        uint32_t _fatStart = 0;
+        uint32_t _fatSectors = 0;
+        uint32_t _rootStart = 0;
+        uint32_t _rootSectors = 0;
+        uint32_t _rootCluster = 0;
+        uint32_t _dataStart = 0;
+        uint32_t _clusterCount = 0;
+
+        // Progress of the current pass
+        uint32_t _position = 0;
+        uint32_t _markedClusters = 0;
+        uint32_t _fingerprint = 0;
+        Summary _previous = {};
+        bool _havePrevious = false;
+
+        // Directory walk
+        Frame _stack[QSPI_FLASH_FSCK_MAX_DEPTH];
+        uint8_t _depth = 0;
+        bool _walking = false;
+        bool _walkDirectory = false;
+        uint32_t _walkStart = 0;
+        uint32_t _walkCluster = 0;
+        uint32_t _walkPrevious = 0;
+        uint32_t _walkCount = 0;
+        uint32_t _walkLimit = 0;
+        uint32_t _walkSize = 0;
+        uint32_t _walkEntrySector = 0;
+        uint8_t _walkEntryIndex = 0;
+
+        Fix _fixes[QSPI_FLASH_FSCK_MAX_REPAIRS];
+        uint8_t _fixCount = 0;
+
+        uint8_t _bitmap[(QSPI_FLASH_FSCK_MAX_CLUSTERS + 7) / 8];
+        uint8_t _fatBuffer[QSPI_FLASH_FSCK_SECTOR_SIZE];
+        uint32_t _fatBufferSector = 0;
+        bool _fatBufferDirty = false;
+        uint8_t _dirBuffer[QSPI_FLASH_FSCK_SECTOR_SIZE];
+        uint32_t _dirBufferSector = 0;
+
+        int readGeometry();
+        void startPass();
+        int finishPass();
+        int work();
+        int countStep();
+        int copiesStep();
+        int directoryStep();
+        int walkStep();
+        int lostStep();
+        void startWalk(uint32_t entrySector, uint8_t entryIndex, uint32_t startCluster, uint32_t size, bool directory);
+        void finishWalk();
+        void pushDirectory(uint32_t cluster, uint32_t clusterCount);
+        void addFix(uint32_t entrySector, uint8_t entryIndex, uint32_t startCluster, uint32_t truncateAt, uint32_t size, uint8_t action);
+        uint32_t countFindings();
+        bool isValidName(uint8_t entry[]);
+        int repair();
+        int loadDirectorySector(uint32_t sector);
+        int loadFatSector(uint32_t sector);
+        int flushFatSector();
+        int readFatEntry(uint32_t cluster, uint32_t &value);
+        int writeFatEntry(uint32_t cluster, uint32_t value);
+        bool isValidCluster(uint32_t cluster);
+        bool isEndOfChain(uint32_t value);
+        bool isMarked(uint32_t cluster);
+        void setMarked(uint32_t cluster, bool marked);
+        uint32_t entryCluster(uint8_t entry[]);
+};
+
+#endif // _FLASHCONSISTENCYCHECKER_H
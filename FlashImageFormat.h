@@ -0,0 +1,189 @@
+#ifndef   _FLASHIMAGEFORMAT_H
+#define   _FLASHIMAGEFORMAT_H
+
+#include <stdint.h>
+#include "FlashCRC32.h"
+
+/*
+Stream format of QSPIFlashMemory::exportImage()/importImage().
+Plain C++ (no Arduino dependency) so host-side tools can read and write images.
+All values little endian.
+
+    Image header (QSPI_FLASH_IMAGE_HEADER_SIZE bytes)
+    0       4     magic (QSPI_FLASH_IMAGE_MAGIC)
+    4       1     version (QSPI_FLASH_IMAGE_VERSION)
+    5       1     flags (QSPI_FLASH_IMAGE_FLAG_*)
+    6       2     reserved, 0
+    8       4     sector size
+    12      4     sector count of the chip
+    16      4     base fingerprint: flashImageManifestFingerprint() of the manifest a delta image
+                  was made against (0 for a full image). The receiver's chip must match it
+    20      4     CRC-32 of bytes 0 - 19
+
+    Frames, in increasing sector order, each starting with an 8 byte frame header
+    0       1     type (QSPI_FLASH_IMAGE_FRAME_*)
+    1       3     reserved, 0
+    4       4     sector number (END frame: number of frames before it)
+    8       n     DATA frames only: sector size bytes of sector contents (n = 0 for ERASED/END)
+    8+n     4     frame CRC, flashImageFrameCRC(): CRC-32 of the contents (if any) followed
+                  by the 8 header bytes. Every frame has it, ERASED and END included
+
+The CRC covers the contents first so it chains on from the sector's own CRC-32, which is
+also the value stored in a manifest (see QSPIFlashMemory::buildImageManifest()).
+Sectors without a frame are left as they are by an import.
+*/
+
+#define QSPI_FLASH_IMAGE_MAGIC 0x31494651UL     // "QFI1"
+#define QSPI_FLASH_IMAGE_VERSION 2
+#define QSPI_FLASH_IMAGE_HEADER_SIZE 24
+#define QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE 8
+
+// Only sectors differing from a manifest are included
+#define QSPI_FLASH_IMAGE_FLAG_DELTA 0x01
+
+#define QSPI_FLASH_IMAGE_FRAME_DATA 'D'
+#define QSPI_FLASH_IMAGE_FRAME_ERASED 'E'
+#define QSPI_FLASH_IMAGE_FRAME_END 'Z'
+
+// FlashImageStats::failedSector when no sector failed
+#define QSPI_FLASH_IMAGE_NO_SECTOR 0xFFFFFFFFUL
+
+inline void flashImagePut32(uint8_t data[], uint32_t value) {
+    data[0] = value & 0xFF;
+    data[1] = (value >> 8) & 0xFF;
+    data[2] = (value >> 16) & 0xFF;
+    data[3] = (value >> 24) & 0xFF;
+}
+
+inline uint32_t flashImageGet32(const uint8_t data[]) {
+    return (uint32_t) data[0] | ((uint32_t) data[1] << 8) | ((uint32_t) data[2] << 16) | ((uint32_t) data[3] << 24);
+}
+
+/*
+Method: flashImageEncodeHeader()
+Description: Build an image header
+Input:
+    uint8_t header[]: Destination, QSPI_FLASH_IMAGE_HEADER_SIZE bytes
+    uint32_t sectorSize: Bytes per sector
+    uint32_t sectorCount: Sectors on the chip
+    uint8_t flags: QSPI_FLASH_IMAGE_FLAG_* bits
+    uint32_t baseFingerprint: Fingerprint of the manifest a delta image is made against, 0 for a full image
+Output: N/A
+*/
+inline void flashImageEncodeHeader(uint8_t header[], uint32_t sectorSize, uint32_t sectorCount, uint8_t flags, uint32_t baseFingerprint = 0) {
+    flashImagePut32(&header[0], QSPI_FLASH_IMAGE_MAGIC);
+    header[4] = QSPI_FLASH_IMAGE_VERSION;
+    header[5] = flags;
+    header[6] = 0;
+    header[7] = 0;
+    flashImagePut32(&header[8], sectorSize);
+    flashImagePut32(&header[12], sectorCount);
+    flashImagePut32(&header[16], baseFingerprint);
+    flashImagePut32(&header[20], flashCRC32(header, 20));
+}
+
+/*
+Method: flashImageDecodeHeader()
+Description: Validate and unpack an image header
+Input:
+    const uint8_t header[]: QSPI_FLASH_IMAGE_HEADER_SIZE bytes
+    uint32_t &sectorSize: Set to the bytes per sector
+    uint32_t &sectorCount: Set to the sector count
+    uint8_t &flags: Set to the flags
+    uint32_t &baseFingerprint: Set to the base fingerprint (delta images)
+Output:
+     0: valid
+    -1: not an image header, unsupported version or corrupt
+*/
+inline int flashImageDecodeHeader(const uint8_t header[], uint32_t &sectorSize, uint32_t &sectorCount, uint8_t &flags, uint32_t &baseFingerprint) {
+    if (flashImageGet32(&header[0]) != QSPI_FLASH_IMAGE_MAGIC || header[4] != QSPI_FLASH_IMAGE_VERSION
+        || flashImageGet32(&header[20]) != flashCRC32(header, 20)) {
+        return -1;
+    }
+    flags = header[5];
+    sectorSize = flashImageGet32(&header[8]);
+    sectorCount = flashImageGet32(&header[12]);
+    baseFingerprint = flashImageGet32(&header[16]);
+    return 0;
+}
+
+/*
+Method: flashImageFingerprintAdd()
+Description: Add the next sector's CRC-32 to a manifest fingerprint
+Input:
+    uint32_t fingerprint: Fingerprint so far (0 before the first sector)
+    uint32_t sectorCRC: flashCRC32() of the sector
+Output: uint32_t fingerprint
+*/
+inline uint32_t flashImageFingerprintAdd(uint32_t fingerprint, uint32_t sectorCRC) {
+    uint8_t data[4];
+    flashImagePut32(data, sectorCRC);
+    return flashCRC32(data, sizeof(data), fingerprint);
+}
+
+/*
+Method: flashImageManifestFingerprint()
+Description: CRC-32 over a whole manifest (each sector CRC little endian, in sector order),
+             identifying the chip contents a delta image was made against
+Input:
+    const uint32_t manifest[]: One CRC-32 per sector
+    uint32_t sectorCount: Entries in manifest[]
+Output: uint32_t fingerprint
+*/
+inline uint32_t flashImageManifestFingerprint(const uint32_t manifest[], uint32_t sectorCount) {
+    uint32_t fingerprint = 0;
+    for (uint32_t sector = 0 ; sector < sectorCount ; sector++) {
+        fingerprint = flashImageFingerprintAdd(fingerprint, manifest[sector]);
+    }
+    return fingerprint;
+}
+
+/*
+Method: flashImageEncodeFrameHeader()
+Description: Build a frame header
+Input:
+    uint8_t frame[]: Destination, QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE bytes
+    uint8_t type: QSPI_FLASH_IMAGE_FRAME_*
+    uint32_t sector: Sector number (END: frame count)
+Output: N/A
+*/
+inline void flashImageEncodeFrameHeader(uint8_t frame[], uint8_t type, uint32_t sector) {
+    frame[0] = type;
+    frame[1] = 0;
+    frame[2] = 0;
+    frame[3] = 0;
+    flashImagePut32(&frame[4], sector);
+}
+
+/*
+Method: flashImageFrameCRC()
+Description: CRC that ends a frame
+Input:
+    const uint8_t frame[]: Frame header
+    uint32_t contentCRC: flashCRC32() of the sector contents (0 for ERASED/END frames)
+Output: uint32_t CRC
+*/
+inline uint32_t flashImageFrameCRC(const uint8_t frame[], uint32_t contentCRC) {
+    return flashCRC32(frame, QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE, contentCRC);
+}
+
+/*
+Method: flashImageIsErased()
+Description: Check if a buffer is all 0xFF (erased flash)
+Input:
+    const uint8_t data[]: Bytes to check
+    uint32_t length: Number of bytes
+Output:
+    true: all 0xFF
+    false: programmed data present
+*/
+inline bool flashImageIsErased(const uint8_t data[], uint32_t length) {
+    for (uint32_t i = 0 ; i < length ; i++) {
+        if (data[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif // _FLASHIMAGEFORMAT_H
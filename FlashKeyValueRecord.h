@@ -0,0 +1,88 @@
+#ifndef   _FLASHKEYVALUERECORD_H
+#define   _FLASHKEYVALUERECORD_H
+
+#include <stdint.h>
+#include <string.h>
+#include "FlashCRC32.h"
+#include "QSPI_Flash_Config.h"
+
+/*
+On-flash record layout of the FlashKeyValueStore log.
+Plain C++ (no Arduino dependency) so host-side tools can write logs the device reads.
+
+The log is a file of fixed-size records, newest last. A later record for a key supersedes
+earlier ones, a record with the REMOVED flag deletes the key.
+
+    Offset  Size  Field
+    0       1     magic (QSPI_FLASH_KV_RECORD_MAGIC)
+    1       1     flags
+    2       1     key length
+    3       1     value length
+    4       n     key bytes followed by value bytes, zero padded
+    size-4  4     CRC-32 of bytes 0 .. size-5 (little endian)
+*/
+
+#define QSPI_FLASH_KV_DEFAULT_DIRECTORY "/.config"
+#define QSPI_FLASH_KV_DEFAULT_FILENAME  "kv.log"
+
+#define QSPI_FLASH_KV_RECORD_MAGIC 0xA5
+#define QSPI_FLASH_KV_FLAG_REMOVED 0x01
+#define QSPI_FLASH_KV_DATA_SIZE (QSPI_FLASH_KV_RECORD_SIZE - 8)
+
+/*
+Method: flashKVEncodeRecord()
+Description: Build a log record
+Input:
+    uint8_t record[]: Destination, QSPI_FLASH_KV_RECORD_SIZE bytes
+    const char key[]: Key bytes (not NUL-terminated)
+    uint8_t keyLength: Key length (1 or more)
+    const uint8_t value[]: Value bytes (may be NULL for a removal)
+    uint8_t valueLength: Value length
+    uint8_t flags: 0 or QSPI_FLASH_KV_FLAG_REMOVED
+Output:
+     0: success
+    -1: key and value don't fit in one record
+*/
+inline int flashKVEncodeRecord(uint8_t record[], const char key[], uint8_t keyLength, const uint8_t value[], uint8_t valueLength, uint8_t flags) {
+    if (keyLength == 0 || (uint16_t) keyLength + valueLength > QSPI_FLASH_KV_DATA_SIZE) {
+        return -1;
+    }
+    memset(record, 0, QSPI_FLASH_KV_RECORD_SIZE);
+    record[0] = QSPI_FLASH_KV_RECORD_MAGIC;
+    record[1] = flags;
+    record[2] = keyLength;
+    record[3] = valueLength;
+    memcpy(&record[4], key, keyLength);
+    if (valueLength > 0) {
+        memcpy(&record[4 + keyLength], value, valueLength);
+    }
+    uint32_t crc = flashCRC32(record, QSPI_FLASH_KV_RECORD_SIZE - 4);
+    record[QSPI_FLASH_KV_RECORD_SIZE - 4] = crc & 0xFF;
+    record[QSPI_FLASH_KV_RECORD_SIZE - 3] = (crc >> 8) & 0xFF;
+    record[QSPI_FLASH_KV_RECORD_SIZE - 2] = (crc >> 16) & 0xFF;
+    record[QSPI_FLASH_KV_RECORD_SIZE - 1] = (crc >> 24) & 0xFF;
+    return 0;
+}
+
+/*
+Method: flashKVCheckRecord()
+Description: Validate a record read back from the log (torn writes fail the CRC)
+Input:
+    const uint8_t record[]: QSPI_FLASH_KV_RECORD_SIZE bytes
+Output:
+    true: record is intact
+    false: record is blank, torn or corrupt
+*/
+inline bool flashKVCheckRecord(const uint8_t record[]) {
+    if (record[0] != QSPI_FLASH_KV_RECORD_MAGIC || record[2] == 0
+        || (uint16_t) record[2] + record[3] > QSPI_FLASH_KV_DATA_SIZE) {
+        return false;
+    }
+    uint32_t crc = (uint32_t) record[QSPI_FLASH_KV_RECORD_SIZE - 4]
+                 | ((uint32_t) record[QSPI_FLASH_KV_RECORD_SIZE - 3] << 8)
+                 | ((uint32_t) record[QSPI_FLASH_KV_RECORD_SIZE - 2] << 16)
+                 | ((uint32_t) record[QSPI_FLASH_KV_RECORD_SIZE - 1] << 24);
+    return crc == flashCRC32(record, QSPI_FLASH_KV_RECORD_SIZE - 4);
+}
+
+#endif // _FLASHKEYVALUERECORD_H
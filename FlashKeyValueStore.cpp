@@ -0,0 +1,606 @@
+#include "FlashKeyValueStore.h"
+
+#define INDEX_EMPTY   0xFFFFFFFFUL
+#define INDEX_REMOVED 0xFFFFFFFEUL
+#define INDEX_MASK    (QSPI_FLASH_KV_INDEX_SIZE - 1)
+#define MAX_LIVE_KEYS ((QSPI_FLASH_KV_INDEX_SIZE * 3) / 4)
+
+FlashKeyValueStore::FlashKeyValueStore(QSPIFlashMemory &flashMemory) : _flashMemory(flashMemory) {
+    _directory[0] = 0;
+    _filename[0] = 0;
+    clearIndex();
+}
+
+/*
+Method: begin()
+Description: Open the store at the default location (/.config/kv.log) and rebuild the index
+Input: None
+Output: See begin(directory, filename)
+*/
+int FlashKeyValueStore::begin() {
+    char directory[] = QSPI_FLASH_KV_DEFAULT_DIRECTORY;
+    char filename[] = QSPI_FLASH_KV_DEFAULT_FILENAME;
+    return begin(directory, filename);
+}
+
+/*
+Method: begin()
+Description: Open (or create) the store log and rebuild the in-RAM index with one sequential scan.
+             Finishes an interrupted compaction if one is found
+Input:
+    char directory[]: user-specified directory (leading /)
+    char filename[]: User-specified log filename (with extension)
+Output:
+     0: success
+    -1: directory or filename too long
+    -2: log could not be opened or created
+    -3: Filesystem could not be mounted/accessed
+    -4: log holds more live keys than the index can track (QSPI_FLASH_KV_INDEX_SIZE)
+*/
+int FlashKeyValueStore::begin(char directory[], char filename[]) {
+    if (strlen(directory) >= sizeof(_directory) || strlen(filename) + 4 >= sizeof(_filename)) {
+        return -1;
+    }
+    end();
+    strcpy(_directory, directory);
+    strcpy(_filename, filename);
+    return openStore();
+}
+
+/*
+Method: openStore()
+Description: Open (or create) the log at _directory/_filename, finish an interrupted compaction
+             and rebuild the index. Takes the locks itself
+Input: None
+Output: See begin(directory, filename)
+*/
+int FlashKeyValueStore::openStore() {
+    if (_flashMemory.mount() != 0) {
+        return -3;
+    }
+    // -1 means it already exists
+    int res = _flashMemory.createDirectory(_directory);
+    if (res != 0 && res != -1) {
+        return -2;
+    }
+
+    FlashLockGuard fileGuard(_flashMemory.getFileLock(_directory, _filename));
+    FlashLockGuard volumeGuard(_flashMemory.getVolumeLock());
+    Adafruit_W25Q16BV_FatFs &fatfs = _flashMemory.getFlashFileSystemInterface();
+
+    FlashPathBuffer logPath;
+    FlashPathBuffer tmpPath;
+    char tmpName[sizeof(_filename)];
+    strcpy(tmpName, _filename);
+    strcat(tmpName, ".tmp");
+    if (_flashMemory.path.resolve(logPath, _directory, _filename) != 0
+        || _flashMemory.path.resolve(tmpPath, _directory, tmpName) != 0) {
+        return -1;
+    }
+    if (fatfs.exists(tmpPath)) {
+        if (fatfs.exists(logPath)) {
+            // Compaction didn't finish writing the new log, the old one is still complete
+            fatfs.remove(tmpPath);
+        } else {
+            // Compaction finished but was interrupted before the rename
+            f_rename(tmpPath, logPath);
+        }
+    }
+
+    if (openLog(logPath) != 0) {
+        return -2;
+    }
+    return rebuildIndex();
+}
+
+/*
+Method: reopenIfRemounted()
+Description: Re-open the log if the filesystem was mounted again since it was opened: the open
+             File is no longer valid and the log may have changed (or be gone after a format).
+             Called before the locks are taken, like begin()
+Input: None
+Output:
+     0: log usable
+    -2: log could not be re-opened (the store is closed)
+*/
+int FlashKeyValueStore::reopenIfRemounted() {
+    {
+        FlashLockGuard volumeGuard(_flashMemory.getVolumeLock());
+        if (_flashMemory.mount() != 0) {
+            return -2;
+        }
+        if (_flashMemory.getMountCount() == _logMount) {
+            return 0;
+        }
+        _log.close();
+        _open = false;
+    }
+    // -4 (index full) leaves the store open, as it does for begin()
+    int res = openStore();
+    return (res == 0 || res == -4) ? 0 : -2;
+}
+
+/*
+Method: end()
+Description: Close the store log
+Input: None
+Output: N/A
+*/
+void FlashKeyValueStore::end() {
+    if (_open) {
+        FlashLockGuard volumeGuard(_flashMemory.getVolumeLock());
+        _log.close();
+        _open = false;
+    }
+    clearIndex();
+}
+
+/*
+Method: get()
+Description: Look up a key (one index probe and one record read)
+Input:
+    char key[]: NUL-terminated key
+    uint8_t value[]: Destination for the value
+    uint8_t maxLength: Size of value[], longer values are truncated
+Output:
+    >= 0: Length of the stored value
+      -1: Key not found
+      -2: error reading the log
+      -3: store not open
+*/
+int FlashKeyValueStore::get(char key[], uint8_t value[], uint8_t maxLength) {
+    if (!_open) {
+        return -3;
+    }
+    size_t keyLength = strlen(key);
+    if (keyLength == 0 || keyLength > QSPI_FLASH_KV_DATA_SIZE) {
+        return -1;
+    }
+    if (reopenIfRemounted() != 0) {
+        return -2;
+    }
+    FlashLockGuard fileGuard(_flashMemory.getFileLock(_directory, _filename));
+    FlashLockGuard volumeGuard(_flashMemory.getVolumeLock());
+
+    int slot = findSlot(key, keyLength, hashKey(key, keyLength), false);
+    if (slot == -2) {
+        return -2;
+    }
+    if (slot < 0) {
+        return -1;
+    }
+    // findSlot() leaves the matching record in _record
+    uint8_t valueLength = _record[3];
+    memcpy(value, &_record[4 + keyLength], (valueLength < maxLength) ? valueLength : maxLength);
+    return valueLength;
+}
+
+/*
+Method: put()
+Description: Store a value, appending one record to the log (skipped if the value is unchanged)
+Input:
+    char key[]: NUL-terminated key
+    uint8_t value[]: Value bytes
+    uint8_t valueLength: Value length, key + value must fit in QSPI_FLASH_KV_DATA_SIZE
+Output:
+     0: success
+    -1: key/value too long
+    -2: error writing the log
+    -3: store not open
+    -4: index full (too many keys)
+    -5: log full even after compaction
+*/
+int FlashKeyValueStore::put(char key[], uint8_t value[], uint8_t valueLength) {
+    if (!_open) {
+        return -3;
+    }
+    size_t keyLength = strlen(key);
+    if (keyLength == 0 || keyLength + valueLength > QSPI_FLASH_KV_DATA_SIZE) {
+        return -1;
+    }
+    if (reopenIfRemounted() != 0) {
+        return -2;
+    }
+    FlashLockGuard fileGuard(_flashMemory.getFileLock(_directory, _filename));
+    FlashLockGuard volumeGuard(_flashMemory.getVolumeLock());
+
+    uint32_t hash = hashKey(key, keyLength);
+    int slot = findSlot(key, keyLength, hash, false);
+    if (slot == -2) {
+        return -2;
+    }
+    if (slot >= 0 && _record[3] == valueLength && memcmp(&_record[4 + keyLength], value, valueLength) == 0) {
+        return 0;
+    }
+    if (slot < 0 && _liveCount >= MAX_LIVE_KEYS) {
+        return -4;
+    }
+
+    if (_logSize + QSPI_FLASH_KV_RECORD_SIZE > QSPI_FLASH_KV_MAX_LOG_SIZE) {
+        if (compact() != 0 || _logSize + QSPI_FLASH_KV_RECORD_SIZE > QSPI_FLASH_KV_MAX_LOG_SIZE) {
+            return -5;
+        }
+        // Compaction moved every record
+        slot = findSlot(key, keyLength, hash, false);
+    }
+
+    uint32_t offset;
+    if (appendRecord(key, keyLength, value, valueLength, 0, offset) != 0) {
+        return -2;
+    }
+    if (slot < 0) {
+        slot = findSlot(key, keyLength, hash, true);
+        _index[slot].hash = hash;
+        _liveCount++;
+    }
+    _index[slot].offset = offset;
+    return 0;
+}
+
+/*
+Method: put()
+Description: Store a NUL-terminated string value (terminator not stored)
+Input:
+    char key[]: NUL-terminated key
+    char value[]: NUL-terminated value
+Output: See put(key, value, valueLength)
+*/
+int FlashKeyValueStore::put(char key[], char value[]) {
+    size_t valueLength = strlen(value);
+    if (valueLength > QSPI_FLASH_KV_DATA_SIZE) {
+        return -1;
+    }
+    return put(key, (uint8_t *) value, valueLength);
+}
+
+/*
+Method: remove()
+Description: Delete a key by appending a removal record
+Input:
+    char key[]: NUL-terminated key
+Output:
+     0: success
+    -1: Key not found
+    -2: error writing the log
+    -3: store not open
+    -5: log full even after compaction
+*/
+int FlashKeyValueStore::remove(char key[]) {
+    if (!_open) {
+        return -3;
+    }
+    size_t keyLength = strlen(key);
+    if (keyLength == 0 || keyLength > QSPI_FLASH_KV_DATA_SIZE) {
+        return -1;
+    }
+    if (reopenIfRemounted() != 0) {
+        return -2;
+    }
+    FlashLockGuard fileGuard(_flashMemory.getFileLock(_directory, _filename));
+    FlashLockGuard volumeGuard(_flashMemory.getVolumeLock());
+
+    uint32_t hash = hashKey(key, keyLength);
+    int slot = findSlot(key, keyLength, hash, false);
+    if (slot == -2) {
+        return -2;
+    }
+    if (slot < 0) {
+        return -1;
+    }
+    if (_logSize + QSPI_FLASH_KV_RECORD_SIZE > QSPI_FLASH_KV_MAX_LOG_SIZE) {
+        if (compact() != 0 || _logSize + QSPI_FLASH_KV_RECORD_SIZE > QSPI_FLASH_KV_MAX_LOG_SIZE) {
+            return -5;
+        }
+        slot = findSlot(key, keyLength, hash, false);
+    }
+
+    uint32_t offset;
+    if (appendRecord(key, keyLength, NULL, 0, QSPI_FLASH_KV_FLAG_REMOVED, offset) != 0) {
+        return -2;
+    }
+    _index[slot].offset = INDEX_REMOVED;
+    _liveCount--;
+    return 0;
+}
+
+/*
+Method: contains()
+Description: Check if a key is stored
+Input:
+    char key[]: NUL-terminated key
+Output:
+    true: Key exists
+    false: Key doesn't exist or the store is not open
+*/
+bool FlashKeyValueStore::contains(char key[]) {
+    uint8_t value;
+    return get(key, &value, 0) >= 0;
+}
+
+/*
+Method: maintain()
+Description: Compact the log early if it is mostly superseded records.
+             Cheap when there is nothing to do, call it from idle time
+Input: None
+Output:
+     1: log was compacted
+     0: nothing to do
+    <0: compaction error, see compact()
+*/
+int FlashKeyValueStore::maintain() {
+    if (!_open) {
+        return -3;
+    }
+    uint32_t records = _logSize / QSPI_FLASH_KV_RECORD_SIZE;
+    if (_logSize < QSPI_FLASH_KV_MAX_LOG_SIZE / 2 || records - _liveCount < _liveCount) {
+        return 0;
+    }
+    int res = compact();
+    return (res == 0) ? 1 : res;
+}
+
+/*
+Method: compact()
+Description: Rewrite the log with only the live records. The new log is written to <filename>.tmp
+             and renamed over the old one, so an interruption leaves one complete log (see begin())
+Input: None
+Output:
+     0: success
+    -1: log path could not be resolved
+    -2: error reading or writing the log
+    -3: store not open
+*/
+int FlashKeyValueStore::compact() {
+    if (!_open) {
+        return -3;
+    }
+    if (reopenIfRemounted() != 0) {
+        return -2;
+    }
+    FlashLockGuard fileGuard(_flashMemory.getFileLock(_directory, _filename));
+    FlashLockGuard volumeGuard(_flashMemory.getVolumeLock());
+    Adafruit_W25Q16BV_FatFs &fatfs = _flashMemory.getFlashFileSystemInterface();
+
+    FlashPathBuffer logPath;
+    FlashPathBuffer tmpPath;
+    char tmpName[sizeof(_filename)];
+    strcpy(tmpName, _filename);
+    strcat(tmpName, ".tmp");
+    if (_flashMemory.path.resolve(logPath, _directory, _filename) != 0
+        || _flashMemory.path.resolve(tmpPath, _directory, tmpName) != 0) {
+        return -1;
+    }
+
+    fatfs.remove(tmpPath);
+    File tmp = fatfs.open(tmpPath, FILE_WRITE);
+    if (!tmp) {
+        return -2;
+    }
+    for (uint16_t i = 0 ; i < QSPI_FLASH_KV_INDEX_SIZE ; i++) {
+        if (_index[i].offset >= INDEX_REMOVED) {
+            continue;
+        }
+        if (readRecord(_index[i].offset) != 0
+            || tmp.write(_record, QSPI_FLASH_KV_RECORD_SIZE) != QSPI_FLASH_KV_RECORD_SIZE) {
+            tmp.close();
+            fatfs.remove(tmpPath);
+            return -2;
+        }
+    }
+    tmp.flush();
+    tmp.close();
+
+    _log.close();
+    _open = false;
+    fatfs.remove(logPath);
+    if (f_rename(tmpPath, logPath) != FR_OK || openLog(logPath) != 0) {
+        return -2;
+    }
+    return (rebuildIndex() == 0) ? 0 : -2;
+}
+
+/*
+Method: getKeyCount()
+Description: Number of live keys
+Input: None
+Output: uint16_t key count
+*/
+uint16_t FlashKeyValueStore::getKeyCount() {
+    return _liveCount;
+}
+
+/*
+Method: getLogSize()
+Description: Current size of the log in bytes (live and superseded records)
+Input: None
+Output: uint32_t log size
+*/
+uint32_t FlashKeyValueStore::getLogSize() {
+    return _logSize;
+}
+
+/*
+Method: openLog()
+Description: Open the log file for reading and appending (caller holds the locks)
+Input:
+    char logPath[]: Resolved path of the log
+Output:
+     0: success
+    -1: error opening
+*/
+int FlashKeyValueStore::openLog(char logPath[]) {
+    _log = _flashMemory.getFlashFileSystemInterface().open(logPath, FILE_WRITE);
+    if (!_log) {
+        return -1;
+    }
+    _open = true;
+    _logMount = _flashMemory.getMountCount();
+    return 0;
+}
+
+/*
+Method: rebuildIndex()
+Description: Scan the log from the start and index the newest record of every key.
+             Torn or corrupt records are skipped (caller holds the locks)
+Input: None
+Output:
+     0: success
+    -2: error reading the log
+    -4: more live keys than the index can track
+*/
+int FlashKeyValueStore::rebuildIndex() {
+    clearIndex();
+    uint32_t size = _log.size();
+    // A torn final record is skipped and the next append starts on a record boundary
+    _logSize = ((size + QSPI_FLASH_KV_RECORD_SIZE - 1) / QSPI_FLASH_KV_RECORD_SIZE) * QSPI_FLASH_KV_RECORD_SIZE;
+
+    char key[QSPI_FLASH_KV_DATA_SIZE];
+    int res = 0;
+    for (uint32_t offset = 0 ; offset + QSPI_FLASH_KV_RECORD_SIZE <= size ; offset += QSPI_FLASH_KV_RECORD_SIZE) {
+        if (readRecord(offset) != 0) {
+            return -2;
+        }
+        if (!flashKVCheckRecord(_record)) {
+            continue;
+        }
+        uint8_t keyLength = _record[2];
+        bool removed = (_record[1] & QSPI_FLASH_KV_FLAG_REMOVED) != 0;
+        memcpy(key, &_record[4], keyLength);
+
+        uint32_t hash = hashKey(key, keyLength);
+        int slot = findSlot(key, keyLength, hash, false);
+        if (slot == -2) {
+            return -2;
+        }
+        if (removed) {
+            if (slot >= 0) {
+                _index[slot].offset = INDEX_REMOVED;
+                _liveCount--;
+            }
+            continue;
+        }
+        if (slot < 0) {
+            if (_liveCount >= MAX_LIVE_KEYS) {
+                res = -4;
+                continue;
+            }
+            slot = findSlot(key, keyLength, hash, true);
+            _index[slot].hash = hash;
+            _liveCount++;
+        }
+        _index[slot].offset = offset;
+    }
+    return res;
+}
+
+/*
+Method: clearIndex()
+Description: Empty the in-RAM index
+Input: None
+Output: N/A
+*/
+void FlashKeyValueStore::clearIndex() {
+    for (uint16_t i = 0 ; i < QSPI_FLASH_KV_INDEX_SIZE ; i++) {
+        _index[i].hash = 0;
+        _index[i].offset = INDEX_EMPTY;
+    }
+    _liveCount = 0;
+}
+
+/*
+Method: findSlot()
+Description: Probe the index for a key. Hash matches are confirmed against the key stored in the log
+Input:
+    char key[]: Key bytes
+    uint8_t keyLength: Key length
+    uint32_t hash: hashKey() of the key
+    bool forInsert: false = find the key's slot, true = find a free slot for a new key
+Output:
+    >= 0: slot index (when found, the key's record is left in _record)
+      -1: not found / no free slot
+      -2: error reading the log
+*/
+int FlashKeyValueStore::findSlot(char key[], uint8_t keyLength, uint32_t hash, bool forInsert) {
+    uint16_t slot = hash & INDEX_MASK;
+    for (uint16_t probe = 0 ; probe < QSPI_FLASH_KV_INDEX_SIZE ; probe++, slot = (slot + 1) & INDEX_MASK) {
+        IndexEntry &entry = _index[slot];
+        if (forInsert) {
+            if (entry.offset >= INDEX_REMOVED) {
+                return slot;
+            }
+            continue;
+        }
+        if (entry.offset == INDEX_EMPTY) {
+            return -1;
+        }
+        if (entry.offset == INDEX_REMOVED || entry.hash != hash) {
+            continue;
+        }
+        if (readRecord(entry.offset) != 0) {
+            return -2;
+        }
+        if (_record[2] == keyLength && memcmp(&_record[4], key, keyLength) == 0) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+/*
+Method: readRecord()
+Description: Read one record from the log into _record
+Input:
+    uint32_t offset: Record offset in the log
+Output:
+     0: success
+    -1: error reading
+*/
+int FlashKeyValueStore::readRecord(uint32_t offset) {
+    if (!_log.seek(offset) || _log.read(_record, QSPI_FLASH_KV_RECORD_SIZE) != QSPI_FLASH_KV_RECORD_SIZE) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+Method: appendRecord()
+Description: Append one record to the end of the log and flush it to flash
+Input:
+    char key[]: Key bytes
+    uint8_t keyLength: Key length
+    uint8_t value[]: Value bytes (NULL for a removal)
+    uint8_t valueLength: Value length
+    uint8_t flags: Record flags
+    uint32_t &offset: Set to the offset the record was written at
+Output:
+     0: success
+    -1: error writing
+*/
+int FlashKeyValueStore::appendRecord(char key[], uint8_t keyLength, uint8_t value[], uint8_t valueLength, uint8_t flags, uint32_t &offset) {
+    if (flashKVEncodeRecord(_record, key, keyLength, value, valueLength, flags) != 0) {
+        return -1;
+    }
+    offset = _logSize;
+    if (!_log.seek(offset) || _log.write(_record, QSPI_FLASH_KV_RECORD_SIZE) != QSPI_FLASH_KV_RECORD_SIZE) {
+        return -1;
+    }
+    _log.flush();
+    _logSize += QSPI_FLASH_KV_RECORD_SIZE;
+    return 0;
+}
+
+/*
+Method: hashKey()
+Description: FNV-1a hash of a key for the index
+Input:
+    char key[]: Key bytes
+    uint8_t keyLength: Key length
+Output: uint32_t hash
+*/
+uint32_t FlashKeyValueStore::hashKey(char key[], uint8_t keyLength) {
+    uint32_t hash = 2166136261UL;
+    for (uint8_t i = 0 ; i < keyLength ; i++) {
+        hash = (hash ^ (uint8_t) key[i]) * 16777619UL;
+    }
+    return hash;
+}
@@ -0,0 +1,70 @@
+#ifndef   _FLASHKEYVALUESTORE_H
+#define   _FLASHKEYVALUESTORE_H
+
+#include <Arduino.h>
+#include "QSPI_Flash.h"
+#include "FlashKeyValueRecord.h"
+
+/*
+Compact key-value store for small settings, kept as an append-only log in one file
+(see FlashKeyValueRecord.h for the record layout).
+
+An in-RAM hash index maps each key's 32-bit hash to the offset of its newest record, so
+get/put/remove never scan the log. The index holds no key bytes: each call still reads that one
+record from flash to confirm the key (and get() takes the value from it). Keys whose hashes collide
+cost one extra record read each. Every update appends exactly one record. When the log grows past QSPI_FLASH_KV_MAX_LOG_SIZE the
+live records are copied to a fresh log; call maintain() from idle time to do that early.
+
+The append is a FatFs write plus flush, not a single page program: the log's data sector and its
+directory entry are rewritten on every update, and the FAT too when the log enters a new cluster.
+Each of those 512 byte writes is a read-erase-program of the 4KB flash sector holding it.
+
+The log stays open between calls. When the filesystem has been mounted again since (format(),
+raw page writes, importImage(), a FlashConsistencyChecker repair) the next call re-opens the log
+and rebuilds the index from it before going on.
+*/
+class FlashKeyValueStore {
+
+    public:
+        FlashKeyValueStore(QSPIFlashMemory &flashMemory);
+        int begin();
+        int begin(char directory[], char filename[]);
+        void end();
+        int get(char key[], uint8_t value[], uint8_t maxLength);
+        int put(char key[], uint8_t value[], uint8_t valueLength);
+        int put(char key[], char value[]);
+        int remove(char key[]);
+        bool contains(char key[]);
+        int maintain();
+        int compact();
+        uint16_t getKeyCount();
+        uint32_t getLogSize();
+    private:
+        struct IndexEntry {
+            uint32_t hash;
+            uint32_t offset;
+        };
+
+        QSPIFlashMemory &_flashMemory;
+        char _directory[QSPI_FLASH_MAX_DIRECTORY_LENGTH];
+        char _filename[QSPI_FLASH_MAX_FILENAME_LENGTH];
+        File _log;
+        bool _open = false;
+        uint32_t _logMount = 0;
+        uint32_t _logSize = 0;
+        uint16_t _liveCount = 0;
+        IndexEntry _index[QSPI_FLASH_KV_INDEX_SIZE];
+        uint8_t _record[QSPI_FLASH_KV_RECORD_SIZE];
+
+        int openStore();
+        int reopenIfRemounted();
+        int openLog(char logPath[]);
+        int rebuildIndex();
+        void clearIndex();
+        int findSlot(char key[], uint8_t keyLength, uint32_t hash, bool forInsert);
+        int readRecord(uint32_t offset);
+        int appendRecord(char key[], uint8_t keyLength, uint8_t value[], uint8_t valueLength, uint8_t flags, uint32_t &offset);
+        static uint32_t hashKey(char key[], uint8_t keyLength);
+};
+
+#endif // _FLASHKEYVALUESTORE_H
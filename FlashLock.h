@@ -0,0 +1,82 @@
+#ifndef   _FLASHLOCK_H
+#define   _FLASHLOCK_H
+
+#include <stddef.h>
+
+/*
+Locking for concurrent use of QSPIFlashMemory (e.g. several FreeRTOS tasks).
+
+QSPIFlashMemory uses two kinds of lock, both optional (NULL = no locking):
+    Volume lock: serialises every FatFs call. Held only for the duration of the FatFs work,
+                 so long reads are broken into chunks and other tasks can run in between.
+    File locks:  a small table of striped locks picked by a hash of directory + filename.
+                 Held for a whole helper call so two tasks never interleave on the same file,
+                 while tasks working on different files only contend on the volume lock.
+
+Locks MUST be recursive (helpers call each other). A file lock is always taken before the
+volume lock, never the other way round.
+
+Implementations below are header-only so the sketch decides which one is compiled in:
+    FlashFreeRTOSLock:  define QSPI_FLASH_USE_FREERTOS (or include FreeRTOS.h first)
+    FlashStdMutexLock:  define QSPI_FLASH_USE_STD_MUTEX (host builds)
+*/
+
+class FlashLock {
+
+    public:
+        virtual ~FlashLock() {}
+        virtual void lock() = 0;
+        virtual void unlock() = 0;
+};
+
+/*
+Class: FlashLockGuard
+Description: Scoped lock holder, does nothing when given a NULL lock
+*/
+class FlashLockGuard {
+
+    public:
+        FlashLockGuard(FlashLock *lock) : _lock(lock) {
+            if (_lock != NULL) { _lock->lock(); }
+        }
+        ~FlashLockGuard() {
+            if (_lock != NULL) { _lock->unlock(); }
+        }
+    private:
+        FlashLock *_lock;
+        FlashLockGuard(const FlashLockGuard&);
+        FlashLockGuard& operator=(const FlashLockGuard&);
+};
+
+#if defined(QSPI_FLASH_USE_FREERTOS) || defined(INC_FREERTOS_H)
+#ifndef INC_FREERTOS_H
+#include <FreeRTOS.h>
+#endif
+#include <semphr.h>
+
+class FlashFreeRTOSLock : public FlashLock {
+
+    public:
+        FlashFreeRTOSLock() { _mutex = xSemaphoreCreateRecursiveMutex(); }
+        ~FlashFreeRTOSLock() { vSemaphoreDelete(_mutex); }
+        void lock() { xSemaphoreTakeRecursive(_mutex, portMAX_DELAY); }
+        void unlock() { xSemaphoreGiveRecursive(_mutex); }
+    private:
+        SemaphoreHandle_t _mutex;
+};
+#endif // QSPI_FLASH_USE_FREERTOS
+
+#if defined(QSPI_FLASH_USE_STD_MUTEX)
+#include <mutex>
+
+class FlashStdMutexLock : public FlashLock {
+
+    public:
+        void lock() { _mutex.lock(); }
+        void unlock() { _mutex.unlock(); }
+    private:
+        std::recursive_mutex _mutex;
+};
+#endif // QSPI_FLASH_USE_STD_MUTEX
+
+#endif // _FLASHLOCK_H
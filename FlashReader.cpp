@@ -0,0 +1,389 @@
+#include "FlashReader.h"
+
+FlashReader::FlashReader(QSPIFlashMemory &flashMemory) : _flashMemory(flashMemory) {
+}
+
+/*
+Method: open()
+Description: Open a file for buffered reading from the start
+Input:
+    char directory[]: user-specified directory (leading /)
+    char filename[]: User-specified filename (with extension)
+Output:
+     0: success
+    -1: File doesnt exist
+    -2: error opening file to read
+    -3: Filesystem could not be mounted/accessed
+    -8: directory + filename longer than QSPI_FLASH_MAX_PATH_LENGTH
+*/
+int FlashReader::open(char directory[], char filename[]) {
+    close();
+    if (_flashMemory.mount() != 0) {
+        return -3;
+    }
+    FlashLockGuard volumeGuard(_flashMemory.getVolumeLock());
+    Adafruit_W25Q16BV_FatFs &fatfs = _flashMemory.getFlashFileSystemInterface();
+    FlashPathBuffer resolvedPath;
+    if (_flashMemory.path.resolve(resolvedPath, directory, filename) != 0) {
+        return -8;
+    }
+    if (!fatfs.exists(resolvedPath)) {
+        return -1;
+    }
+    _file = fatfs.open(resolvedPath, FILE_READ);
+    if (!_file) {
+        return -2;
+    }
+    _open = true;
+    _eof = false;
+    _bufferOffset = 0;
+    _start = 0;
+    _end = 0;
+    return 0;
+}
+
+/*
+Method: close()
+Description: Close the file, any buffered data is discarded
+Input: None
+Output: N/A
+*/
+void FlashReader::close() {
+    if (_open) {
+        FlashLockGuard volumeGuard(_flashMemory.getVolumeLock());
+        _file.close();
+        _open = false;
+    }
+    _start = 0;
+    _end = 0;
+}
+
+/*
+Method: read()
+Description: Bulk read. Buffered bytes are copied first, reads of a whole buffer or more
+             then go straight into the caller's buffer
+Input:
+    uint8_t buffer[]: Destination
+    uint32_t length: Bytes wanted
+Output:
+    >= 0: Bytes read (less than length only at end of file)
+      -2: error reading
+      -3: reader not open
+*/
+int FlashReader::read(uint8_t buffer[], uint32_t length) {
+    if (!_open) {
+        return -3;
+    }
+    uint32_t copied = 0;
+    while (copied < length) {
+        if (_start < _end) {
+            uint32_t chunk = _end - _start;
+            if (chunk > length - copied) {
+                chunk = length - copied;
+            }
+            memcpy(&buffer[copied], &_buffer[_start], chunk);
+            _start += chunk;
+            copied += chunk;
+            continue;
+        }
+        if (_eof) {
+            break;
+        }
+        if (length - copied >= QSPI_FLASH_READER_BUFFER_SIZE) {
+            uint32_t direct = length - copied;
+            if (direct > 0x8000) {
+                direct = 0x8000;
+            }
+            FlashLockGuard volumeGuard(_flashMemory.getVolumeLock());
+            int readCount = _file.read(&buffer[copied], direct);
+            if (readCount < 0) {
+                return -2;
+            }
+            if (readCount == 0) {
+                _eof = true;
+            }
+            // Buffer is empty, it now starts after the bytes read directly
+            _bufferOffset += _end + readCount;
+            _start = 0;
+            _end = 0;
+            copied += readCount;
+            continue;
+        }
+        if (refill() < 0) {
+            return -2;
+        }
+    }
+    return copied;
+}
+
+/*
+Method: readUntil()
+Description: Copy bytes up to a delimiter. The delimiter is consumed but not stored.
+             If buffer fills first the rest is left for the next call (a delimiter right
+             after a full buffer is consumed too, so it doesn't show up as an empty piece)
+Input:
+    char delimiter: Byte to stop at
+    char buffer[]: Destination, NUL-terminated on return
+    uint32_t maxLength: Size of buffer[] including the terminator
+Output:
+    >= 0: Bytes stored (excluding terminator)
+      -1: End of file, nothing read
+      -2: error reading
+      -3: reader not open
+*/
+int FlashReader::readUntil(char delimiter, char buffer[], uint32_t maxLength) {
+    return scanUntil(delimiter, buffer, maxLength, false);
+}
+
+/*
+Method: readLine()
+Description: Copy the next line, without its "\n" or "\r\n"
+Input:
+    char buffer[]: Destination, NUL-terminated on return
+    uint32_t maxLength: Size of buffer[] including the terminator
+Output: See readUntil()
+*/
+int FlashReader::readLine(char buffer[], uint32_t maxLength) {
+    int length = scanUntil('\n', buffer, maxLength, true);
+    if (length > 0 && buffer[length - 1] == '\r') {
+        buffer[--length] = 0;
+    }
+    return length;
+}
+
+/*
+Method: scanUntil()
+Description: readUntil()/readLine() implementation
+Input:
+    char delimiter: Byte to stop at
+    char buffer[]: Destination, NUL-terminated on return
+    uint32_t maxLength: Size of buffer[] including the terminator
+    bool lineEnd: true = "\r" + delimiter after a full buffer is consumed as well
+Output: See readUntil()
+*/
+int FlashReader::scanUntil(char delimiter, char buffer[], uint32_t maxLength, bool lineEnd) {
+    if (!_open) {
+        return -3;
+    }
+    if (maxLength == 0) {
+        return 0;
+    }
+    uint32_t stored = 0;
+    bool found = false;
+    bool any = false;
+    while (!found && stored < maxLength - 1) {
+        if (_start == _end) {
+            int buffered = refill();
+            if (buffered < 0) {
+                return -2;
+            }
+            if (buffered == 0) {
+                break;
+            }
+        }
+        any = true;
+        uint32_t available = _end - _start;
+        if (available > maxLength - 1 - stored) {
+            available = maxLength - 1 - stored;
+        }
+        uint8_t *match = (uint8_t *) memchr(&_buffer[_start], delimiter, available);
+        uint32_t chunk = (match != NULL) ? (match - &_buffer[_start]) : available;
+        memcpy(&buffer[stored], &_buffer[_start], chunk);
+        stored += chunk;
+        _start += chunk;
+        if (match != NULL) {
+            _start++;
+            found = true;
+        }
+    }
+    buffer[stored] = 0;
+    if (!found && any && stored == maxLength - 1 && skipDelimiter(delimiter, lineEnd) != 0) {
+        return -2;
+    }
+    return any ? (int) stored : -1;
+}
+
+/*
+Method: skipDelimiter()
+Description: Consume the delimiter (or "\r" + delimiter when lineEnd is set) if it is next,
+             refilling first so one split across a refill is seen
+Input:
+    char delimiter: Byte to skip
+    bool lineEnd: Also skip "\r" followed by the delimiter
+Output:
+     0: success
+    -2: error reading
+*/
+int FlashReader::skipDelimiter(char delimiter, bool lineEnd) {
+    if (_end - _start < 2 && refill() < 0) {
+        return -2;
+    }
+    if (_start < _end && _buffer[_start] == (uint8_t) delimiter) {
+        _start++;
+    } else if (lineEnd && _end - _start >= 2 && _buffer[_start] == '\r' && _buffer[_start + 1] == (uint8_t) delimiter) {
+        _start += 2;
+    }
+    return 0;
+}
+
+/*
+Method: nextLine()
+Description: Zero-copy line access. line points into the reader's buffer (NUL-terminated,
+             without "\n"/"\r\n") and stays valid until the next call on this reader.
+             Lines longer than QSPI_FLASH_READER_BUFFER_SIZE are returned in buffer-sized pieces
+Input:
+    char *&line: Set to the start of the line
+Output:
+    >= 0: Line length
+      -1: End of file
+      -2: error reading
+      -3: reader not open
+*/
+int FlashReader::nextLine(char *&line) {
+    if (!_open) {
+        return -3;
+    }
+    uint32_t searched = 0;
+    while (true) {
+        uint8_t *match = (uint8_t *) memchr(&_buffer[_start + searched], '\n', _end - _start - searched);
+        if (match != NULL) {
+            uint32_t length = match - &_buffer[_start];
+            *match = 0;
+            if (length > 0 && _buffer[_start + length - 1] == '\r') {
+                _buffer[_start + length - 1] = 0;
+                length--;
+            }
+            line = (char *) &_buffer[_start];
+            _start = (match - _buffer) + 1;
+            return length;
+        }
+        searched = _end - _start;
+        if (_eof || (_start == 0 && _end == QSPI_FLASH_READER_BUFFER_SIZE)) {
+            break;
+        }
+        // refill() moves the unread bytes to the front of the buffer
+        int buffered = refill();
+        if (buffered < 0) {
+            return -2;
+        }
+    }
+    if (_start == _end) {
+        return -1;
+    }
+    // Last line without a newline, or a line longer than the buffer
+    uint32_t length = _end - _start;
+    _buffer[_end] = 0;
+    line = (char *) &_buffer[_start];
+    _start = _end;
+    return length;
+}
+
+/*
+Method: peekBuffer()
+Description: Zero-copy access to the buffered bytes, refilling if empty.
+             Call consume() with the number of bytes used
+Input:
+    uint8_t *&data: Set to the first buffered byte
+Output:
+     > 0: Bytes available at data
+       0: End of file
+      -2: error reading
+      -3: reader not open
+*/
+int FlashReader::peekBuffer(uint8_t *&data) {
+    if (!_open) {
+        return -3;
+    }
+    if (_start == _end) {
+        int buffered = refill();
+        if (buffered <= 0) {
+            return buffered;
+        }
+    }
+    data = &_buffer[_start];
+    return _end - _start;
+}
+
+/*
+Method: consume()
+Description: Mark bytes returned by peekBuffer() as used
+Input:
+    uint32_t length: Bytes used (clamped to what is buffered)
+Output: N/A
+*/
+void FlashReader::consume(uint32_t length) {
+    _start += (length < _end - _start) ? length : _end - _start;
+}
+
+/*
+Method: position()
+Description: File offset of the next byte to be returned
+Input: None
+Output: uint32_t offset
+*/
+uint32_t FlashReader::position() {
+    return _bufferOffset + _start;
+}
+
+/*
+Method: size()
+Description: Size of the open file
+Input: None
+Output: uint32_t size (0 if not open)
+*/
+uint32_t FlashReader::size() {
+    if (!_open) {
+        return 0;
+    }
+    FlashLockGuard volumeGuard(_flashMemory.getVolumeLock());
+    return _file.size();
+}
+
+/*
+Method: isOpen()
+Description: Check if a file is open
+Input: None
+Output:
+    true: open
+    false: not open
+*/
+bool FlashReader::isOpen() {
+    return _open;
+}
+
+/*
+Method: refill()
+Description: Move unread bytes to the front of the buffer and read more after them.
+             The read is trimmed to end on a QSPI_FLASH_READER_ALIGNMENT boundary when possible
+Input: None
+Output:
+    >= 0: Bytes now buffered (0 = end of file)
+      -2: error reading
+*/
+int FlashReader::refill() {
+    if (_start > 0) {
+        memmove(_buffer, &_buffer[_start], _end - _start);
+        _bufferOffset += _start;
+        _end -= _start;
+        _start = 0;
+    }
+    if (_eof || _end == QSPI_FLASH_READER_BUFFER_SIZE) {
+        return _end;
+    }
+    uint32_t space = QSPI_FLASH_READER_BUFFER_SIZE - _end;
+    uint32_t tail = (_bufferOffset + _end + space) % QSPI_FLASH_READER_ALIGNMENT;
+    if (tail < space) {
+        space -= tail;
+    }
+
+    FlashLockGuard volumeGuard(_flashMemory.getVolumeLock());
+    int readCount = _file.read(&_buffer[_end], space);
+    if (readCount < 0) {
+        return -2;
+    }
+    if (readCount == 0) {
+        _eof = true;
+    }
+    _end += readCount;
+    return _end;
+}
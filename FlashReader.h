@@ -0,0 +1,48 @@
+#ifndef   _FLASHREADER_H
+#define   _FLASHREADER_H
+
+#include <Arduino.h>
+#include "QSPI_Flash.h"
+
+/*
+Buffered sequential reader. Reads ahead in QSPI_FLASH_READER_BUFFER_SIZE chunks (ending on
+sector boundaries) so scanning a file costs one FatFs call per chunk rather than per byte.
+
+    readLine()/readUntil()  copy into a caller buffer
+    read()                  bulk copy, large reads bypass the buffer
+    nextLine()/peekBuffer() zero-copy access to the internal buffer, valid until the next call
+
+The volume lock is taken for each refill only, so other tasks can use the flash in between.
+*/
+class FlashReader {
+
+    public:
+        FlashReader(QSPIFlashMemory &flashMemory);
+        int open(char directory[], char filename[]);
+        void close();
+        int read(uint8_t buffer[], uint32_t length);
+        int readUntil(char delimiter, char buffer[], uint32_t maxLength);
+        int readLine(char buffer[], uint32_t maxLength);
+        int nextLine(char *&line);
+        int peekBuffer(uint8_t *&data);
+        void consume(uint32_t length);
+        uint32_t position();
+        uint32_t size();
+        bool isOpen();
+    private:
+        QSPIFlashMemory &_flashMemory;
+        File _file;
+        bool _open = false;
+        bool _eof = false;
+        uint32_t _bufferOffset = 0;
+        uint32_t _start = 0;
+        uint32_t _end = 0;
+        // +1 so nextLine() can always NUL-terminate
+        uint8_t _buffer[QSPI_FLASH_READER_BUFFER_SIZE + 1];
+
+        int refill();
+        int scanUntil(char delimiter, char buffer[], uint32_t maxLength, bool lineEnd);
+        int skipDelimiter(char delimiter, bool lineEnd);
+};
+
+#endif // _FLASHREADER_H
@@ -0,0 +1,408 @@
+#include "FlashTimeSeries.h"
+
+FlashTimeSeries::FlashTimeSeries(QSPIFlashMemory &flashMemory) : _flashMemory(flashMemory) {
+    _directory[0] = 0;
+    _filename[0] = 0;
+}
+
+/*
+Method: begin()
+Description: Open (or create) a series for appending and querying
+Input:
+    char directory[]: user-specified directory (leading /)
+    char filename[]: User-specified series filename (with extension)
+Output: See begin(directory, filename, readOnly)
+*/
+int FlashTimeSeries::begin(char directory[], char filename[]) {
+    return begin(directory, filename, false);
+}
+
+/*
+Method: begin()
+Description: Open a series. In write mode, records after the last index entry are re-scanned
+             so index entries lost to a power cut are restored and a torn last record is dropped
+Input:
+    char directory[]: user-specified directory (leading /)
+    char filename[]: User-specified series filename (with extension)
+    bool readOnly: true = query only, nothing is written
+Output:
+     0: success
+    -1: name too long, or series doesn't exist (read only)
+    -2: data or index file could not be opened
+    -3: Filesystem could not be mounted/accessed
+*/
+int FlashTimeSeries::begin(char directory[], char filename[], bool readOnly) {
+    if (strlen(directory) >= sizeof(_directory) || strlen(filename) + 4 >= sizeof(_filename)) {
+        return -1;
+    }
+    end();
+    strcpy(_directory, directory);
+    strcpy(_filename, filename);
+    _readOnly = readOnly;
+
+    if (_flashMemory.mount() != 0) {
+        return -3;
+    }
+    if (readOnly) {
+        if (_flashMemory.checkFileExists(_directory, _filename) == false) {
+            return -1;
+        }
+    } else {
+        _flashMemory.createDirectory(_directory);
+    }
+
+    FlashLockGuard fileGuard(_flashMemory.getFileLock(_directory, _filename));
+    FlashLockGuard volumeGuard(_flashMemory.getVolumeLock());
+    Adafruit_W25Q16BV_FatFs &fatfs = _flashMemory.getFlashFileSystemInterface();
+
+    FlashPathBuffer resolvedPath;
+    char indexName[sizeof(_filename)];
+    strcpy(indexName, _filename);
+    strcat(indexName, ".idx");
+    if (_flashMemory.path.resolve(resolvedPath, _directory, _filename) != 0) {
+        return -1;
+    }
+    _data = fatfs.open(resolvedPath, readOnly ? FILE_READ : FILE_WRITE);
+    if (!_data) {
+        return -2;
+    }
+    if (_flashMemory.path.resolve(resolvedPath, _directory, indexName) != 0) {
+        _data.close();
+        return -1;
+    }
+    if (readOnly && !fatfs.exists(resolvedPath)) {
+        // No index yet, query() falls back to scanning from the start
+        _index = File();
+    } else {
+        _index = fatfs.open(resolvedPath, readOnly ? FILE_READ : FILE_WRITE);
+        if (!_index) {
+            _data.close();
+            return -2;
+        }
+    }
+    _open = true;
+    return recover();
+}
+
+/*
+Method: end()
+Description: Close the series files
+Input: None
+Output: N/A
+*/
+void FlashTimeSeries::end() {
+    if (_open) {
+        FlashLockGuard volumeGuard(_flashMemory.getVolumeLock());
+        _data.close();
+        if (_index) {
+            _index.close();
+        }
+        _open = false;
+    }
+    _hasRecords = false;
+    _dataSize = 0;
+    _indexEntries = 0;
+    _lastTimestamp = 0;
+    _lastIndexedInterval = 0;
+}
+
+/*
+Method: append()
+Description: Append one timestamped record, adding an index entry when it is the first
+             record to start in a new index interval
+Input:
+    uint32_t timestamp: Record time, must not be older than the previous record
+    uint8_t data[]: Payload bytes
+    uint16_t length: Payload length (up to QSPI_FLASH_SERIES_MAX_RECORD_SIZE)
+Output:
+     0: success
+    -1: payload too long
+    -2: timestamp older than the last record
+    -3: series not open for writing
+    -4: error writing
+*/
+int FlashTimeSeries::append(uint32_t timestamp, uint8_t data[], uint16_t length) {
+    if (!_open || _readOnly) {
+        return -3;
+    }
+    if (length > QSPI_FLASH_SERIES_MAX_RECORD_SIZE) {
+        return -1;
+    }
+    if (_hasRecords && timestamp < _lastTimestamp) {
+        return -2;
+    }
+    FlashLockGuard fileGuard(_flashMemory.getFileLock(_directory, _filename));
+    FlashLockGuard volumeGuard(_flashMemory.getVolumeLock());
+
+    uint8_t header[QSPI_FLASH_SERIES_HEADER_SIZE] = {
+        (uint8_t) timestamp, (uint8_t) (timestamp >> 8), (uint8_t) (timestamp >> 16), (uint8_t) (timestamp >> 24),
+        (uint8_t) length, (uint8_t) (length >> 8)
+    };
+    uint32_t crc = flashCRC32(data, length, flashCRC32(header, 6));
+    header[6] = (uint8_t) crc;
+    header[7] = (uint8_t) (crc >> 8);
+    header[8] = (uint8_t) (crc >> 16);
+    header[9] = (uint8_t) (crc >> 24);
+    if (!_data.seek(_dataSize)
+        || _data.write(header, sizeof(header)) != sizeof(header)
+        || (length > 0 && _data.write(data, length) != length)) {
+        return -4;
+    }
+    _data.flush();
+
+    // Data is flushed before the index, so an index entry never points past the data
+    uint32_t interval = _dataSize / QSPI_FLASH_SERIES_INDEX_INTERVAL;
+    if (_indexEntries == 0 || interval != _lastIndexedInterval) {
+        if (appendIndexEntry(timestamp, _dataSize) != 0) {
+            return -4;
+        }
+    }
+    _dataSize += QSPI_FLASH_SERIES_HEADER_SIZE + length;
+    _lastTimestamp = timestamp;
+    _hasRecords = true;
+    return 0;
+}
+
+/*
+Method: query()
+Description: Deliver every record with startTime <= timestamp <= endTime, in order.
+             The index is binary searched, then records are read from that page until endTime is passed
+             or a torn/stale record is found
+Input:
+    uint32_t startTime: First timestamp of interest
+    uint32_t endTime: Last timestamp of interest
+    FlashSeriesCallback callback: Called once per matching record (no flash lock held)
+    void *context: Passed through to the callback
+Output:
+    >= 0: Number of records delivered
+      -2: error reading
+      -3: series not open
+*/
+long FlashTimeSeries::query(uint32_t startTime, uint32_t endTime, FlashSeriesCallback callback, void *context) {
+    if (!_open) {
+        return -3;
+    }
+    FlashLockGuard fileGuard(_flashMemory.getFileLock(_directory, _filename));
+
+    uint32_t offset;
+    uint32_t dataSize;
+    {
+        FlashLockGuard volumeGuard(_flashMemory.getVolumeLock());
+        if (_readOnly) {
+            // Another instance may be appending
+            _dataSize = _data.size();
+            _indexEntries = _index ? _index.size() / QSPI_FLASH_SERIES_INDEX_ENTRY_SIZE : 0;
+        }
+        offset = findStartOffset(startTime);
+        dataSize = _dataSize;
+    }
+
+    long delivered = 0;
+    uint32_t previous = 0;
+    while (true) {
+        uint32_t timestamp;
+        uint16_t length;
+        {
+            FlashLockGuard volumeGuard(_flashMemory.getVolumeLock());
+            int res = readRecord(offset, dataSize, timestamp, length);
+            if (res < 0) {
+                return -2;
+            }
+            if (res > 0 || timestamp > endTime || timestamp < previous) {
+                break;
+            }
+        }
+        if (timestamp >= startTime) {
+            callback(timestamp, _payload, length, context);
+            delivered++;
+        }
+        previous = timestamp;
+        offset += QSPI_FLASH_SERIES_HEADER_SIZE + length;
+    }
+    return delivered;
+}
+
+/*
+Method: getLastTimestamp()
+Description: Timestamp of the newest record (0 if empty)
+Input: None
+Output: uint32_t timestamp
+*/
+uint32_t FlashTimeSeries::getLastTimestamp() {
+    return _lastTimestamp;
+}
+
+/*
+Method: getDataSize()
+Description: Size of the series data in bytes, excluding any torn or stale bytes at the end of the file
+Input: None
+Output: uint32_t size
+*/
+uint32_t FlashTimeSeries::getDataSize() {
+    return _dataSize;
+}
+
+/*
+Method: recover()
+Description: Rebuild the append state by scanning the records after the last index entry
+             (at most one index interval when the index is up to date). The series ends at the
+             first record with a bad CRC or an older timestamp. Caller holds the locks
+Input: None
+Output:
+     0: success
+    -2: error reading or writing
+*/
+int FlashTimeSeries::recover() {
+    uint32_t fileSize = _data.size();
+    _indexEntries = _index ? _index.size() / QSPI_FLASH_SERIES_INDEX_ENTRY_SIZE : 0;
+
+    uint32_t offset = 0;
+    if (_indexEntries > 0) {
+        uint32_t timestamp;
+        if (readIndexEntry(_indexEntries - 1, timestamp, offset) != 0) {
+            return -2;
+        }
+        _lastIndexedInterval = offset / QSPI_FLASH_SERIES_INDEX_INTERVAL;
+    }
+
+    while (true) {
+        uint32_t timestamp;
+        uint16_t length;
+        int res = readRecord(offset, fileSize, timestamp, length);
+        if (res < 0) {
+            return -2;
+        }
+        if (res > 0 || (_hasRecords && timestamp < _lastTimestamp)) {
+            // Torn record from a power cut, or stale bytes left behind one. The next append
+            // overwrites from here, anything after it stays unreachable
+            break;
+        }
+        uint32_t interval = offset / QSPI_FLASH_SERIES_INDEX_INTERVAL;
+        if (!_readOnly && (_indexEntries == 0 || interval != _lastIndexedInterval)) {
+            if (appendIndexEntry(timestamp, offset) != 0) {
+                return -2;
+            }
+        }
+        _lastTimestamp = timestamp;
+        _hasRecords = true;
+        offset += QSPI_FLASH_SERIES_HEADER_SIZE + length;
+    }
+    _dataSize = offset;
+    return 0;
+}
+
+/*
+Method: readRecord()
+Description: Read a record into _payload and check it is whole and its CRC matches
+Input:
+    uint32_t offset: Record offset in the data file
+    uint32_t limit: End of the data that may be read
+    uint32_t &timestamp: Set to the record timestamp
+    uint16_t &length: Set to the payload length
+Output:
+     0: valid record
+     1: no valid record at offset (end of data, torn or stale bytes)
+    -1: error reading
+*/
+int FlashTimeSeries::readRecord(uint32_t offset, uint32_t limit, uint32_t &timestamp, uint16_t &length) {
+    uint8_t header[QSPI_FLASH_SERIES_HEADER_SIZE];
+    if (offset + QSPI_FLASH_SERIES_HEADER_SIZE > limit) {
+        return 1;
+    }
+    if (!_data.seek(offset) || _data.read(header, sizeof(header)) != sizeof(header)) {
+        return -1;
+    }
+    timestamp = (uint32_t) header[0] | ((uint32_t) header[1] << 8) | ((uint32_t) header[2] << 16) | ((uint32_t) header[3] << 24);
+    length = (uint16_t) header[4] | ((uint16_t) header[5] << 8);
+    if (length > QSPI_FLASH_SERIES_MAX_RECORD_SIZE || offset + QSPI_FLASH_SERIES_HEADER_SIZE + length > limit) {
+        return 1;
+    }
+    if (length > 0 && _data.read(_payload, length) != length) {
+        return -1;
+    }
+    uint32_t crc = (uint32_t) header[6] | ((uint32_t) header[7] << 8) | ((uint32_t) header[8] << 16) | ((uint32_t) header[9] << 24);
+    if (crc != flashCRC32(_payload, length, flashCRC32(header, 6))) {
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Method: readIndexEntry()
+Description: Read one sparse index entry
+Input:
+    uint32_t entry: Entry number (0 - _indexEntries-1)
+    uint32_t &timestamp: Set to the timestamp of the first record in the interval
+    uint32_t &offset: Set to that record's data file offset
+Output:
+     0: success
+    -1: error reading
+*/
+int FlashTimeSeries::readIndexEntry(uint32_t entry, uint32_t &timestamp, uint32_t &offset) {
+    uint8_t raw[QSPI_FLASH_SERIES_INDEX_ENTRY_SIZE];
+    if (!_index.seek(entry * QSPI_FLASH_SERIES_INDEX_ENTRY_SIZE) || _index.read(raw, sizeof(raw)) != sizeof(raw)) {
+        return -1;
+    }
+    timestamp = (uint32_t) raw[0] | ((uint32_t) raw[1] << 8) | ((uint32_t) raw[2] << 16) | ((uint32_t) raw[3] << 24);
+    offset = (uint32_t) raw[4] | ((uint32_t) raw[5] << 8) | ((uint32_t) raw[6] << 16) | ((uint32_t) raw[7] << 24);
+    return 0;
+}
+
+/*
+Method: appendIndexEntry()
+Description: Append an index entry for a record that starts a new index interval
+Input:
+    uint32_t timestamp: Record timestamp
+    uint32_t offset: Record offset in the data file
+Output:
+     0: success
+    -1: error writing
+*/
+int FlashTimeSeries::appendIndexEntry(uint32_t timestamp, uint32_t offset) {
+    uint8_t raw[QSPI_FLASH_SERIES_INDEX_ENTRY_SIZE] = {
+        (uint8_t) timestamp, (uint8_t) (timestamp >> 8), (uint8_t) (timestamp >> 16), (uint8_t) (timestamp >> 24),
+        (uint8_t) offset, (uint8_t) (offset >> 8), (uint8_t) (offset >> 16), (uint8_t) (offset >> 24)
+    };
+    if (!_index.seek(_indexEntries * QSPI_FLASH_SERIES_INDEX_ENTRY_SIZE) || _index.write(raw, sizeof(raw)) != sizeof(raw)) {
+        return -1;
+    }
+    _index.flush();
+    _indexEntries++;
+    _lastIndexedInterval = offset / QSPI_FLASH_SERIES_INDEX_INTERVAL;
+    return 0;
+}
+
+/*
+Method: findStartOffset()
+Description: Binary search the index for the last interval starting before startTime.
+             Records at startTime may begin in that interval, so the scan starts there
+Input:
+    uint32_t startTime: First timestamp of interest
+Output: uint32_t data file offset to scan from (0 when the index can't help)
+*/
+uint32_t FlashTimeSeries::findStartOffset(uint32_t startTime) {
+    uint32_t low = 0;
+    uint32_t high = _indexEntries;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        uint32_t timestamp;
+        uint32_t offset;
+        if (readIndexEntry(middle, timestamp, offset) != 0) {
+            return 0;
+        }
+        if (timestamp < startTime) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low == 0) {
+        return 0;
+    }
+    uint32_t timestamp;
+    uint32_t offset;
+    if (readIndexEntry(low - 1, timestamp, offset) != 0) {
+        return 0;
+    }
+    return offset;
+}
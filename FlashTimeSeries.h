@@ -0,0 +1,61 @@
+#ifndef   _FLASHTIMESERIES_H
+#define   _FLASHTIMESERIES_H
+
+#include <Arduino.h>
+#include "QSPI_Flash.h"
+#include "FlashCRC32.h"
+
+#define QSPI_FLASH_SERIES_HEADER_SIZE 10
+#define QSPI_FLASH_SERIES_INDEX_ENTRY_SIZE 8
+
+/*
+Time-indexed series file: timestamped records appended to <filename>, plus a sparse index
+<filename>.idx holding (timestamp, offset) of the first record starting in every
+QSPI_FLASH_SERIES_INDEX_INTERVAL bytes of the data file.
+
+    Data record:  uint32 timestamp, uint16 length, uint32 CRC-32, payload     (little endian)
+                  The CRC covers the timestamp, length and payload
+    Index entry:  uint32 timestamp, uint32 data file offset
+
+Timestamps must not decrease. A range query binary searches the index and then reads
+only the records from the matching page onwards, so its cost doesn't grow with the file.
+
+The data file is never truncated (the FatFs wrapper has no truncate), so a record torn by a
+power cut stays behind the end of the series, and a shorter append over it leaves stale bytes
+past the new record. Scans stop at the first record with a bad CRC or an older timestamp,
+so neither is ever delivered or appended after.
+*/
+class FlashTimeSeries {
+
+    public:
+        FlashTimeSeries(QSPIFlashMemory &flashMemory);
+        int begin(char directory[], char filename[]);
+        int begin(char directory[], char filename[], bool readOnly);
+        void end();
+        int append(uint32_t timestamp, uint8_t data[], uint16_t length);
+        long query(uint32_t startTime, uint32_t endTime, FlashSeriesCallback callback, void *context);
+        uint32_t getLastTimestamp();
+        uint32_t getDataSize();
+    private:
+        QSPIFlashMemory &_flashMemory;
+        char _directory[QSPI_FLASH_MAX_DIRECTORY_LENGTH];
+        char _filename[QSPI_FLASH_MAX_FILENAME_LENGTH];
+        File _data;
+        File _index;
+        bool _open = false;
+        bool _readOnly = false;
+        bool _hasRecords = false;
+        uint32_t _dataSize = 0;
+        uint32_t _indexEntries = 0;
+        uint32_t _lastTimestamp = 0;
+        uint32_t _lastIndexedInterval = 0;
+        uint8_t _payload[QSPI_FLASH_SERIES_MAX_RECORD_SIZE];
+
+        int recover();
+        int readRecord(uint32_t offset, uint32_t limit, uint32_t &timestamp, uint16_t &length);
+        int readIndexEntry(uint32_t entry, uint32_t &timestamp, uint32_t &offset);
+        int appendIndexEntry(uint32_t timestamp, uint32_t offset);
+        uint32_t findStartOffset(uint32_t startTime);
+};
+
+#endif // _FLASHTIMESERIES_H
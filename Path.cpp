@@ -1,6 +1,12 @@
 #include <Arduino.h>
 #include "Path.h"
 
+#if QSPI_FLASH_STATIC_ARENA
+// Only used with the volume lock held, see QSPI_Flash_Config.h
+static char arenaPathBuffers[QSPI_FLASH_PATH_BUFFERS][QSPI_FLASH_MAX_PATH_LENGTH];
+static uint8_t arenaPathBuffersUsed = 0;
+#endif
+
 
 /*
 Method: initialise()
@@ -33,19 +39,30 @@ Input:
     char path[]: Array where the path is to be stored
     char directory[]: User-specified directory (leading /)
     char filename[]: User-specified filename and extension (no /)
-Output: N/A
-@TODO: Check the / are in the correct place and resolved path doesnt exceed target array
+Output:
+     0: success
+    -1: no path buffer, or the result wouldn't fit in QSPI_FLASH_MAX_PATH_LENGTH (path is left empty)
+@TODO: Check the / are in the correct place
 */
-void Path::resolve(char path[], char directory[], char filename[]) {
+int Path::resolve(char path[], char directory[], char filename[]) {
+    if (path == NULL) {
+        if (_debugLevel > 0) { Serial.print("\n -> Path.resolve - No path buffer available"); }
+        return -1;
+    }
     if (_debugLevel > 0) { Serial.print("\n -> Path.resolve - BEFORE RESET= " ); Serial.print(path); }
     resetPath(path);
     if (_debugLevel > 0) { Serial.print("\n -> Path.resolve - AFTER RESET= " ); Serial.print(path); }
 
+    if (strlen(directory) + 1 + strlen(filename) >= QSPI_FLASH_MAX_PATH_LENGTH) {
+        if (_debugLevel > 0) { Serial.print("\n -> Path.resolve - Path too long for QSPI_FLASH_MAX_PATH_LENGTH"); }
+        return -1;
+    }
+
     strcat(path, directory);
     strcat(path, "/");
     strcat(path, filename);
     if (_debugLevel > 0) { Serial.print("\n -> Path.resolve - AFTER WRITE= " ); Serial.print(path); }
-
+    return 0;
 }
 
 /*
@@ -54,31 +71,74 @@ Description: Resolve a directory =
 Input:
     char path[]: Array where the path is to be stored
     char directory[]: User-specified directory (leading /)
-Output: N/A
-@TODO: Check the / are in the correct place and resolved path doesnt exceed target array
+Output:
+     0: success
+    -1: no path buffer, or the result wouldn't fit in QSPI_FLASH_MAX_PATH_LENGTH (path is left empty)
+@TODO: Check the / are in the correct place
 */
-void Path::resolve(char path[], char directory[]) {
+int Path::resolve(char path[], char directory[]) {
+    if (path == NULL) {
+        if (_debugLevel > 0) { Serial.print("\n -> Path.resolve - No path buffer available"); }
+        return -1;
+    }
     if (_debugLevel > 0) { Serial.print("\n -> Path.resolve - BEFORE RESET= " ); Serial.print(path); }
     resetPath(path);
     if (_debugLevel > 0) { Serial.print("\n -> Path.resolve - AFTER RESET= " ); Serial.print(path); }
 
+    if (strlen(directory) >= QSPI_FLASH_MAX_PATH_LENGTH) {
+        if (_debugLevel > 0) { Serial.print("\n -> Path.resolve - Path too long for QSPI_FLASH_MAX_PATH_LENGTH"); }
+        return -1;
+    }
+
     strcat(path, directory);
     if (_debugLevel > 0) { Serial.print("\n -> Path.resolve - AFTER WRITE= " ); Serial.print(path); }
-
-    if (_debugLevel > 0) { Serial.print("\n Size of path: ");Serial.print(sizeof(path)); }
-    if (_debugLevel > 0) { Serial.print("\n Size of directory: ");Serial.print(sizeof(directory)); }
+    return 0;
 }
 
 /*
 Method: resetPath()
 Description: Erase path content
 Input:
-    char path[]: Array where the path is to be stored
+    char path[]: Array where the path is to be stored (QSPI_FLASH_MAX_PATH_LENGTH bytes)
 Output: N/A
-@TODO: Use a global constant for the max path size
 */
 void Path::resetPath(char path[]) {
-    for (int i = 0 ; i < 260 ; i++) {
+    for (int i = 0 ; i < QSPI_FLASH_MAX_PATH_LENGTH ; i++) {
         path[i] = 0x00;
     }
 }
+
+#if QSPI_FLASH_STATIC_ARENA
+/*
+Method: FlashPathBuffer()
+Description: Take the next free buffer of the static pool (NULL when all are in use)
+Input: None
+Output: N/A
+*/
+FlashPathBuffer::FlashPathBuffer() {
+    _path = NULL;
+    if (arenaPathBuffersUsed < QSPI_FLASH_PATH_BUFFERS) {
+        _path = arenaPathBuffers[arenaPathBuffersUsed++];
+        _path[0] = 0x00;
+    }
+}
+
+/*
+Method: ~FlashPathBuffer()
+Description: Return the buffer to the pool. Buffers are scoped, so they come back in reverse order
+Input: None
+Output: N/A
+*/
+FlashPathBuffer::~FlashPathBuffer() {
+    if (_path != NULL) {
+        arenaPathBuffersUsed--;
+    }
+}
+#else
+FlashPathBuffer::FlashPathBuffer() {
+    _path[0] = 0x00;
+}
+
+FlashPathBuffer::~FlashPathBuffer() {
+}
+#endif
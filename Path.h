@@ -2,17 +2,41 @@
 #define   _PATH_H
 
 #include <string.h>
+#include "QSPI_Flash_Config.h"
 
 class Path {
 
     public:
         int initialise();
         int initialise(int debugLevel);
-        void resolve(char path[], char directory[], char filename[]);
-        void resolve(char path[], char directory[]);
+        int resolve(char path[], char directory[], char filename[]);
+        int resolve(char path[], char directory[]);
     private:
         int _debugLevel = 0;
         void resetPath(char path[]);
 };
 
+/*
+Class: FlashPathBuffer
+Description: QSPI_FLASH_MAX_PATH_LENGTH bytes for one resolved path, released at the end of its scope.
+             With QSPI_FLASH_STATIC_ARENA it is taken from a pool of QSPI_FLASH_PATH_BUFFERS static
+             buffers, so declare it after the volume lock is taken (it is then released first).
+             An exhausted pool gives NULL, which resolve() reports as an error
+*/
+class FlashPathBuffer {
+
+    public:
+        FlashPathBuffer();
+        ~FlashPathBuffer();
+        operator char *() { return _path; }
+    private:
+#if QSPI_FLASH_STATIC_ARENA
+        char *_path;
+#else
+        char _path[QSPI_FLASH_MAX_PATH_LENGTH];
+#endif
+        FlashPathBuffer(const FlashPathBuffer &);
+        FlashPathBuffer &operator=(const FlashPathBuffer &);
+};
+
 #endif // _PATH_H
@@ -1,9 +1,22 @@
 #include <QSPI_Flash.h>
+#include "FlashTimeSeries.h"
+#include "FlashKeyValueStore.h"
+#include "FlashReader.h"
+#include "FlashConsistencyChecker.h"
+#include "FlashImageFormat.h"
 #define FLASH_TYPE    SPIFLASHTYPE_W25Q16BV  // Flash chip type.
 
 Adafruit_QSPI_GD25Q flash;
 Adafruit_W25Q16BV_FatFs fs(flash);
 
+#if QSPI_FLASH_STATIC_ARENA
+// Only used with the volume lock held, see QSPI_Flash_Config.h
+static uint8_t arenaFormatBuffer[QSPI_FLASH_FORMAT_BUFFER_SIZE];
+static uint8_t arenaPageBuffer[QSPI_FLASH_MAX_PAGE_SIZE];
+static uint8_t arenaImageBuffer[QSPI_FLASH_IMAGE_CHUNK_SIZE];
+static uint8_t arenaSectorBuffer[QSPI_FLASH_SECTOR_SIZE];
+#endif
+
 
 /*
 Method: initialise()
@@ -16,53 +29,252 @@ int8_t QSPIFlashMemory::initialise() {
     flash.setFlashType(FLASH_TYPE);
     _debugLevel = 0;
     path.initialise(0);
+    _startupTiming = {};
+    unsigned long start = micros();
     if (checkIfFlashMemoryIsReady() == false) {
         return -1;
     }
-    getManufacturerID();
-    getDeviceID();
+    _startupTiming.probeMicros = micros() - start;
+    // One GetManufacturerInfo for both IDs
+    flash.GetManufacturerInfo(&manufacturerID, &deviceID);
     pageCount = getFlashPages();
     pageSize = getFlashPageSize();
     chipModelID = getFlashChipID();
     chipAddress = getFlashChipAddress();
+    _startupTiming.identifyMicros = micros() - start - _startupTiming.probeMicros;
+    _startupTiming.totalMicros = micros() - start;
     return 0;
 }
 
 /*
 Method: initialise()
 Description: Initialise with a specific debug level
-Input: debugLevel integer (0 - 254)
+Input: debugLevel integer (0 - 127)
 Output:
      0: success
     -1: chip not ready
 */
 int8_t QSPIFlashMemory::initialise(int8_t debugLevel) {
     flash.setFlashType(FLASH_TYPE);
-    if (debugLevel >= 0 && debugLevel < 255) {
+    if (debugLevel >= 0) {
         _debugLevel = debugLevel;
         path.initialise(_debugLevel);
     }
+    _startupTiming = {};
+    unsigned long start = micros();
     if (checkIfFlashMemoryIsReady() == false) {
         return -1;
     }
+    _startupTiming.probeMicros = micros() - start;
+    flash.GetManufacturerInfo(&manufacturerID, &deviceID);
     pageCount = getFlashPages();
     pageSize = getFlashPageSize();
     chipModelID = getFlashChipID();
     chipAddress = getFlashChipAddress();
+    _startupTiming.identifyMicros = micros() - start - _startupTiming.probeMicros;
+    _startupTiming.totalMicros = micros() - start;
+    return 0;
+}
+
+/*
+Method: initialiseFast()
+Description: Fast boot with no debug enabled, see initialiseFast(cachedGeometry, debugLevel)
+Input:
+    FlashGeometry &cachedGeometry: Geometry saved from a previous boot
+Output: See initialiseFast(cachedGeometry, debugLevel)
+*/
+int8_t QSPIFlashMemory::initialiseFast(FlashGeometry &cachedGeometry) {
+    return initialiseFast(cachedGeometry, 0);
+}
+
+/*
+Method: initialiseFast()
+Description: Fast boot for nodes that wake, log and sleep. Probes the chip once, reads only
+             the JEDEC ID and takes the rest of the geometry from cachedGeometry when it matches.
+             Then mounts the filesystem and reads the root directory so the first write
+             doesn't pay for either. See getStartupTiming() for the breakdown
+Input:
+    FlashGeometry &cachedGeometry: Geometry saved from a previous boot (getGeometry()).
+                                   Refreshed from the chip if it doesn't match
+    int8_t debugLevel: debugLevel integer (0 - 127)
+Output:
+     0: success, cached geometry used
+     1: success, cached geometry was stale, empty or corrupt and has been refreshed (save it again)
+    -1: chip not ready
+    -3: Filesystem could not be mounted/accessed
+*/
+int8_t QSPIFlashMemory::initialiseFast(FlashGeometry &cachedGeometry, int8_t debugLevel) {
+    flash.setFlashType(FLASH_TYPE);
+    if (debugLevel >= 0) {
+        _debugLevel = debugLevel;
+        path.initialise(_debugLevel);
+    }
+    _startupTiming = {};
+    unsigned long start = micros();
+    unsigned long mark = start;
+
+    if (checkIfFlashMemoryIsReady() == false) {
+        return -1;
+    }
+    _startupTiming.probeMicros = micros() - mark;
+    mark = micros();
+
+    int8_t res = 0;
+    chipModelID = getFlashChipID();
+    if (cachedGeometry.magic == QSPI_FLASH_GEOMETRY_MAGIC && cachedGeometry.crc == geometryCRC(cachedGeometry)
+        && cachedGeometry.chipModelID == chipModelID && cachedGeometry.pageCount != 0 && cachedGeometry.pageSize != 0) {
+        manufacturerID = cachedGeometry.manufacturerID;
+        deviceID = cachedGeometry.deviceID;
+        pageCount = cachedGeometry.pageCount;
+        pageSize = cachedGeometry.pageSize;
+        chipAddress = cachedGeometry.chipAddress;
+    } else {
+        if (_debugLevel > 1) { Serial.print("\nQSPIFlashMemory::initialiseFast() - Cached geometry doesn't match chip, refreshing"); }
+        flash.GetManufacturerInfo(&manufacturerID, &deviceID);
+        pageCount = getFlashPages();
+        pageSize = getFlashPageSize();
+        chipAddress = getFlashChipAddress();
+        cachedGeometry = getGeometry();
+        res = 1;
+    }
+    _startupTiming.identifyMicros = micros() - mark;
+    mark = micros();
+
+    if (mount() != 0) {
+        return -3;
+    }
+    _startupTiming.mountMicros = micros() - mark;
+    mark = micros();
+
+    // Pull the root directory into the FatFs window
+    {
+        FlashLockGuard volumeGuard(_volumeLock);
+        File root = fs.open("/");
+        if (root) {
+            File child = root.openNextFile();
+            if (child) {
+                child.close();
+            }
+            root.close();
+        }
+    }
+    _startupTiming.warmMicros = micros() - mark;
+    _startupTiming.totalMicros = micros() - start;
+    return res;
+}
+
+/*
+Method: getGeometry()
+Description: Get the chip identity and geometry, for caching across boots (see initialiseFast())
+Input: None
+Output: FlashGeometry struct
+*/
+FlashGeometry QSPIFlashMemory::getGeometry() {
+    FlashGeometry geometry;
+    geometry.chipModelID = chipModelID;
+    geometry.chipAddress = chipAddress;
+    geometry.pageCount = pageCount;
+    geometry.pageSize = pageSize;
+    geometry.manufacturerID = manufacturerID;
+    geometry.deviceID = deviceID;
+    geometry.magic = QSPI_FLASH_GEOMETRY_MAGIC;
+    geometry.crc = geometryCRC(geometry);
+    return geometry;
+}
+
+/*
+Method: geometryCRC()
+Description: CRC-32 of a geometry record's fields (not of the struct, so padding doesn't count)
+Input:
+    FlashGeometry &geometry: Record to check
+Output: uint32_t CRC
+*/
+uint32_t QSPIFlashMemory::geometryCRC(FlashGeometry &geometry) {
+    uint8_t raw[18];
+    flashImagePut32(&raw[0], geometry.magic);
+    flashImagePut32(&raw[4], geometry.chipModelID);
+    flashImagePut32(&raw[8], geometry.chipAddress);
+    raw[12] = (uint8_t) geometry.pageCount;
+    raw[13] = (uint8_t) (geometry.pageCount >> 8);
+    raw[14] = (uint8_t) geometry.pageSize;
+    raw[15] = (uint8_t) (geometry.pageSize >> 8);
+    raw[16] = geometry.manufacturerID;
+    raw[17] = geometry.deviceID;
+    return flashCRC32(raw, sizeof(raw));
+}
+
+/*
+Method: getStartupTiming()
+Description: Get the time spent in each stage of the last initialise()/initialiseFast()
+Input: None
+Output: FlashStartupTiming struct (microseconds, stages not run are 0)
+*/
+FlashStartupTiming QSPIFlashMemory::getStartupTiming() {
+    return _startupTiming;
+}
+
+/*
+Method: mount()
+Description: Mount the filesystem if it isn't already. Helpers call this, so the
+             mount cost is only paid once per boot (and again after format())
+Input: None
+Output:
+     0: success
+    -3: Filesystem could not be mounted/accessed
+*/
+int QSPIFlashMemory::mount() {
+    FlashLockGuard volumeGuard(_volumeLock);
+    if (_mounted) {
+        return 0;
+    }
+    fs.activate();
+    if (!fs.begin()) {
+        if (_debugLevel > 0) { Serial.print("\n -> Error, failed to mount filesystem!"); }
+        return -3;
+    }
+    _mounted = true;
+    _mountCount++;
     return 0;
 }
 
+/*
+Method: remount()
+Description: Mount the filesystem again so FatFs re-reads it, e.g. after sectors were
+             changed underneath it. Files opened before the remount can no longer be used
+Input: None
+Output:
+     0: success
+    -3: Filesystem could not be mounted/accessed
+*/
+int QSPIFlashMemory::remount() {
+    FlashLockGuard volumeGuard(_volumeLock);
+    _mounted = false;
+    return mount();
+}
+
+/*
+Method: getMountCount()
+Description: Number of times the filesystem was mounted (format(), a remount after raw writes,
+             importImage() or a repair each add one). Code keeping a File open across helper
+             calls compares it to know when that File has become invalid
+Input: None
+Output: uint32_t mount count
+*/
+uint32_t QSPIFlashMemory::getMountCount() {
+    return _mountCount;
+}
+
 /*
 Method: setDebugLevel()
 Description: Override existing debug level
 Input:
-    int8_t debugLevel: Desired debug level integer (0 - 254) - See QSPI_Flash.h for details
+    int8_t debugLevel: Desired debug level integer (0 - 127) - See QSPI_Flash.h for details
 Output:
      0: Value changed successfully
     -1: Illegal value
 */
 int8_t QSPIFlashMemory::setDebugLevel(int8_t debugLevel) {
-    if (debugLevel >= 0 && debugLevel < 255) {
+    if (debugLevel >= 0) {
         _debugLevel = debugLevel;
         path.initialise(_debugLevel);
         return 0;
@@ -75,7 +287,7 @@ Method: getDebugLevel()
 Description: Get the current debug level value
 Input: None
 Output:
-    int8_t (0 - 254): Current debug level integer (0 - 254) - See QSPI_Flash.h for details
+    int8_t (0 - 127): Current debug level integer (0 - 127) - See QSPI_Flash.h for details
 */
 int8_t QSPIFlashMemory::getDebugLevel() {
     return _debugLevel;
@@ -93,8 +305,10 @@ bool QSPIFlashMemory::checkIfFlashMemoryIsReady() {
     // TODO: Add logic to check 5 times then return false if still unavailable
     if (!flash.begin()) {
         if (_debugLevel > 0 && _debugLevel < 255) { Serial.println("\nCould not find flash on QSPI bus!"); }
+        _flashReady = false;
         return false;
     }
+    _flashReady = true;
     return true;
 }
 
@@ -177,14 +391,21 @@ Output:
 @TODO: Explain properly what the error codes are
 */
 int QSPIFlashMemory::format() {
+    FlashLockGuard volumeGuard(_volumeLock);
     if (_debugLevel > 0) { Serial.print("\n\n Formatting Flash Chip"); }
 
+    _mounted = false;
     fs.activate();
 
     // Partition the flash with 1 partition that takes the entire space.
     if (_debugLevel > 0) { Serial.print("\n -> Partitioning flash with 1 primary partition using 100% available space"); }
     DWORD plist[] = { 100, 0, 0, 0 };  // 1 primary partition with 100% of space.
-    uint8_t buf[512] = { 0 };          // Working buffer for f_fdisk function.
+#if QSPI_FLASH_STATIC_ARENA
+    uint8_t *buf = arenaFormatBuffer;  // Working buffer for f_fdisk function.
+#else
+    uint8_t buf[QSPI_FLASH_FORMAT_BUFFER_SIZE];
+#endif
+    memset(buf, 0, QSPI_FLASH_FORMAT_BUFFER_SIZE);
     FRESULT r = f_fdisk(0, plist, buf);
     if (r != FR_OK) {
         if (_debugLevel > 0) { Serial.print("\n -> Error, f_fdisk failed with error code: "); Serial.print(r, DEC); }
@@ -194,7 +415,7 @@ int QSPIFlashMemory::format() {
 
     // Make filesystem.
     if (_debugLevel > 0) { Serial.print("\n -> Making FAT file system (takes ~60s)"); }
-    r = f_mkfs("", FM_ANY, 0, buf, sizeof(buf));
+    r = f_mkfs("", FM_ANY, 0, buf, QSPI_FLASH_FORMAT_BUFFER_SIZE);
     if (r != FR_OK) {
         if (_debugLevel > 0) { Serial.print(" -> Error, f_mkfs failed with error code: "); Serial.print(r, DEC); }
         return -2;
@@ -207,6 +428,8 @@ int QSPIFlashMemory::format() {
         if (_debugLevel > 0) { Serial.print("\n -> Error, failed to mount newly formatted filesystem!"); }
         return -3;
     }
+    _mounted = true;
+    _mountCount++;
     if (_debugLevel > 0) { Serial.print("\n -> Filesystem available"); }
     if (_debugLevel > 0) { Serial.print("\n -> Complete!\n"); }
     return 0;
@@ -214,7 +437,9 @@ int QSPIFlashMemory::format() {
 
 /*
 Method: getFilesInDirectory()
-Description: Get the folder representation to access files
+Description: Get the folder representation to access files. The returned File (and any File
+             from its openNextFile()) is raw FatFs access: with locks set, hold getVolumeLock()
+             for as long as it is used, including close()
 Input:
     char directory[]: user-specified directory (leading /)
 Output:
@@ -222,6 +447,7 @@ Output:
     File: File object for the directory
 */
 File QSPIFlashMemory::getFilesInDirectory(char directory[]) {
+    FlashLockGuard volumeGuard(_volumeLock);
     if (checkDirectoryExists(directory) == false) {
         return NULL;
     }
@@ -236,10 +462,14 @@ Input:
     char filename[]: User-specified filename (with extension)
 Output:
     true: File exists
-    false: File doesn't exist
+    false: File doesn't exist (or the path is longer than QSPI_FLASH_MAX_PATH_LENGTH)
 */
 bool QSPIFlashMemory::checkFileExists(char directory[], char filename[]) {
-    path.resolve(resolvedPath, directory, filename);
+    FlashLockGuard volumeGuard(_volumeLock);
+    FlashPathBuffer resolvedPath;
+    if (path.resolve(resolvedPath, directory, filename) != 0) {
+        return false;
+    }
     if (fs.exists(resolvedPath)) {
         if (_debugLevel > 0) { Serial.print("\nQSPIFlashMemory::checkDirectoryExists - Exists"); }
         return true;
@@ -255,10 +485,14 @@ Input:
     char directory[]: user-specified directory (leading /)
 Output:
     true: File exists
-    false: File doesn't exist
+    false: File doesn't exist (or the path is longer than QSPI_FLASH_MAX_PATH_LENGTH)
 */
 bool QSPIFlashMemory::checkDirectoryExists(char directory[]) {
-    path.resolve(resolvedPath, directory);
+    FlashLockGuard volumeGuard(_volumeLock);
+    FlashPathBuffer resolvedPath;
+    if (path.resolve(resolvedPath, directory) != 0) {
+        return false;
+    }
     if (fs.exists(resolvedPath)) {
         if (_debugLevel > 0) { Serial.print("\nQSPIFlashMemory::checkDirectoryExists - Exists"); }
         return true;
@@ -269,17 +503,23 @@ bool QSPIFlashMemory::checkDirectoryExists(char directory[]) {
 
 /*
 Method: getFile()
-Description: Get specific file by directory and filename
+Description: Get specific file by directory and filename. The returned File is raw FatFs access:
+             with locks set, hold getVolumeLock() (and getFileLock() to keep helpers off the
+             same file) for as long as it is used, including close()
 Input:
     char directory[]: user-specified directory (leading /)
     char filename[]: User-specified filename (with extension)
 Output:
-    NULL: Directory does not exist or an error occurred
+    NULL: Directory does not exist, the path is longer than QSPI_FLASH_MAX_PATH_LENGTH or an error occurred
     File: File object for the directory
 @TODO: Check file exists first and check if
 */
 File QSPIFlashMemory::getFile(char directory[], char filename[]) {
-    path.resolve(resolvedPath, directory, filename);
+    FlashLockGuard volumeGuard(_volumeLock);
+    FlashPathBuffer resolvedPath;
+    if (path.resolve(resolvedPath, directory, filename) != 0) {
+        return File();
+    }
     return fs.open(resolvedPath);
 }
 
@@ -296,12 +536,12 @@ Output:
     -9: flash not ready
 */
 int QSPIFlashMemory::createDirectory(char directory[]) {
-    fs.activate();
-    if (!fs.begin()) {
+    FlashLockGuard volumeGuard(_volumeLock);
+    if (mount() != 0) {
         if (_debugLevel > 0) { Serial.print("\n -> Error, failed to mount filesystem!"); }
         return -3;
     }
-    if (checkIfFlashMemoryIsReady() == false) {
+    if (_flashReady == false && checkIfFlashMemoryIsReady() == false) {
         if (_debugLevel > 0) { Serial.println("\nQSPIFlashMemory::createDirectory() - Flash not ready"); }
         return -9;
     }
@@ -330,21 +570,28 @@ Output:
     -3: Filesystem could not be mounted/accessed
     -4: Create directory failed
     -5: error creating
+    -8: directory + filename longer than QSPI_FLASH_MAX_PATH_LENGTH
     -9: flash not ready
 
 */
 int QSPIFlashMemory::createFile(char directory[], char filename[]) {
-    fs.activate();
-    if (!fs.begin()) {
+    FlashLockGuard fileGuard(getFileLock(directory, filename));
+    FlashLockGuard volumeGuard(_volumeLock);
+    if (mount() != 0) {
         if (_debugLevel > 0) { Serial.print("\n -> Error, failed to mount filesystem!"); }
         return -3;
     }
-    if (checkIfFlashMemoryIsReady() == false) {
+    if (_flashReady == false && checkIfFlashMemoryIsReady() == false) {
         if (_debugLevel > 0) { Serial.println("\nQSPIFlashMemory::createFile() - Flash not ready"); }
         return -9;
     }
+    FlashPathBuffer resolvedPath;
+    if (path.resolve(resolvedPath, directory, filename) != 0) {
+        if (_debugLevel > 0) { Serial.println("\nError, path longer than QSPI_FLASH_MAX_PATH_LENGTH"); }
+        return -8;
+    }
 
-    if (checkFileExists(directory, filename) == true) {
+    if (fs.exists(resolvedPath)) {
         if (_debugLevel > 0) { Serial.println("\nQSPIFlashMemory::createFile() - File already exists"); }
         return -1;
     }
@@ -366,7 +613,6 @@ int QSPIFlashMemory::createFile(char directory[], char filename[]) {
         }
     }
 
-    path.resolve(resolvedPath, directory, filename);
     if (_debugLevel > 0) { Serial.println("\nQSPIFlashMemory::createFile() - creating file "); Serial.print(resolvedPath); }
 
     File cf = fs.open(resolvedPath, FILE_WRITE);
@@ -394,19 +640,22 @@ Output:
     -1: file didnt exist and failed to create it
     -2: file already has content and user requested not to over write
     -3: Filesystem could not be mounted/accessed
+    -8: directory + filename longer than QSPI_FLASH_MAX_PATH_LENGTH
 */
 int QSPIFlashMemory::saveFile(char directory[], char filename[], char content[], bool overwriteExistingContent) {
-    fs.activate();
-    if (!fs.begin()) {
+    FlashLockGuard fileGuard(getFileLock(directory, filename));
+    FlashLockGuard volumeGuard(_volumeLock);
+    if (mount() != 0) {
         if (_debugLevel > 0) { Serial.print("\n -> Error, failed to mount filesystem!"); }
         return -3;
     }
     if (checkFileExists(directory, filename) == false) {
         if (_debugLevel > 0) { Serial.println("\nQSPIFlashMemory::saveFile() - File doesnt exist"); }
 
-        if (createFile(directory, filename) != 0) {
+        int createRes = createFile(directory, filename);
+        if (createRes != 0) {
             if (_debugLevel > 0) { Serial.println("\nQSPIFlashMemory::saveFile() - File doesnt exist, error creating it "); }
-           return -1;
+           return (createRes == -8) ? -8 : -1;
         }
         if (_debugLevel > 0) { Serial.println("\nQSPIFlashMemory::saveFile() - File didnt exist, so created it"); }
     }
@@ -417,7 +666,11 @@ int QSPIFlashMemory::saveFile(char directory[], char filename[], char content[],
         }
     }
 
-    path.resolve(resolvedPath, directory, filename);
+    FlashPathBuffer resolvedPath;
+    if (path.resolve(resolvedPath, directory, filename) != 0) {
+        if (_debugLevel > 0) { Serial.println("\nError, path longer than QSPI_FLASH_MAX_PATH_LENGTH"); }
+        return -8;
+    }
 
     File wf;
     if (overwriteExistingContent == true) {
@@ -447,21 +700,27 @@ Output:
     -1: file didnt exist and failed to create it
     -2: file already has content and user requested not to over write
     -3: Filesystem could not be mounted/accessed
+    -8: directory + filename longer than QSPI_FLASH_MAX_PATH_LENGTH
 */
 int QSPIFlashMemory::appendToFile(char directory[], char filename[], char content[]) {
-    fs.activate();
-    if (!fs.begin()) {
+    FlashLockGuard fileGuard(getFileLock(directory, filename));
+    FlashLockGuard volumeGuard(_volumeLock);
+    if (mount() != 0) {
         if (_debugLevel > 0) { Serial.print("\n -> Error, failed to mount filesystem!"); }
         return -3;
     }
     if (checkFileExists(directory, filename) == false) {
-        if (createFile(directory, filename) == false) {
-           return -1;
+        int createRes = createFile(directory, filename);
+        if (createRes != 0) {
+           return (createRes == -8) ? -8 : -1;
         }
     }
 
-    path.resolve(resolvedPath, directory, filename);
-    // fs.activate();
+    FlashPathBuffer resolvedPath;
+    if (path.resolve(resolvedPath, directory, filename) != 0) {
+        if (_debugLevel > 0) { Serial.println("\nError, path longer than QSPI_FLASH_MAX_PATH_LENGTH"); }
+        return -8;
+    }
     File wf = fs.open(resolvedPath, FILE_WRITE);
     if (!wf) {
         if (_debugLevel > 0) { Serial.println("\nError, failed to open test.txt for writing!"); }
@@ -476,39 +735,55 @@ int QSPIFlashMemory::appendToFile(char directory[], char filename[], char conten
 
 /*
 Method: appendFile()
-Description: Save content to file
+Description: Append each value of an array to a file. The volume lock is released between values
+             while the file stays open, so another task must not format(), importImage(), write
+             raw pages or run a FlashConsistencyChecker repair during the call: the remount would
+             leave the open file invalid
 Input:
     char directory[]: user-specified directory (leading /)
     char filename[]: User-specified filename (with extension)
-    char content[]: User-specified file content (NULL-terminated)
+    int content[]: Values to append
+    int contentLength: Number of values in content[]
+    bool writeLiterally: true = print each value through String(), false = print it directly
 Output:
      0: success
     -1: file didnt exist and failed to create it
     -2: file already has content and user requested not to over write
     -3: Filesystem could not be mounted/accessed
+    -8: directory + filename longer than QSPI_FLASH_MAX_PATH_LENGTH
 */
 int QSPIFlashMemory::appendToFile(char directory[], char filename[], int content[], int contentLength, bool writeLiterally) {
-    fs.activate();
-    if (!fs.begin()) {
-        if (_debugLevel > 0) { Serial.print("\n -> Error, failed to mount filesystem!"); }
-        return -3;
-    }
-    if (checkFileExists(directory, filename) == false) {
-        if (createFile(directory, filename) == false) {
-           return -1;
+    FlashLockGuard fileGuard(getFileLock(directory, filename));
+    File wf;
+    {
+        FlashLockGuard volumeGuard(_volumeLock);
+        if (mount() != 0) {
+            if (_debugLevel > 0) { Serial.print("\n -> Error, failed to mount filesystem!"); }
+            return -3;
+        }
+        if (checkFileExists(directory, filename) == false) {
+            int createRes = createFile(directory, filename);
+            if (createRes != 0) {
+               return (createRes == -8) ? -8 : -1;
+            }
         }
-    }
 
-    path.resolve(resolvedPath, directory, filename);
-    // fs.activate();
-    File wf = fs.open(resolvedPath, FILE_WRITE);
-    if (!wf) {
-        if (_debugLevel > 0) { Serial.println("\nError, failed to open test.txt for writing!"); }
-        return -2;
+        FlashPathBuffer resolvedPath;
+        if (path.resolve(resolvedPath, directory, filename) != 0) {
+            if (_debugLevel > 0) { Serial.println("\nError, path longer than QSPI_FLASH_MAX_PATH_LENGTH"); }
+            return -8;
+        }
+        wf = fs.open(resolvedPath, FILE_WRITE);
+        if (!wf) {
+            if (_debugLevel > 0) { Serial.println("\nError, failed to open test.txt for writing!"); }
+            return -2;
+        }
     }
 
+    // Volume lock is retaken per value so writers of other files can interleave
     int ptr = wf.size();
     for (int i = 0 ; i < contentLength; i++) {
+        FlashLockGuard volumeGuard(_volumeLock);
         wf.seek(ptr);
         if (writeLiterally) {
             wf.print(String(content[i]));
@@ -517,6 +792,7 @@ int QSPIFlashMemory::appendToFile(char directory[], char filename[], int content
         }
         ptr++;
     }
+    FlashLockGuard volumeGuard(_volumeLock);
     wf.close();
     return 0;
 }
@@ -533,21 +809,27 @@ Output:
     -1: file didnt exist and failed to create it
     -2: file already has content and user requested not to over write
     -3: Filesystem could not be mounted/accessed
+    -8: directory + filename longer than QSPI_FLASH_MAX_PATH_LENGTH
 */
 int QSPIFlashMemory::appendToFile(char directory[], char filename[], int content, bool writeLiterally) {
-    fs.activate();
-    if (!fs.begin()) {
+    FlashLockGuard fileGuard(getFileLock(directory, filename));
+    FlashLockGuard volumeGuard(_volumeLock);
+    if (mount() != 0) {
         if (_debugLevel > 0) { Serial.print("\n -> Error, failed to mount filesystem!"); }
         return -3;
     }
     if (checkFileExists(directory, filename) == false) {
-        if (createFile(directory, filename) == false) {
-           return -1;
+        int createRes = createFile(directory, filename);
+        if (createRes != 0) {
+           return (createRes == -8) ? -8 : -1;
         }
     }
 
-    path.resolve(resolvedPath, directory, filename);
-    // fs.activate();
+    FlashPathBuffer resolvedPath;
+    if (path.resolve(resolvedPath, directory, filename) != 0) {
+        if (_debugLevel > 0) { Serial.println("\nError, path longer than QSPI_FLASH_MAX_PATH_LENGTH"); }
+        return -8;
+    }
     File wf = fs.open(resolvedPath, FILE_WRITE);
     if (!wf) {
         if (_debugLevel > 0) { Serial.println("\nError, failed to open test.txt for writing!"); }
@@ -576,21 +858,27 @@ Output:
     -1: file didnt exist and failed to create it
     -2: file already has content and user requested not to over write
     -3: Filesystem could not be mounted/accessed
+    -8: directory + filename longer than QSPI_FLASH_MAX_PATH_LENGTH
 */
 int QSPIFlashMemory::appendToFile(char directory[], char filename[], char content) {
-    fs.activate();
-    if (!fs.begin()) {
+    FlashLockGuard fileGuard(getFileLock(directory, filename));
+    FlashLockGuard volumeGuard(_volumeLock);
+    if (mount() != 0) {
         if (_debugLevel > 0) { Serial.print("\n -> Error, failed to mount filesystem!"); }
         return -3;
     }
     if (checkFileExists(directory, filename) == false) {
-        if (createFile(directory, filename) == false) {
-           return -1;
+        int createRes = createFile(directory, filename);
+        if (createRes != 0) {
+           return (createRes == -8) ? -8 : -1;
         }
     }
 
-    path.resolve(resolvedPath, directory, filename);
-    // fs.activate();
+    FlashPathBuffer resolvedPath;
+    if (path.resolve(resolvedPath, directory, filename) != 0) {
+        if (_debugLevel > 0) { Serial.println("\nError, path longer than QSPI_FLASH_MAX_PATH_LENGTH"); }
+        return -8;
+    }
     File wf = fs.open(resolvedPath, FILE_WRITE);
     if (!wf) {
         if (_debugLevel > 0) { Serial.println("\nError, failed to open test.txt for writing!"); }
@@ -614,17 +902,23 @@ Output:
     -1: Doesnt exist
     -2: error reading
     -3: Filesystem could not be mounted/accessed
+    -8: directory + filename longer than QSPI_FLASH_MAX_PATH_LENGTH
 */
 int QSPIFlashMemory::getFilesize(char directory[], char filename[]) {
-    fs.activate();
-    if (!fs.begin()) {
+    FlashLockGuard fileGuard(getFileLock(directory, filename));
+    FlashLockGuard volumeGuard(_volumeLock);
+    if (mount() != 0) {
         if (_debugLevel > 0) { Serial.print("\n -> Error, failed to mount filesystem!"); }
         return -3;
     }
-    if (checkFileExists(directory, filename) == false) {
+    FlashPathBuffer resolvedPath;
+    if (path.resolve(resolvedPath, directory, filename) != 0) {
+        if (_debugLevel > 0) { Serial.println("\nError, path longer than QSPI_FLASH_MAX_PATH_LENGTH"); }
+        return -8;
+    }
+    if (!fs.exists(resolvedPath)) {
         return -1;
     }
-    path.resolve(resolvedPath, directory, filename);
     File cf = fs.open(resolvedPath, FILE_READ);
     if (!cf) {
         if (_debugLevel > 0) { Serial.println("\nError, failed to open file for reading"); }
@@ -637,7 +931,10 @@ int QSPIFlashMemory::getFilesize(char directory[], char filename[]) {
 
 /*
 Method: readFileContents()
-Description: Read file content to provided content array
+Description: Read file content to provided content array. The volume lock is released between
+             QSPI_FLASH_READ_CHUNK_SIZE chunks while the file stays open, so another task must not
+             format(), importImage(), write raw pages or run a FlashConsistencyChecker repair
+             during the call: the remount would leave the open file invalid
 Input:
     char directory[]: user-specified directory (leading /)
     char filename[]: User-specified filename (with extension)
@@ -648,28 +945,297 @@ Output: true = content read and stored in content[] array, false = content not w
     -1: File doesnt exist
     -2: error opening file to read
     -3: Filesystem could not be mounted/accessed
+    -8: directory + filename longer than QSPI_FLASH_MAX_PATH_LENGTH
 */
 int QSPIFlashMemory::readFileContents(char directory[], char filename[], uint8_t content[], long maxReadSize) {
-    fs.activate();
-    if (!fs.begin()) {
-        if (_debugLevel > 0) { Serial.print("\n -> Error, failed to mount filesystem!"); }
-        return -3;
+    FlashLockGuard fileGuard(getFileLock(directory, filename));
+    File cf;
+    {
+        FlashLockGuard volumeGuard(_volumeLock);
+        if (mount() != 0) {
+            if (_debugLevel > 0) { Serial.print("\n -> Error, failed to mount filesystem!"); }
+            return -3;
+        }
+        FlashPathBuffer resolvedPath;
+        if (path.resolve(resolvedPath, directory, filename) != 0) {
+            if (_debugLevel > 0) { Serial.println("\nError, path longer than QSPI_FLASH_MAX_PATH_LENGTH"); }
+            return -8;
+        }
+        if (!fs.exists(resolvedPath)) {
+            return -1;
+        }
+        cf = fs.open(resolvedPath, FILE_READ);
+        if (!cf) {
+            if (_debugLevel > 0) { Serial.println("\nError, failed to open file for reading"); }
+            return -2;
+        }
     }
-    if (checkFileExists(directory, filename) == false) {
-        return -1;
+
+    // Read in chunks, releasing the volume lock in between so other files can be accessed
+    long i = 0;
+    while (i < maxReadSize) {
+        FlashLockGuard volumeGuard(_volumeLock);
+        long chunk = maxReadSize - i;
+        if (chunk > QSPI_FLASH_READ_CHUNK_SIZE) {
+            chunk = QSPI_FLASH_READ_CHUNK_SIZE;
+        }
+        int readCount = cf.read(&content[i], chunk);
+        if (readCount <= 0) {
+            break;
+        }
+        i += readCount;
     }
-    path.resolve(resolvedPath, directory, filename);
-    File cf = fs.open(resolvedPath, FILE_READ);
-    if (!cf) {
-        if (_debugLevel > 0) { Serial.println("\nError, failed to open file for reading"); }
+    FlashLockGuard volumeGuard(_volumeLock);
+    cf.close();
+    return 0;
+}
+
+/*
+Method: appendFromStream()
+Description: Append bytes arriving on a Stream (serial, network, radio) to a file. Data goes
+    straight from the stream into one QSPI_FLASH_STREAM_BUFFER_SIZE buffer and from there into
+    the file, so nothing is assembled in RAM first. Binary safe. The volume lock is only held
+    while a full buffer is written, other files stay usable while waiting on a slow stream.
+    Stops after maxBytes or when nothing has arrived for timeoutMillis
+Input:
+    char directory[]: user-specified directory (leading /)
+    char filename[]: User-specified filename (with extension), created if it doesnt exist
+    Stream &stream: Source of the data
+    uint32_t maxBytes: Most bytes to append
+    uint32_t timeoutMillis: Idle time after which the transfer is considered complete
+Output:
+    >= 0: Bytes appended, see getStreamStats()
+    -1: file didnt exist and failed to create it
+    -2: error opening or writing the file (bytes up to the failed write are kept)
+    -3: Filesystem could not be mounted/accessed
+    -8: directory + filename longer than QSPI_FLASH_MAX_PATH_LENGTH
+*/
+long QSPIFlashMemory::appendFromStream(char directory[], char filename[], Stream &stream, uint32_t maxBytes, uint32_t timeoutMillis) {
+    return appendFromStream(directory, filename, stream, maxBytes, timeoutMillis, NULL);
+}
+
+/*
+Method: appendFromStream()
+Description: As appendFromStream() above, also returning this call's stats
+Input:
+    FlashStreamStats *stats: Receives the stats of this call, NULL if not needed
+Output: See appendFromStream() above
+*/
+long QSPIFlashMemory::appendFromStream(char directory[], char filename[], Stream &stream, uint32_t maxBytes, uint32_t timeoutMillis, FlashStreamStats *stats) {
+    FlashStreamStats result = {};
+    long res = receiveStream(directory, filename, stream, maxBytes, timeoutMillis, result);
+    publishStreamStats(result, stats);
+    return res;
+}
+
+/*
+Method: receiveStream()
+Description: Body of appendFromStream(), filling this call's stats
+Input: See appendFromStream(), FlashStreamStats &stats: Zeroed stats to fill
+Output: See appendFromStream()
+*/
+long QSPIFlashMemory::receiveStream(char directory[], char filename[], Stream &stream, uint32_t maxBytes, uint32_t timeoutMillis, FlashStreamStats &stats) {
+    uint8_t buffer[QSPI_FLASH_STREAM_BUFFER_SIZE];
+    unsigned long startMicros = micros();
+    FlashLockGuard fileGuard(getFileLock(directory, filename));
+    File wf;
+    {
+        FlashLockGuard volumeGuard(_volumeLock);
+        if (mount() != 0) {
+            if (_debugLevel > 0) { Serial.print("\n -> Error, failed to mount filesystem!"); }
+            return -3;
+        }
+        if (checkFileExists(directory, filename) == false) {
+            int createRes = createFile(directory, filename);
+            if (createRes != 0) {
+                if (_debugLevel > 0) { Serial.println("\nQSPIFlashMemory::appendFromStream() - File doesnt exist, error creating it "); }
+                return (createRes == -8) ? -8 : -1;
+            }
+        }
+        FlashPathBuffer resolvedPath;
+        if (path.resolve(resolvedPath, directory, filename) != 0) {
+            if (_debugLevel > 0) { Serial.println("\nError, path longer than QSPI_FLASH_MAX_PATH_LENGTH"); }
+            return -8;
+        }
+        wf = fs.open(resolvedPath, FILE_WRITE);
+        if (!wf) {
+            if (_debugLevel > 0) { Serial.println("\nQSPIFlashMemory::appendFromStream() - Error, failed to open file for appending content!"); }
+            return -2;
+        }
+        wf.seek(wf.size());
+    }
+
+    uint32_t total = 0;
+    uint32_t buffered = 0;
+    bool failed = false;
+    unsigned long lastDataMillis = millis();
+    while (total + buffered < maxBytes) {
+        // Fill from whatever the stream already holds, without blocking
+        unsigned long waitStart = micros();
+        int available = stream.available();
+        if (available > 0) {
+            uint32_t count = QSPI_FLASH_STREAM_BUFFER_SIZE - buffered;
+            if ((uint32_t) available < count) {
+                count = available;
+            }
+            if (maxBytes - total - buffered < count) {
+                count = maxBytes - total - buffered;
+            }
+            count = stream.readBytes(&buffer[buffered], count);
+            buffered += count;
+            lastDataMillis = millis();
+        } else if (millis() - lastDataMillis >= timeoutMillis) {
+            stats.streamMicros += micros() - waitStart;
+            break;
+        } else {
+            yield();
+        }
+        stats.streamMicros += micros() - waitStart;
+
+        if (buffered == QSPI_FLASH_STREAM_BUFFER_SIZE) {
+            FlashLockGuard volumeGuard(_volumeLock);
+            unsigned long writeStart = micros();
+            uint32_t written = wf.write(buffer, buffered);
+            stats.flashOperations++;
+            stats.flashMicros += micros() - writeStart;
+            if (written != buffered) {
+                total += written;
+                buffered = 0;
+                failed = true;
+                break;
+            }
+            total += buffered;
+            buffered = 0;
+        }
+    }
+
+    FlashLockGuard volumeGuard(_volumeLock);
+    if (buffered > 0) {
+        unsigned long writeStart = micros();
+        uint32_t written = wf.write(buffer, buffered);
+        stats.flashOperations++;
+        stats.flashMicros += micros() - writeStart;
+        total += written;
+        failed = written != buffered;
+    }
+    wf.close();
+    stats.bytes = total;
+    stats.micros = micros() - startMicros;
+    if (failed) {
+        if (_debugLevel > 0) { Serial.println("\nQSPIFlashMemory::appendFromStream() - Error, write failed (volume full?)"); }
         return -2;
     }
-    int i = 0;
-    while (cf.available() && i < maxReadSize) {
-        content[i] = cf.read();
-        i++;
+    if (_debugLevel > 2) { Serial.print("\nQSPIFlashMemory::appendFromStream() - bytes appended: "); Serial.print((unsigned long) total); }
+    return total;
+}
+
+/*
+Method: writeToStream()
+Description: Send the contents of a file to a Stream, one QSPI_FLASH_STREAM_BUFFER_SIZE buffer at a
+    time. The volume lock is only held while a buffer is read from the file
+Input:
+    char directory[]: user-specified directory (leading /)
+    char filename[]: User-specified filename (with extension)
+    Stream &stream: Destination of the data
+Output:
+    >= 0: Bytes sent, see getStreamStats()
+    -1: File doesnt exist
+    -2: error opening or reading the file
+    -3: Filesystem could not be mounted/accessed
+    -4: Stream did not accept all bytes
+    -8: directory + filename longer than QSPI_FLASH_MAX_PATH_LENGTH
+*/
+long QSPIFlashMemory::writeToStream(char directory[], char filename[], Stream &stream) {
+    return writeToStream(directory, filename, stream, NULL);
+}
+
+/*
+Method: writeToStream()
+Description: As writeToStream() above, also returning this call's stats
+Input:
+    FlashStreamStats *stats: Receives the stats of this call, NULL if not needed
+Output: See writeToStream() above
+*/
+long QSPIFlashMemory::writeToStream(char directory[], char filename[], Stream &stream, FlashStreamStats *stats) {
+    FlashStreamStats result = {};
+    long res = sendStream(directory, filename, stream, result);
+    publishStreamStats(result, stats);
+    return res;
+}
+
+/*
+Method: sendStream()
+Description: Body of writeToStream(), filling this call's stats
+Input: See writeToStream(), FlashStreamStats &stats: Zeroed stats to fill
+Output: See writeToStream()
+*/
+long QSPIFlashMemory::sendStream(char directory[], char filename[], Stream &stream, FlashStreamStats &stats) {
+    uint8_t buffer[QSPI_FLASH_STREAM_BUFFER_SIZE];
+    unsigned long startMicros = micros();
+    FlashLockGuard fileGuard(getFileLock(directory, filename));
+    File rf;
+    uint32_t size;
+    {
+        FlashLockGuard volumeGuard(_volumeLock);
+        if (mount() != 0) {
+            if (_debugLevel > 0) { Serial.print("\n -> Error, failed to mount filesystem!"); }
+            return -3;
+        }
+        FlashPathBuffer resolvedPath;
+        if (path.resolve(resolvedPath, directory, filename) != 0) {
+            if (_debugLevel > 0) { Serial.println("\nError, path longer than QSPI_FLASH_MAX_PATH_LENGTH"); }
+            return -8;
+        }
+        if (!fs.exists(resolvedPath)) {
+            return -1;
+        }
+        rf = fs.open(resolvedPath, FILE_READ);
+        if (!rf) {
+            if (_debugLevel > 0) { Serial.println("\nError, failed to open file for reading"); }
+            return -2;
+        }
+        size = rf.size();
+    }
+
+    uint32_t total = 0;
+    long result = 0;
+    while (total < size) {
+        uint32_t count = size - total;
+        if (count > QSPI_FLASH_STREAM_BUFFER_SIZE) {
+            count = QSPI_FLASH_STREAM_BUFFER_SIZE;
+        }
+        int readCount;
+        {
+            FlashLockGuard volumeGuard(_volumeLock);
+            unsigned long readStart = micros();
+            readCount = rf.read(buffer, count);
+            stats.flashOperations++;
+            stats.flashMicros += micros() - readStart;
+        }
+        if (readCount <= 0) {
+            result = -2;
+            break;
+        }
+
+        unsigned long writeStart = micros();
+        uint32_t sent = stream.write(buffer, readCount);
+        stats.streamMicros += micros() - writeStart;
+        total += sent;
+        if (sent != (uint32_t) readCount) {
+            result = -4;
+            break;
+        }
+    }
+
+    FlashLockGuard volumeGuard(_volumeLock);
+    rf.close();
+    stats.bytes = total;
+    stats.micros = micros() - startMicros;
+    if (result < 0) {
+        if (_debugLevel > 0) { Serial.print("\nQSPIFlashMemory::writeToStream() - Error, transfer stopped after bytes: "); Serial.print((unsigned long) total); }
+        return result;
     }
-    return 0;
+    return total;
 }
 
 /*
@@ -683,15 +1249,21 @@ Output:
     -1: File could not be deleted
     -1: File was not deleted
     -3: Filesystem could not be mounted/accessed
+    -8: directory + filename longer than QSPI_FLASH_MAX_PATH_LENGTH
 */
 int QSPIFlashMemory::deleteFile(char directory[], char filename[]) {
-    fs.activate();
-    if (!fs.begin()) {
+    FlashLockGuard fileGuard(getFileLock(directory, filename));
+    FlashLockGuard volumeGuard(_volumeLock);
+    if (mount() != 0) {
         if (_debugLevel > 0) { Serial.print("\n -> Error, failed to mount filesystem!"); }
         return -3;
     }
 
-    path.resolve(resolvedPath, directory, filename);
+    FlashPathBuffer resolvedPath;
+    if (path.resolve(resolvedPath, directory, filename) != 0) {
+        if (_debugLevel > 0) { Serial.println("\nError, path longer than QSPI_FLASH_MAX_PATH_LENGTH"); }
+        return -8;
+    }
     if (!fs.remove(resolvedPath)) {
         if (_debugLevel > 0) { Serial.println("\nError, couldn't delete test.txt file!"); }
         return -1;
@@ -716,8 +1288,8 @@ Output:
     -3: Filesystem could not be mounted/accessed
 */
 int QSPIFlashMemory::deleteDirectory(char directory[]) {
-    fs.activate();
-    if (!fs.begin()) {
+    FlashLockGuard volumeGuard(_volumeLock);
+    if (mount() != 0) {
         if (_debugLevel > 0) { Serial.print("\n -> Error, failed to mount filesystem!"); }
         return -3;
     }
@@ -734,13 +1306,56 @@ int QSPIFlashMemory::deleteDirectory(char directory[]) {
     return 0;
 }
 
+/*
+Method: querySeries()
+Description: Deliver the records of a time series file between two timestamps (see FlashTimeSeries.h)
+Input:
+    char directory[]: user-specified directory (leading /)
+    char filename[]: User-specified series filename (with extension)
+    uint32_t startTime: First timestamp of interest
+    uint32_t endTime: Last timestamp of interest
+    FlashSeriesCallback callback: Called once per matching record
+Output: See querySeries(directory, filename, startTime, endTime, callback, context)
+*/
+long QSPIFlashMemory::querySeries(char directory[], char filename[], uint32_t startTime, uint32_t endTime, FlashSeriesCallback callback) {
+    return querySeries(directory, filename, startTime, endTime, callback, NULL);
+}
+
+/*
+Method: querySeries()
+Description: Deliver the records of a time series file between two timestamps.
+             Seeks through the sparse index so only the matching pages are read
+Input:
+    char directory[]: user-specified directory (leading /)
+    char filename[]: User-specified series filename (with extension)
+    uint32_t startTime: First timestamp of interest
+    uint32_t endTime: Last timestamp of interest
+    FlashSeriesCallback callback: Called once per matching record
+    void *context: Passed through to the callback
+Output:
+    >= 0: Number of records delivered
+      -1: Series doesn't exist
+      -2: error opening or reading
+      -3: Filesystem could not be mounted/accessed
+*/
+long QSPIFlashMemory::querySeries(char directory[], char filename[], uint32_t startTime, uint32_t endTime, FlashSeriesCallback callback, void *context) {
+    FlashTimeSeries series(*this);
+    int res = series.begin(directory, filename, true);
+    if (res != 0) {
+        return res;
+    }
+    long delivered = series.query(startTime, endTime, callback, context);
+    series.end();
+    return delivered;
+}
+
 /*
 Method: getFlashQSPIInterface()
 Description: get the raw QSPI_GD25Q flash object
 Input: None
-Output: Adafruit_QSPI_GD25Q object
+Output: Adafruit_QSPI_GD25Q object (reference to the driver in use, not a copy)
 */
-Adafruit_QSPI_GD25Q QSPIFlashMemory::getFlashQSPIInterface() {
+Adafruit_QSPI_GD25Q &QSPIFlashMemory::getFlashQSPIInterface() {
     return flash;
 }
 
@@ -748,8 +1363,849 @@ Adafruit_QSPI_GD25Q QSPIFlashMemory::getFlashQSPIInterface() {
 Method: getFlashFileSystemInterface()
 Description: get the raw FatFs object for low-level controls
 Input: None
-Output: Adafruit_W25Q16BV_FatFs object
+Output: Adafruit_W25Q16BV_FatFs object (reference to the mounted filesystem, not a copy)
 */
-Adafruit_W25Q16BV_FatFs QSPIFlashMemory::getFlashFileSystemInterface() {
+Adafruit_W25Q16BV_FatFs &QSPIFlashMemory::getFlashFileSystemInterface() {
     return fs;
 }
+
+/*
+Method: setLocks()
+Description: Enable locking with a single volume lock (every helper call is serialised)
+Input:
+    FlashLock *volumeLock: Recursive lock guarding all FatFs access (NULL = no locking)
+Output: N/A
+*/
+void QSPIFlashMemory::setLocks(FlashLock *volumeLock) {
+    setLocks(volumeLock, NULL, 0);
+}
+
+/*
+Method: setLocks()
+Description: Enable locking with a volume lock and a table of per-file locks (see FlashLock.h)
+Input:
+    FlashLock *volumeLock: Recursive lock guarding all FatFs access (NULL = no locking)
+    FlashLock *fileLocks[]: Recursive locks, a file uses the entry selected by its path hash
+    uint8_t fileLockCount: Number of entries in fileLocks[] (0 = no per-file locking)
+Output: N/A
+*/
+void QSPIFlashMemory::setLocks(FlashLock *volumeLock, FlashLock *fileLocks[], uint8_t fileLockCount) {
+    _volumeLock = volumeLock;
+    _fileLocks = fileLocks;
+    _fileLockCount = (fileLocks == NULL) ? 0 : fileLockCount;
+}
+
+/*
+Method: getVolumeLock()
+Description: Get the lock guarding FatFs access, for callers using the raw File objects
+Input: None
+Output: FlashLock pointer (NULL when locking is disabled)
+*/
+FlashLock *QSPIFlashMemory::getVolumeLock() {
+    return _volumeLock;
+}
+
+/*
+Method: getFileLock()
+Description: Get the lock guarding a specific file
+Input:
+    char directory[]: user-specified directory (leading /)
+    char filename[]: User-specified filename (with extension)
+Output: FlashLock pointer (NULL when per-file locking is disabled)
+*/
+FlashLock *QSPIFlashMemory::getFileLock(char directory[], char filename[]) {
+    if (_fileLockCount == 0) {
+        return NULL;
+    }
+    // FNV-1a over directory + filename, no need to resolve the path
+    uint32_t hash = 2166136261UL;
+    for (char *c = directory; *c != 0; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619UL;
+    }
+    hash = (hash ^ '/') * 16777619UL;
+    for (char *c = filename; *c != 0; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619UL;
+    }
+    return _fileLocks[hash % _fileLockCount];
+}
+
+/*
+Method: getSectorCount()
+Description: Number of erasable sectors (QSPI_FLASH_SECTOR_SIZE bytes each)
+Input: None
+Output: uint32_t sector count
+*/
+uint32_t QSPIFlashMemory::getSectorCount() {
+    return ((uint32_t) pageCount * pageSize) / QSPI_FLASH_SECTOR_SIZE;
+}
+
+/*
+Method: getBlockCount()
+Description: Number of erasable blocks (QSPI_FLASH_BLOCK_SIZE bytes each)
+Input: None
+Output: uint32_t block count
+*/
+uint32_t QSPIFlashMemory::getBlockCount() {
+    return ((uint32_t) pageCount * pageSize) / QSPI_FLASH_BLOCK_SIZE;
+}
+
+/*
+Method: readPages()
+Description: Read whole pages straight from the chip, bypassing the filesystem
+Input:
+    uint32_t firstPage: First page to read (0 - pageCount-1)
+    uint32_t count: Number of pages to read
+    uint8_t buffer[]: Destination, at least count * pageSize bytes
+Output:
+     0: success
+    -1: Page range out of bounds
+    -2: Read error
+*/
+int QSPIFlashMemory::readPages(uint32_t firstPage, uint32_t count, uint8_t buffer[]) {
+    // Checked before multiplying so count * pageSize can't wrap
+    if (count > pageCount) {
+        return -1;
+    }
+    FlashIOVec vector = { buffer, count * pageSize };
+    return readPages(firstPage, &vector, 1);
+}
+
+/*
+Method: readPages()
+Description: Read consecutive pages into a scatter-gather list of buffers
+Input:
+    uint32_t firstPage: First page to read (0 - pageCount-1)
+    FlashIOVec vectors[]: Destination buffers, filled in order
+    uint8_t vectorCount: Number of entries in vectors[]
+Output:
+     0: success
+    -1: Page range out of bounds or total length not a whole number of pages
+    -2: Read error
+*/
+int QSPIFlashMemory::readPages(uint32_t firstPage, FlashIOVec vectors[], uint8_t vectorCount) {
+    uint32_t total = 0;
+    for (uint8_t i = 0 ; i < vectorCount ; i++) {
+        if (vectors[i].length > 0xFFFFFFFFUL - total) {
+            return -1;
+        }
+        total += vectors[i].length;
+    }
+    if (checkPageRange(firstPage, total) != 0) {
+        return -1;
+    }
+
+    FlashLockGuard volumeGuard(_volumeLock);
+    unsigned long start = micros();
+    uint32_t address = firstPage * pageSize;
+    for (uint8_t i = 0 ; i < vectorCount ; i++) {
+        if (vectors[i].length == 0) {
+            continue;
+        }
+        if (flash.readBuffer(address, vectors[i].buffer, vectors[i].length) != vectors[i].length) {
+            if (_debugLevel > 0) { Serial.print("\nQSPIFlashMemory::readPages() - Read failed at 0x"); Serial.print(address, HEX); }
+            return -2;
+        }
+        address += vectors[i].length;
+    }
+    recordOperation(_rawStats.read, total, start);
+    return 0;
+}
+
+/*
+Method: programPages()
+Description: Program whole pages straight to the chip, bypassing the filesystem.
+             Pages must have been erased first (see eraseSector()/eraseBlock()).
+             The next helper call remounts the filesystem, Files opened before can no longer be used
+Input:
+    uint32_t firstPage: First page to program (0 - pageCount-1)
+    uint32_t count: Number of pages to program
+    uint8_t buffer[]: Source, count * pageSize bytes
+Output:
+     0: success
+    -1: Page range out of bounds
+    -2: Program error
+*/
+int QSPIFlashMemory::programPages(uint32_t firstPage, uint32_t count, uint8_t buffer[]) {
+    // Checked before multiplying so count * pageSize can't wrap
+    if (count > pageCount) {
+        return -1;
+    }
+    FlashIOVec vector = { buffer, count * pageSize };
+    return programPages(firstPage, &vector, 1);
+}
+
+/*
+Method: programPages()
+Description: Program consecutive pages from a scatter-gather list of buffers.
+             Whole pages inside a segment are written directly, pages spanning
+             segments are gathered into one page buffer first so every page is a single program command.
+             The next helper call remounts the filesystem, Files opened before can no longer be used
+Input:
+    uint32_t firstPage: First page to program (0 - pageCount-1)
+    FlashIOVec vectors[]: Source buffers, consumed in order
+    uint8_t vectorCount: Number of entries in vectors[]
+Output:
+     0: success
+    -1: Page range out of bounds or total length not a whole number of pages
+    -2: Program error
+*/
+int QSPIFlashMemory::programPages(uint32_t firstPage, FlashIOVec vectors[], uint8_t vectorCount) {
+    uint32_t total = 0;
+    for (uint8_t i = 0 ; i < vectorCount ; i++) {
+        if (vectors[i].length > 0xFFFFFFFFUL - total) {
+            return -1;
+        }
+        total += vectors[i].length;
+    }
+    if (checkPageRange(firstPage, total) != 0 || pageSize > QSPI_FLASH_MAX_PAGE_SIZE) {
+        return -1;
+    }
+
+    FlashLockGuard volumeGuard(_volumeLock);
+    // FatFs' cached sectors may no longer match the chip, remount before the next FatFs access
+    _mounted = false;
+    unsigned long start = micros();
+#if QSPI_FLASH_STATIC_ARENA
+    uint8_t *page = arenaPageBuffer;
+#else
+    uint8_t page[QSPI_FLASH_MAX_PAGE_SIZE];
+#endif
+    uint16_t staged = 0;
+    uint32_t address = firstPage * pageSize;
+    for (uint8_t i = 0 ; i < vectorCount ; i++) {
+        uint8_t *source = vectors[i].buffer;
+        uint32_t remaining = vectors[i].length;
+        while (remaining > 0) {
+            if (staged == 0 && remaining >= pageSize) {
+                uint32_t direct = remaining - (remaining % pageSize);
+                if (flash.writeBuffer(address, source, direct) != direct) {
+                    if (_debugLevel > 0) { Serial.print("\nQSPIFlashMemory::programPages() - Program failed at 0x"); Serial.print(address, HEX); }
+                    return -2;
+                }
+                address += direct;
+                source += direct;
+                remaining -= direct;
+                continue;
+            }
+            uint32_t copy = pageSize - staged;
+            if (copy > remaining) {
+                copy = remaining;
+            }
+            memcpy(&page[staged], source, copy);
+            staged += copy;
+            source += copy;
+            remaining -= copy;
+            if (staged == pageSize) {
+                if (flash.writeBuffer(address, page, pageSize) != pageSize) {
+                    if (_debugLevel > 0) { Serial.print("\nQSPIFlashMemory::programPages() - Program failed at 0x"); Serial.print(address, HEX); }
+                    return -2;
+                }
+                address += pageSize;
+                staged = 0;
+            }
+        }
+    }
+    recordOperation(_rawStats.program, total, start);
+    return 0;
+}
+
+/*
+Method: eraseSector()
+Description: Erase one sector (QSPI_FLASH_SECTOR_SIZE bytes) to 0xFF, bypassing the filesystem.
+             The next helper call remounts the filesystem, Files opened before can no longer be used
+Input:
+    uint32_t sector: Sector number (0 - getSectorCount()-1)
+Output:
+     0: success
+    -1: Sector out of bounds
+    -2: Erase error
+*/
+int QSPIFlashMemory::eraseSector(uint32_t sector) {
+    if (sector >= getSectorCount()) {
+        return -1;
+    }
+    FlashLockGuard volumeGuard(_volumeLock);
+    _mounted = false;
+    unsigned long start = micros();
+    if (!flash.eraseSector(sector)) {
+        if (_debugLevel > 0) { Serial.print("\nQSPIFlashMemory::eraseSector() - Erase failed for sector "); Serial.print(sector); }
+        return -2;
+    }
+    recordOperation(_rawStats.eraseSector, QSPI_FLASH_SECTOR_SIZE, start);
+    return 0;
+}
+
+/*
+Method: eraseBlock()
+Description: Erase one block (QSPI_FLASH_BLOCK_SIZE bytes) to 0xFF, bypassing the filesystem.
+             The next helper call remounts the filesystem, Files opened before can no longer be used
+Input:
+    uint32_t block: Block number (0 - getBlockCount()-1)
+Output:
+     0: success
+    -1: Block out of bounds
+    -2: Erase error
+*/
+int QSPIFlashMemory::eraseBlock(uint32_t block) {
+    if (block >= getBlockCount()) {
+        return -1;
+    }
+    FlashLockGuard volumeGuard(_volumeLock);
+    _mounted = false;
+    unsigned long start = micros();
+    if (!flash.eraseBlock(block)) {
+        if (_debugLevel > 0) { Serial.print("\nQSPIFlashMemory::eraseBlock() - Erase failed for block "); Serial.print(block); }
+        return -2;
+    }
+    recordOperation(_rawStats.eraseBlock, QSPI_FLASH_BLOCK_SIZE, start);
+    return 0;
+}
+
+/*
+Method: getRawStats()
+Description: Get counts and timings of the raw block operations since the last reset
+Input: None
+Output: FlashRawStats struct
+*/
+FlashRawStats QSPIFlashMemory::getRawStats() {
+    FlashLockGuard volumeGuard(_volumeLock);
+    return _rawStats;
+}
+
+/*
+Method: resetRawStats()
+Description: Clear the raw block operation counts and timings
+Input: None
+Output: N/A
+*/
+void QSPIFlashMemory::resetRawStats() {
+    FlashLockGuard volumeGuard(_volumeLock);
+    memset(&_rawStats, 0, sizeof(_rawStats));
+}
+
+/*
+Method: buildImageManifest()
+Description: CRC-32 of every sector, for a sender to leave unchanged sectors out of an export
+             (see exportImage(stream, manifest))
+Input:
+    uint32_t manifest[]: Destination, one entry per sector
+    uint32_t sectorCount: Entries in manifest[], must be getSectorCount()
+Output:
+     0: success
+    -1: sectorCount doesn't match the chip
+    -4: Flash read error
+*/
+int QSPIFlashMemory::buildImageManifest(uint32_t manifest[], uint32_t sectorCount) {
+    return buildImageManifest(manifest, sectorCount, NULL);
+}
+
+/*
+Method: buildImageManifest()
+Description: As buildImageManifest() above, also returning this call's stats
+Input:
+    FlashImageStats *stats: Receives the stats of this call, NULL if not needed
+Output: See buildImageManifest() above
+*/
+int QSPIFlashMemory::buildImageManifest(uint32_t manifest[], uint32_t sectorCount, FlashImageStats *stats) {
+    FlashLockGuard volumeGuard(_volumeLock);
+    FlashImageStats result = {};
+    result.failedSector = QSPI_FLASH_IMAGE_NO_SECTOR;
+    int res = readManifest(manifest, sectorCount, result);
+    publishImageStats(result, stats);
+    return res;
+}
+
+/*
+Method: readManifest()
+Description: Body of buildImageManifest(), filling this call's stats. Volume lock held by the caller
+Input: See buildImageManifest(), FlashImageStats &stats: Stats to fill
+Output: See buildImageManifest()
+*/
+int QSPIFlashMemory::readManifest(uint32_t manifest[], uint32_t sectorCount, FlashImageStats &stats) {
+    if (sectorCount == 0 || sectorCount != getSectorCount()) {
+        return -1;
+    }
+#if QSPI_FLASH_STATIC_ARENA
+    uint8_t *chunk = arenaImageBuffer;
+#else
+    uint8_t chunk[QSPI_FLASH_IMAGE_CHUNK_SIZE];
+#endif
+    unsigned long start = micros();
+    for (uint32_t sector = 0 ; sector < sectorCount ; sector++) {
+        bool erased;
+        if (readSectorCRC(sector, chunk, false, manifest[sector], erased) != 0) {
+            stats.failedSector = sector;
+            return -4;
+        }
+    }
+    stats.micros = micros() - start;
+    return 0;
+}
+
+/*
+Method: exportImage()
+Description: Stream the whole chip as an image (see FlashImageFormat.h), erased sectors are
+             sent as a short ERASED frame
+Input:
+    Stream &stream: Destination
+Output: See exportImage(stream, manifest)
+*/
+long QSPIFlashMemory::exportImage(Stream &stream) {
+    return exportImage(stream, NULL);
+}
+
+/*
+Method: exportImage()
+Description: Stream the chip as an image, leaving out sectors whose CRC-32 matches the
+             receiver's manifest. Each sector is read once into a QSPI_FLASH_SECTOR_SIZE buffer,
+             its CRC-32 is computed as the chunks arrive and sent after the contents as the frame
+             trailer. A delta image records the manifest's fingerprint so importImage() can
+             reject it on a unit whose contents differ. The volume lock is held throughout so
+             the image is consistent
+Input:
+    Stream &stream: Destination
+    uint32_t manifest[]: getSectorCount() CRCs from the receiver's buildImageManifest(), or NULL for a full image
+Output:
+    >= 0: Sectors sent (data + erased), see getImageStats()
+      -1: Chip geometry unknown (not initialised)
+      -3: Stream write failed
+      -4: Flash read error
+*/
+long QSPIFlashMemory::exportImage(Stream &stream, uint32_t manifest[]) {
+    return exportImage(stream, manifest, NULL);
+}
+
+/*
+Method: exportImage()
+Description: As exportImage(stream, manifest) above, also returning this call's stats
+Input:
+    FlashImageStats *stats: Receives the stats of this call, NULL if not needed
+Output: See exportImage(stream, manifest) above
+*/
+long QSPIFlashMemory::exportImage(Stream &stream, uint32_t manifest[], FlashImageStats *stats) {
+    FlashLockGuard volumeGuard(_volumeLock);
+    FlashImageStats result = {};
+    result.failedSector = QSPI_FLASH_IMAGE_NO_SECTOR;
+    long res = sendImage(stream, manifest, result);
+    publishImageStats(result, stats);
+    return res;
+}
+
+/*
+Method: sendImage()
+Description: Body of exportImage(), filling this call's stats. Volume lock held by the caller
+Input: See exportImage(stream, manifest), FlashImageStats &stats: Stats to fill
+Output: See exportImage(stream, manifest)
+*/
+long QSPIFlashMemory::sendImage(Stream &stream, uint32_t manifest[], FlashImageStats &stats) {
+    uint32_t sectorCount = getSectorCount();
+    if (sectorCount == 0) {
+        return -1;
+    }
+#if QSPI_FLASH_STATIC_ARENA
+    uint8_t *contents = arenaSectorBuffer;
+#else
+    uint8_t contents[QSPI_FLASH_SECTOR_SIZE];
+#endif
+    uint8_t header[QSPI_FLASH_IMAGE_HEADER_SIZE];
+    uint8_t frame[QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE + 4];
+    unsigned long start = micros();
+
+    if (manifest != NULL) {
+        flashImageEncodeHeader(header, QSPI_FLASH_SECTOR_SIZE, sectorCount, QSPI_FLASH_IMAGE_FLAG_DELTA, flashImageManifestFingerprint(manifest, sectorCount));
+    } else {
+        flashImageEncodeHeader(header, QSPI_FLASH_SECTOR_SIZE, sectorCount, 0);
+    }
+    if (stream.write(header, sizeof(header)) != sizeof(header)) {
+        return -3;
+    }
+    stats.streamBytes += sizeof(header);
+
+    uint32_t frames = 0;
+    for (uint32_t sector = 0 ; sector < sectorCount ; sector++) {
+        uint32_t crc;
+        bool erased;
+        if (readSectorCRC(sector, contents, true, crc, erased) != 0) {
+            stats.failedSector = sector;
+            return -4;
+        }
+        if (manifest != NULL && manifest[sector] == crc) {
+            stats.skippedSectors++;
+            continue;
+        }
+
+        flashImageEncodeFrameHeader(frame, erased ? QSPI_FLASH_IMAGE_FRAME_ERASED : QSPI_FLASH_IMAGE_FRAME_DATA, sector);
+        if (stream.write(frame, QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE) != QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE) {
+            stats.failedSector = sector;
+            return -3;
+        }
+        if (!erased) {
+            if (stream.write(contents, QSPI_FLASH_SECTOR_SIZE) != QSPI_FLASH_SECTOR_SIZE) {
+                stats.failedSector = sector;
+                return -3;
+            }
+            stats.streamBytes += QSPI_FLASH_SECTOR_SIZE;
+            stats.dataSectors++;
+        } else {
+            stats.erasedSectors++;
+        }
+        flashImagePut32(&frame[QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE], flashImageFrameCRC(frame, erased ? 0 : crc));
+        if (stream.write(&frame[QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE], 4) != 4) {
+            stats.failedSector = sector;
+            return -3;
+        }
+        stats.streamBytes += sizeof(frame);
+        frames++;
+    }
+
+    flashImageEncodeFrameHeader(frame, QSPI_FLASH_IMAGE_FRAME_END, frames);
+    flashImagePut32(&frame[QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE], flashImageFrameCRC(frame, 0));
+    if (stream.write(frame, sizeof(frame)) != sizeof(frame)) {
+        return -3;
+    }
+    stream.flush();
+    stats.streamBytes += sizeof(frame);
+    stats.micros = micros() - start;
+    return frames;
+}
+
+/*
+Method: importImage()
+Description: Write an image from exportImage() (full or delta) to the chip and remount.
+             Each data frame is received whole into a QSPI_FLASH_SECTOR_SIZE buffer and
+             checked against its CRC before its sector is erased, so a corrupt or truncated
+             frame leaves that sector as it was (see getImageStats().failedSector). Sectors
+             of earlier frames are already written, so a failed import still leaves the
+             volume unusable until an import completes. A delta image is only applied when the
+             chip still has the contents its manifest was built from (the whole chip is read
+             once to check, before anything is written).
+             Reads use the stream's timeout (setTimeout()). The volume lock is held throughout
+Input:
+    Stream &stream: Source
+Output:
+    >= 0: Sectors written (data + erased), see getImageStats()
+      -1: Not an image, or made for a different chip size
+      -2: Corrupt frame
+      -3: Stream ended or timed out
+      -4: Flash read/erase/program error
+      -5: Filesystem could not be mounted after the import
+      -6: Delta image made against different chip contents, nothing written
+*/
+long QSPIFlashMemory::importImage(Stream &stream) {
+    return importImage(stream, NULL);
+}
+
+/*
+Method: importImage()
+Description: As importImage() above, also returning this call's stats
+Input:
+    FlashImageStats *stats: Receives the stats of this call, NULL if not needed
+Output: See importImage() above
+*/
+long QSPIFlashMemory::importImage(Stream &stream, FlashImageStats *stats) {
+    FlashLockGuard volumeGuard(_volumeLock);
+    FlashImageStats result = {};
+    result.failedSector = QSPI_FLASH_IMAGE_NO_SECTOR;
+    long res = receiveImage(stream, result);
+    publishImageStats(result, stats);
+    return res;
+}
+
+/*
+Method: receiveImage()
+Description: Body of importImage(), filling this call's stats. Volume lock held by the caller
+Input: See importImage(), FlashImageStats &stats: Stats to fill
+Output: See importImage()
+*/
+long QSPIFlashMemory::receiveImage(Stream &stream, FlashImageStats &stats) {
+    uint32_t sectorCount = getSectorCount();
+    if (sectorCount == 0) {
+        return -1;
+    }
+#if QSPI_FLASH_STATIC_ARENA
+    uint8_t *chunk = arenaImageBuffer;
+    uint8_t *contents = arenaSectorBuffer;
+#else
+    uint8_t chunk[QSPI_FLASH_IMAGE_CHUNK_SIZE];
+    uint8_t contents[QSPI_FLASH_SECTOR_SIZE];
+#endif
+    uint8_t header[QSPI_FLASH_IMAGE_HEADER_SIZE];
+    uint8_t frame[QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE + 4];
+    uint32_t pagesPerChunk = QSPI_FLASH_IMAGE_CHUNK_SIZE / pageSize;
+    unsigned long start = micros();
+
+    if (stream.readBytes(header, sizeof(header)) != sizeof(header)) {
+        return -3;
+    }
+    uint32_t imageSectorSize;
+    uint32_t imageSectorCount;
+    uint8_t flags;
+    uint32_t baseFingerprint;
+    if (flashImageDecodeHeader(header, imageSectorSize, imageSectorCount, flags, baseFingerprint) != 0
+        || imageSectorSize != QSPI_FLASH_SECTOR_SIZE || imageSectorCount != sectorCount) {
+        if (_debugLevel > 0) { Serial.print("\nQSPIFlashMemory::importImage() - Image doesn't match this chip"); }
+        return -1;
+    }
+    stats.streamBytes += sizeof(header);
+
+    if (flags & QSPI_FLASH_IMAGE_FLAG_DELTA) {
+        uint32_t fingerprint = 0;
+        for (uint32_t sector = 0 ; sector < sectorCount ; sector++) {
+            uint32_t crc;
+            bool erased;
+            if (readSectorCRC(sector, chunk, false, crc, erased) != 0) {
+                stats.failedSector = sector;
+                return -4;
+            }
+            fingerprint = flashImageFingerprintAdd(fingerprint, crc);
+        }
+        if (fingerprint != baseFingerprint) {
+            if (_debugLevel > 0) { Serial.print("\nQSPIFlashMemory::importImage() - Delta image was made for different contents"); }
+            return -6;
+        }
+    }
+
+    uint32_t frames = 0;
+    while (true) {
+        if (stream.readBytes(frame, QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE) != QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE) {
+            return -3;
+        }
+        uint8_t type = frame[0];
+        uint32_t sector = flashImageGet32(&frame[4]);
+        if (type == QSPI_FLASH_IMAGE_FRAME_END) {
+            if (stream.readBytes(&frame[QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE], 4) != 4) {
+                return -3;
+            }
+            if (flashImageGet32(&frame[QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE]) != flashImageFrameCRC(frame, 0) || sector != frames) {
+                return -2;
+            }
+            stats.streamBytes += sizeof(frame);
+            break;
+        }
+        if ((type != QSPI_FLASH_IMAGE_FRAME_DATA && type != QSPI_FLASH_IMAGE_FRAME_ERASED) || sector >= sectorCount) {
+            if (_debugLevel > 0) { Serial.print("\nQSPIFlashMemory::importImage() - Bad frame header"); }
+            return -2;
+        }
+
+        // Receive and check the whole frame before the sector is touched
+        stats.failedSector = sector;
+        uint32_t crc = 0;
+        if (type == QSPI_FLASH_IMAGE_FRAME_DATA) {
+            if (stream.readBytes(contents, QSPI_FLASH_SECTOR_SIZE) != QSPI_FLASH_SECTOR_SIZE) {
+                return -3;
+            }
+            crc = flashCRC32(contents, QSPI_FLASH_SECTOR_SIZE);
+        }
+        if (stream.readBytes(&frame[QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE], 4) != 4) {
+            return -3;
+        }
+        if (flashImageGet32(&frame[QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE]) != flashImageFrameCRC(frame, crc)) {
+            if (_debugLevel > 0) { Serial.print("\nQSPIFlashMemory::importImage() - CRC mismatch in sector "); Serial.print(sector); }
+            return -2;
+        }
+        stats.streamBytes += (type == QSPI_FLASH_IMAGE_FRAME_DATA) ? sizeof(frame) + QSPI_FLASH_SECTOR_SIZE : sizeof(frame);
+
+        // The filesystem is rewritten underneath FatFs from here on. Skip the erase when the sector is blank already
+        _mounted = false;
+        bool erased;
+        if (readSectorCRC(sector, chunk, false, crc, erased) != 0) {
+            return -4;
+        }
+        if (!erased && eraseSector(sector) != 0) {
+            return -4;
+        }
+        if (type == QSPI_FLASH_IMAGE_FRAME_DATA) {
+            uint32_t firstPage = sector * (QSPI_FLASH_SECTOR_SIZE / pageSize);
+            for (uint32_t offset = 0 ; offset < QSPI_FLASH_SECTOR_SIZE ; offset += QSPI_FLASH_IMAGE_CHUNK_SIZE) {
+                if (!flashImageIsErased(&contents[offset], QSPI_FLASH_IMAGE_CHUNK_SIZE)
+                    && programPages(firstPage + (offset / pageSize), pagesPerChunk, &contents[offset]) != 0) {
+                    return -4;
+                }
+            }
+            stats.dataSectors++;
+        } else if (erased) {
+            stats.skippedSectors++;
+        } else {
+            stats.erasedSectors++;
+        }
+        stats.failedSector = QSPI_FLASH_IMAGE_NO_SECTOR;
+        frames++;
+    }
+    stats.micros = micros() - start;
+
+    if (mount() != 0) {
+        return -5;
+    }
+    return stats.dataSectors + stats.erasedSectors;
+}
+
+/*
+Method: getImageStats()
+Description: Get sector counts, stream bytes and time of the last completed image operation.
+             With several tasks this may be another task's call, pass a FlashImageStats
+             pointer to the operation itself to get its own
+Input: None
+Output: FlashImageStats struct
+*/
+FlashImageStats QSPIFlashMemory::getImageStats() {
+    FlashLockGuard volumeGuard(_volumeLock);
+    return _imageStats;
+}
+
+/*
+Method: getStreamStats()
+Description: Get bytes, flash operations and time of the last completed appendFromStream() or
+             writeToStream(). With several tasks this may be another task's transfer, pass a
+             FlashStreamStats pointer to the transfer itself to get its own
+Input: None
+Output: FlashStreamStats struct
+*/
+FlashStreamStats QSPIFlashMemory::getStreamStats() {
+    FlashLockGuard volumeGuard(_volumeLock);
+    return _streamStats;
+}
+
+/*
+Method: publishImageStats()
+Description: Make a finished image operation's stats the ones getImageStats() returns.
+             Volume lock held by the caller
+Input:
+    FlashImageStats &result: Stats of the finished call
+    FlashImageStats *stats: Caller's copy, or NULL
+Output: N/A
+*/
+void QSPIFlashMemory::publishImageStats(FlashImageStats &result, FlashImageStats *stats) {
+    _imageStats = result;
+    if (stats != NULL) {
+        *stats = result;
+    }
+}
+
+/*
+Method: publishStreamStats()
+Description: Make a finished transfer's stats the ones getStreamStats() returns. Copied under
+             the volume lock, transfers on other files may finish at the same time
+Input:
+    FlashStreamStats &result: Stats of the finished call
+    FlashStreamStats *stats: Caller's copy, or NULL
+Output: N/A
+*/
+void QSPIFlashMemory::publishStreamStats(FlashStreamStats &result, FlashStreamStats *stats) {
+    FlashLockGuard volumeGuard(_volumeLock);
+    _streamStats = result;
+    if (stats != NULL) {
+        *stats = result;
+    }
+}
+
+/*
+Method: checkPageRange()
+Description: Validate a raw access against the chip geometry
+Input:
+    uint32_t firstPage: First page accessed
+    uint32_t byteCount: Bytes accessed from the start of firstPage
+Output:
+     0: valid
+    -1: not a whole number of pages, or beyond pageCount
+*/
+int QSPIFlashMemory::checkPageRange(uint32_t firstPage, uint32_t byteCount) {
+    if (pageSize == 0 || byteCount % pageSize != 0) {
+        if (_debugLevel > 1) { Serial.print("\nQSPIFlashMemory - Raw access is not a whole number of pages"); }
+        return -1;
+    }
+    if (firstPage >= pageCount || byteCount / pageSize > (uint32_t) pageCount - firstPage) {
+        if (_debugLevel > 1) { Serial.print("\nQSPIFlashMemory - Raw access out of bounds"); }
+        return -1;
+    }
+    return 0;
+}
+
+/*
+Method: recordOperation()
+Description: Add a completed raw operation to its timing stats
+Input:
+    FlashOperationStats &stats: Stats to update
+    uint32_t bytes: Bytes transferred or erased
+    unsigned long startMicros: micros() when the operation started
+Output: N/A
+*/
+void QSPIFlashMemory::recordOperation(FlashOperationStats &stats, uint32_t bytes, unsigned long startMicros) {
+    uint32_t elapsed = micros() - startMicros;
+    stats.operations++;
+    stats.bytes += bytes;
+    stats.lastMicros = elapsed;
+    stats.totalMicros += elapsed;
+    if (elapsed > stats.maxMicros) {
+        stats.maxMicros = elapsed;
+    }
+}
+
+/*
+Method: readSectorCRC()
+Description: Read a sector in QSPI_FLASH_IMAGE_CHUNK_SIZE pieces for its CRC-32 and erased state
+Input:
+    uint32_t sector: Sector number
+    uint8_t buffer[]: QSPI_FLASH_IMAGE_CHUNK_SIZE bytes reused for every piece, or
+                      QSPI_FLASH_SECTOR_SIZE bytes that receive the whole sector (keepSector)
+    bool keepSector: true = keep the contents in buffer[]
+    uint32_t &crc: Set to flashCRC32() of the sector
+    bool &erased: Set to true if the sector is all 0xFF
+Output:
+     0: success
+    -4: Flash read error
+*/
+int QSPIFlashMemory::readSectorCRC(uint32_t sector, uint8_t buffer[], bool keepSector, uint32_t &crc, bool &erased) {
+    uint32_t firstPage = sector * (QSPI_FLASH_SECTOR_SIZE / pageSize);
+    crc = 0;
+    erased = true;
+    for (uint32_t offset = 0 ; offset < QSPI_FLASH_SECTOR_SIZE ; offset += QSPI_FLASH_IMAGE_CHUNK_SIZE) {
+        uint8_t *chunk = keepSector ? &buffer[offset] : buffer;
+        if (readPages(firstPage + (offset / pageSize), QSPI_FLASH_IMAGE_CHUNK_SIZE / pageSize, chunk) != 0) {
+            return -4;
+        }
+        crc = flashCRC32(chunk, QSPI_FLASH_IMAGE_CHUNK_SIZE, crc);
+        if (erased) {
+            erased = flashImageIsErased(chunk, QSPI_FLASH_IMAGE_CHUNK_SIZE);
+        }
+    }
+    return 0;
+}
+
+/*
+Method: getStaticRamUsage()
+Description: Static RAM used by the library with the current configuration: the driver and
+             filesystem objects, one QSPIFlashMemory and the static arena (if enabled)
+Input: None
+Output: uint32_t bytes
+*/
+uint32_t QSPIFlashMemory::getStaticRamUsage() {
+    return sizeof(flash) + sizeof(fs) + sizeof(QSPIFlashMemory) + QSPI_FLASH_ARENA_SIZE;
+}
+
+/*
+Method: printMemoryReport()
+Description: Print the RAM cost of each part of the library for the current configuration
+Input:
+    Print &output: Where to print the report (e.g. Serial)
+Output: N/A
+*/
+void QSPIFlashMemory::printMemoryReport(Print &output) {
+    output.print("\nQSPI_Flash memory report (bytes)");
+    output.print("\n -> Flash driver: "); output.print((unsigned long) sizeof(flash));
+    output.print("\n -> Filesystem: "); output.print((unsigned long) sizeof(fs));
+    output.print("\n -> QSPIFlashMemory: "); output.print((unsigned long) sizeof(QSPIFlashMemory));
+    output.print("\n -> Static arena: "); output.print((unsigned long) QSPI_FLASH_ARENA_SIZE);
+    output.print("\n -> Total static: "); output.print((unsigned long) getStaticRamUsage());
+    output.print("\n -> Each FlashKeyValueStore: "); output.print((unsigned long) sizeof(FlashKeyValueStore));
+    output.print("\n -> Each FlashTimeSeries: "); output.print((unsigned long) sizeof(FlashTimeSeries));
+    output.print("\n -> Each FlashReader: "); output.print((unsigned long) sizeof(FlashReader));
+    output.print("\n -> Each FlashConsistencyChecker: "); output.print((unsigned long) sizeof(FlashConsistencyChecker));
+    output.print("\n -> Stream transfer buffer (stack): "); output.print((unsigned long) QSPI_FLASH_STREAM_BUFFER_SIZE);
+#if !QSPI_FLASH_STATIC_ARENA
+    output.print("\n -> Path buffer per helper call (stack): "); output.print((unsigned long) QSPI_FLASH_MAX_PATH_LENGTH);
+    output.print("\n -> format() work buffer (stack): "); output.print((unsigned long) QSPI_FLASH_FORMAT_BUFFER_SIZE);
+    output.print("\n -> programPages() page buffer (stack): "); output.print((unsigned long) QSPI_FLASH_MAX_PAGE_SIZE);
+    output.print("\n -> Image chunk buffer (stack): "); output.print((unsigned long) QSPI_FLASH_IMAGE_CHUNK_SIZE);
+    output.print("\n -> importImage() sector buffer (stack): "); output.print((unsigned long) QSPI_FLASH_SECTOR_SIZE);
+#endif
+}
@@ -8,7 +8,9 @@
 #include <Adafruit_QSPI_GD25Q.h>
 #include <Adafruit_SPIFlash.h>
 #include <Adafruit_QSPI.h>
+#include "QSPI_Flash_Config.h"
 #include "Path.h"
+#include "FlashLock.h"
 
 /*
 Debug Levels (CREATE CONSTANTS)
@@ -19,6 +21,91 @@ Debug Levels (CREATE CONSTANTS)
     9 = Show extended debug output
 */
 
+/*
+One segment of a scatter-gather list for the raw block API
+*/
+struct FlashIOVec {
+    uint8_t *buffer;
+    uint32_t length;
+};
+
+/*
+Timing for one kind of raw block operation (times in microseconds)
+*/
+struct FlashOperationStats {
+    uint32_t operations;
+    uint32_t bytes;
+    uint32_t lastMicros;
+    uint32_t maxMicros;
+    uint32_t totalMicros;
+};
+
+struct FlashRawStats {
+    FlashOperationStats read;
+    FlashOperationStats program;
+    FlashOperationStats eraseSector;
+    FlashOperationStats eraseBlock;
+};
+
+/*
+Chip identity and geometry, cached across boots to skip re-querying the chip (see initialiseFast()).
+magic and crc are set by getGeometry(), a record without them (never saved, or RAM that didn't
+survive) is treated as stale
+*/
+#define QSPI_FLASH_GEOMETRY_MAGIC 0x47465351UL  // "QSFG"
+
+struct FlashGeometry {
+    uint32_t magic;
+    uint32_t chipModelID;
+    uint32_t chipAddress;
+    uint16_t pageCount;
+    uint16_t pageSize;
+    uint8_t manufacturerID;
+    uint8_t deviceID;
+    uint32_t crc;               // CRC-32 of the fields above
+};
+
+/*
+Time spent in each stage of the last initialise() or initialiseFast() call (microseconds)
+*/
+struct FlashStartupTiming {
+    uint32_t probeMicros;
+    uint32_t identifyMicros;
+    uint32_t mountMicros;
+    uint32_t warmMicros;
+    uint32_t totalMicros;
+};
+
+/*
+Result of an exportImage(), importImage() or buildImageManifest() call (time in microseconds).
+getImageStats() holds the last completed call, any task's, the overloads taking a pointer return the call's own
+*/
+struct FlashImageStats {
+    uint32_t dataSectors;       // sectors sent or written with their contents
+    uint32_t erasedSectors;     // sectors sent or applied as erased
+    uint32_t skippedSectors;    // sectors matching the manifest (export) or already erased (import)
+    uint32_t streamBytes;
+    uint32_t micros;
+    uint32_t failedSector;      // sector being read, sent or written when the operation failed, QSPI_FLASH_IMAGE_NO_SECTOR if none
+};
+
+/*
+Result of an appendFromStream() or writeToStream() call (times in microseconds).
+getStreamStats() holds the last completed call, any task's, the overloads taking a pointer return the call's own
+*/
+struct FlashStreamStats {
+    uint32_t bytes;
+    uint32_t flashOperations;   // file reads or writes of up to QSPI_FLASH_STREAM_BUFFER_SIZE bytes
+    uint32_t flashMicros;       // time spent in file reads/writes, not counting waits for the volume lock
+    uint32_t streamMicros;      // time spent waiting on or writing to the stream
+    uint32_t micros;
+};
+
+/*
+Receives one record from a time series query (see FlashTimeSeries.h)
+*/
+typedef void (*FlashSeriesCallback)(uint32_t timestamp, uint8_t data[], uint16_t length, void *context);
+
 class QSPIFlashMemory {
 
     public:
@@ -39,11 +126,18 @@ class QSPIFlashMemory {
         uint32_t getFlashChipAddress();
         int8_t initialise();
         int8_t initialise(int8_t debugLevel);
+        int8_t initialiseFast(FlashGeometry &cachedGeometry);
+        int8_t initialiseFast(FlashGeometry &cachedGeometry, int8_t debugLevel);
+        FlashGeometry getGeometry();
+        FlashStartupTiming getStartupTiming();
+        int mount();
+        int remount();
+        uint32_t getMountCount();
         bool checkIfFlashMemoryIsReady();
         int8_t setDebugLevel(int8_t debugLevel);
         int8_t getDebugLevel();
-        Adafruit_QSPI_GD25Q getFlashQSPIInterface();
-        Adafruit_W25Q16BV_FatFs getFlashFileSystemInterface();
+        Adafruit_QSPI_GD25Q &getFlashQSPIInterface();
+        Adafruit_W25Q16BV_FatFs &getFlashFileSystemInterface();
         int format();
         File getFilesInDirectory(char directory[]);
         bool checkFileExists(char directory[], char filename[]);
@@ -66,13 +160,64 @@ class QSPIFlashMemory {
 
 
 
+        long appendFromStream(char directory[], char filename[], Stream &stream, uint32_t maxBytes, uint32_t timeoutMillis);
+        long appendFromStream(char directory[], char filename[], Stream &stream, uint32_t maxBytes, uint32_t timeoutMillis, FlashStreamStats *stats);
+        long writeToStream(char directory[], char filename[], Stream &stream);
+        long writeToStream(char directory[], char filename[], Stream &stream, FlashStreamStats *stats);
+        FlashStreamStats getStreamStats();
         int getFilesize(char directory[], char filename[]);
         int readFileContents(char directory[], char filename[], uint8_t fileContent[], long maxReadSize);
         int deleteFile(char directory[], char filename[]);
         int deleteDirectory(char directory[]);
+        long querySeries(char directory[], char filename[], uint32_t startTime, uint32_t endTime, FlashSeriesCallback callback);
+        long querySeries(char directory[], char filename[], uint32_t startTime, uint32_t endTime, FlashSeriesCallback callback, void *context);
+        void setLocks(FlashLock *volumeLock);
+        void setLocks(FlashLock *volumeLock, FlashLock *fileLocks[], uint8_t fileLockCount);
+        FlashLock *getVolumeLock();
+        FlashLock *getFileLock(char directory[], char filename[]);
+        uint32_t getSectorCount();
+        uint32_t getBlockCount();
+        int readPages(uint32_t firstPage, uint32_t count, uint8_t buffer[]);
+        int readPages(uint32_t firstPage, FlashIOVec vectors[], uint8_t vectorCount);
+        int programPages(uint32_t firstPage, uint32_t count, uint8_t buffer[]);
+        int programPages(uint32_t firstPage, FlashIOVec vectors[], uint8_t vectorCount);
+        int eraseSector(uint32_t sector);
+        int eraseBlock(uint32_t block);
+        FlashRawStats getRawStats();
+        void resetRawStats();
+        int buildImageManifest(uint32_t manifest[], uint32_t sectorCount);
+        int buildImageManifest(uint32_t manifest[], uint32_t sectorCount, FlashImageStats *stats);
+        long exportImage(Stream &stream);
+        long exportImage(Stream &stream, uint32_t manifest[]);
+        long exportImage(Stream &stream, uint32_t manifest[], FlashImageStats *stats);
+        long importImage(Stream &stream);
+        long importImage(Stream &stream, FlashImageStats *stats);
+        FlashImageStats getImageStats();
+        static uint32_t getStaticRamUsage();
+        static void printMemoryReport(Print &output);
     private:
         int _debugLevel = 0;
-        char resolvedPath[260];
+        bool _flashReady = false;
+        bool _mounted = false;
+        uint32_t _mountCount = 0;
+        FlashStartupTiming _startupTiming = {};
+        FlashLock *_volumeLock = NULL;
+        FlashLock **_fileLocks = NULL;
+        uint8_t _fileLockCount = 0;
+        FlashRawStats _rawStats = {};
+        FlashImageStats _imageStats = {};
+        FlashStreamStats _streamStats = {};
+        int checkPageRange(uint32_t firstPage, uint32_t byteCount);
+        void recordOperation(FlashOperationStats &stats, uint32_t bytes, unsigned long startMicros);
+        int readSectorCRC(uint32_t sector, uint8_t buffer[], bool keepSector, uint32_t &crc, bool &erased);
+        long receiveStream(char directory[], char filename[], Stream &stream, uint32_t maxBytes, uint32_t timeoutMillis, FlashStreamStats &stats);
+        long sendStream(char directory[], char filename[], Stream &stream, FlashStreamStats &stats);
+        void publishStreamStats(FlashStreamStats &result, FlashStreamStats *stats);
+        int readManifest(uint32_t manifest[], uint32_t sectorCount, FlashImageStats &stats);
+        long sendImage(Stream &stream, uint32_t manifest[], FlashImageStats &stats);
+        long receiveImage(Stream &stream, FlashImageStats &stats);
+        void publishImageStats(FlashImageStats &result, FlashImageStats *stats);
+        static uint32_t geometryCRC(FlashGeometry &geometry);
 };
 
 #endif // _QSPIFLASHMEMORY_H
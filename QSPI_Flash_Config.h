@@ -0,0 +1,173 @@
+#ifndef   _QSPIFLASHCONFIG_H
+#define   _QSPIFLASHCONFIG_H
+
+/*
+Compile-time configuration for the QSPI_Flash library.
+
+Every value can be overridden with a build flag (e.g. -DQSPI_FLASH_MAX_PATH_LENGTH=64) so the
+library's RAM use is fixed at build time. QSPIFlashMemory::printMemoryReport() shows what a
+configuration costs. Plain preprocessor only, so host-side tools can include it too.
+*/
+
+// -----------------------------------------------------------------------------
+// Paths
+// -----------------------------------------------------------------------------
+
+// Longest resolved path (directory + "/" + filename + NUL). A helper resolves its path only after
+// any helper it calls has returned, so one buffer of this size is on the stack per call (two in
+// FlashKeyValueStore begin()/compact())
+#ifndef QSPI_FLASH_MAX_PATH_LENGTH
+#define QSPI_FLASH_MAX_PATH_LENGTH 260
+#endif
+// Directory and filename buffers held by FlashKeyValueStore and FlashTimeSeries objects
+#ifndef QSPI_FLASH_MAX_DIRECTORY_LENGTH
+#define QSPI_FLASH_MAX_DIRECTORY_LENGTH 32
+#endif
+#ifndef QSPI_FLASH_MAX_FILENAME_LENGTH
+#define QSPI_FLASH_MAX_FILENAME_LENGTH 32
+#endif
+
+// -----------------------------------------------------------------------------
+// Chip geometry and work buffers
+// -----------------------------------------------------------------------------
+
+// Erase granularity of the onboard QSPI chips
+#ifndef QSPI_FLASH_SECTOR_SIZE
+#define QSPI_FLASH_SECTOR_SIZE 4096
+#endif
+#ifndef QSPI_FLASH_BLOCK_SIZE
+#define QSPI_FLASH_BLOCK_SIZE 65536
+#endif
+// Largest page size supported by programPages() staging
+#ifndef QSPI_FLASH_MAX_PAGE_SIZE
+#define QSPI_FLASH_MAX_PAGE_SIZE 256
+#endif
+// Working buffer for f_fdisk()/f_mkfs() in format(), at least one FAT sector
+#ifndef QSPI_FLASH_FORMAT_BUFFER_SIZE
+#define QSPI_FLASH_FORMAT_BUFFER_SIZE 512
+#endif
+// Bytes moved per flash access by exportImage()/importImage(), divides QSPI_FLASH_SECTOR_SIZE
+#ifndef QSPI_FLASH_IMAGE_CHUNK_SIZE
+#define QSPI_FLASH_IMAGE_CHUNK_SIZE 1024
+#endif
+// Stack buffer of appendFromStream()/writeToStream(), one flash page by default. Not part of
+// the static arena since the volume lock is released between buffers
+#ifndef QSPI_FLASH_STREAM_BUFFER_SIZE
+#define QSPI_FLASH_STREAM_BUFFER_SIZE 256
+#endif
+// Bytes read per volume lock hold in readFileContents()
+#ifndef QSPI_FLASH_READ_CHUNK_SIZE
+#define QSPI_FLASH_READ_CHUNK_SIZE 64
+#endif
+// CRC-32 lookup table (const, in flash): 256 entries (1KB, one lookup per byte) or
+// 16 entries (64 bytes, two lookups per byte and about half the speed)
+#ifndef QSPI_FLASH_CRC_TABLE_SIZE
+#define QSPI_FLASH_CRC_TABLE_SIZE 256
+#endif
+
+// 1 = work buffers (format, page staging, image chunk and sector, resolved paths) are static, allocated
+//     once in .bss. They are only used under the volume lock, so one copy is shared safely.
+// 0 = work buffers live on the stack of the calling task while in use
+#ifndef QSPI_FLASH_STATIC_ARENA
+#define QSPI_FLASH_STATIC_ARENA 0
+#endif
+// Resolved paths held at once under the volume lock (key-value store compaction needs two),
+// each QSPI_FLASH_MAX_PATH_LENGTH bytes of the static arena
+#ifndef QSPI_FLASH_PATH_BUFFERS
+#define QSPI_FLASH_PATH_BUFFERS 2
+#endif
+
+// -----------------------------------------------------------------------------
+// FlashKeyValueStore
+// -----------------------------------------------------------------------------
+
+// Size of one log record, key + value may use QSPI_FLASH_KV_RECORD_SIZE - 8 bytes
+#ifndef QSPI_FLASH_KV_RECORD_SIZE
+#define QSPI_FLASH_KV_RECORD_SIZE 64
+#endif
+// Number of index slots held in RAM (power of two), at most 3/4 of them can be live keys
+#ifndef QSPI_FLASH_KV_INDEX_SIZE
+#define QSPI_FLASH_KV_INDEX_SIZE 64
+#endif
+// Log size at which put() compacts before appending
+#ifndef QSPI_FLASH_KV_MAX_LOG_SIZE
+#define QSPI_FLASH_KV_MAX_LOG_SIZE 16384
+#endif
+
+// -----------------------------------------------------------------------------
+// FlashTimeSeries
+// -----------------------------------------------------------------------------
+
+// Bytes of data file covered by one sparse index entry
+#ifndef QSPI_FLASH_SERIES_INDEX_INTERVAL
+#define QSPI_FLASH_SERIES_INDEX_INTERVAL 512
+#endif
+// Largest payload of a single record (query() buffers one record at a time)
+#ifndef QSPI_FLASH_SERIES_MAX_RECORD_SIZE
+#define QSPI_FLASH_SERIES_MAX_RECORD_SIZE 64
+#endif
+
+// -----------------------------------------------------------------------------
+// FlashReader
+// -----------------------------------------------------------------------------
+
+// Read-ahead buffer held by each FlashReader, also the longest line nextLine() returns whole
+#ifndef QSPI_FLASH_READER_BUFFER_SIZE
+#define QSPI_FLASH_READER_BUFFER_SIZE 512
+#endif
+// Refills end on multiples of this, so FatFs reads whole sectors
+#ifndef QSPI_FLASH_READER_ALIGNMENT
+#define QSPI_FLASH_READER_ALIGNMENT 512
+#endif
+
+// -----------------------------------------------------------------------------
+// FlashConsistencyChecker
+// -----------------------------------------------------------------------------
+
+// Largest volume (in clusters) the checker handles, its cluster bitmap takes 1 bit per cluster
+#ifndef QSPI_FLASH_FSCK_MAX_CLUSTERS
+#define QSPI_FLASH_FSCK_MAX_CLUSTERS 8192
+#endif
+// Directory nesting followed, deeper directories are reported as skipped
+#ifndef QSPI_FLASH_FSCK_MAX_DEPTH
+#define QSPI_FLASH_FSCK_MAX_DEPTH 8
+#endif
+// Directory entry fixes remembered for the repair step, further findings are left unrepaired
+#ifndef QSPI_FLASH_FSCK_MAX_REPAIRS
+#define QSPI_FLASH_FSCK_MAX_REPAIRS 8
+#endif
+
+// -----------------------------------------------------------------------------
+// Derived sizes
+// -----------------------------------------------------------------------------
+
+#if QSPI_FLASH_STATIC_ARENA
+#define QSPI_FLASH_ARENA_SIZE (QSPI_FLASH_FORMAT_BUFFER_SIZE + QSPI_FLASH_MAX_PAGE_SIZE + QSPI_FLASH_IMAGE_CHUNK_SIZE \
+                               + QSPI_FLASH_SECTOR_SIZE + QSPI_FLASH_PATH_BUFFERS * QSPI_FLASH_MAX_PATH_LENGTH)
+#else
+#define QSPI_FLASH_ARENA_SIZE 0
+#endif
+
+#if (QSPI_FLASH_KV_INDEX_SIZE & (QSPI_FLASH_KV_INDEX_SIZE - 1)) != 0
+#error "QSPI_FLASH_KV_INDEX_SIZE must be a power of two"
+#endif
+#if QSPI_FLASH_KV_RECORD_SIZE < 16 || QSPI_FLASH_KV_RECORD_SIZE > 263
+#error "QSPI_FLASH_KV_RECORD_SIZE must be between 16 and 263"
+#endif
+#if QSPI_FLASH_FORMAT_BUFFER_SIZE < 512
+#error "QSPI_FLASH_FORMAT_BUFFER_SIZE must be at least 512"
+#endif
+#if QSPI_FLASH_SECTOR_SIZE % QSPI_FLASH_IMAGE_CHUNK_SIZE != 0 || QSPI_FLASH_IMAGE_CHUNK_SIZE % QSPI_FLASH_MAX_PAGE_SIZE != 0
+#error "QSPI_FLASH_IMAGE_CHUNK_SIZE must divide QSPI_FLASH_SECTOR_SIZE and be a multiple of QSPI_FLASH_MAX_PAGE_SIZE"
+#endif
+#if QSPI_FLASH_CRC_TABLE_SIZE != 256 && QSPI_FLASH_CRC_TABLE_SIZE != 16
+#error "QSPI_FLASH_CRC_TABLE_SIZE must be 256 or 16"
+#endif
+#if QSPI_FLASH_PATH_BUFFERS < 2
+#error "QSPI_FLASH_PATH_BUFFERS must be at least 2"
+#endif
+#if QSPI_FLASH_MAX_PATH_LENGTH < QSPI_FLASH_MAX_DIRECTORY_LENGTH + QSPI_FLASH_MAX_FILENAME_LENGTH
+#error "QSPI_FLASH_MAX_PATH_LENGTH must hold a maximum length directory and filename"
+#endif
+
+#endif // _QSPIFLASHCONFIG_H
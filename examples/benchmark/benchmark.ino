@@ -0,0 +1,289 @@
+#include <Arduino.h>
+#include <QSPI_Flash.h>
+#include <FlashReader.h>
+
+// Throughput and latency benchmark for QSPIFlashMemory.
+// Output is CSV on Serial, one row per measurement:
+//     test,file_size,buffer_size,operations,bytes,micros,bytes_per_sec
+// Latency rows put the percentile in the micros column and leave bytes_per_sec empty.
+// Rows named raw_* go straight to the FatFs File (under getVolumeLock()) and are the baseline the
+// helper rows (seq_write/seq_read/read_contents/append/line_replay_reader) can be compared against.
+// WARNING: formats the flash chip!
+// Also builds for the host against the simulated chip (sh tools/host/build-sketch.sh examples/benchmark),
+// which checks the sketch's own overhead and File handling but says nothing about flash timing.
+
+#define BENCH_DIR           "/bench"
+#define APPEND_SAMPLES      200
+#define APPEND_LINE_SIZE    32
+#define CREATE_FILE_COUNT   50
+#define REPLAY_LINES        500
+#define CONTENTS_SIZE       4096
+#define CONTENTS_REPEATS    8
+
+QSPIFlashMemory flashMemory;
+FlashReader reader(flashMemory);
+
+const long fileSizes[] = { 4096, 32768, 131072 };
+const int bufferSizes[] = { 32, 128, 512 };
+
+uint8_t buffer[513];
+uint8_t contents[CONTENTS_SIZE];
+unsigned long latencies[APPEND_SAMPLES];
+
+
+void printRow(const char *test, long fileSize, int bufferSize, long operations, long bytes, unsigned long elapsed) {
+    Serial.print(test); Serial.print(",");
+    Serial.print(fileSize); Serial.print(",");
+    Serial.print(bufferSize); Serial.print(",");
+    Serial.print(operations); Serial.print(",");
+    Serial.print(bytes); Serial.print(",");
+    Serial.print(elapsed); Serial.print(",");
+    if (bytes > 0 && elapsed > 0) {
+        Serial.print((unsigned long) ((bytes * 1000000.0) / elapsed));
+    }
+    Serial.print("\n");
+}
+
+void benchFormat() {
+    unsigned long start = micros();
+    int res = flashMemory.format();
+    unsigned long elapsed = micros() - start;
+    if (res < 0) {
+        Serial.print("# format failed: "); Serial.print(res); Serial.print("\n");
+    }
+    printRow("format", 0, 0, 1, 0, elapsed);
+}
+
+void benchSequentialWrite(long fileSize, int bufferSize) {
+    // appendToFile() takes NUL-terminated content, the terminator sits just past bufferSize bytes
+    memset(buffer, 'w', bufferSize);
+    buffer[bufferSize] = 0;
+
+    flashMemory.deleteFile(BENCH_DIR, "seq.bin");
+    flashMemory.createFile(BENCH_DIR, "seq.bin");
+
+    long written = 0;
+    long operations = 0;
+    unsigned long start = micros();
+    while (written < fileSize) {
+        flashMemory.appendToFile(BENCH_DIR, "seq.bin", (char *) buffer);
+        written += bufferSize;
+        operations++;
+    }
+    printRow("seq_write", fileSize, bufferSize, operations, written, micros() - start);
+}
+
+// Sequential read through FlashReader, bufferSize bytes per read()
+void benchSequentialRead(long fileSize, int bufferSize) {
+    long bytes = 0;
+    long operations = 0;
+    unsigned long start = micros();
+    if (reader.open(BENCH_DIR, "seq.bin") == 0) {
+        int readCount;
+        while ((readCount = reader.read(buffer, bufferSize)) > 0) {
+            bytes += readCount;
+            operations++;
+        }
+        reader.close();
+    }
+    printRow("seq_read", fileSize, bufferSize, operations, bytes, micros() - start);
+}
+
+// Whole-file reads through readFileContents(), which opens, reads and closes the file per call
+void benchReadContents(long fileSize) {
+    long readSize = fileSize < CONTENTS_SIZE ? fileSize : CONTENTS_SIZE;
+    unsigned long start = micros();
+    for (int i = 0 ; i < CONTENTS_REPEATS ; i++) {
+        flashMemory.readFileContents(BENCH_DIR, "seq.bin", contents, readSize);
+    }
+    printRow("read_contents", fileSize, readSize, CONTENTS_REPEATS, readSize * CONTENTS_REPEATS, micros() - start);
+}
+
+void benchRawSequentialRead(long fileSize, int bufferSize) {
+    long bytes = 0;
+    long operations = 0;
+    unsigned long start = micros();
+    // Raw File access, so the volume lock is held while it is used (a no-op without setLocks())
+    FlashLockGuard volumeGuard(flashMemory.getVolumeLock());
+    File rf = flashMemory.getFile(BENCH_DIR, "seq.bin");
+    while (rf.available()) {
+        int readCount = rf.read(buffer, bufferSize);
+        if (readCount <= 0) {
+            break;
+        }
+        bytes += readCount;
+        operations++;
+    }
+    rf.close();
+    printRow("raw_seq_read", fileSize, bufferSize, operations, bytes, micros() - start);
+}
+
+// FlashReader can't seek, so random access is only measured on the raw File
+void benchRawRandomRead(long fileSize, int bufferSize) {
+    long operations = fileSize / bufferSize;
+    long bytes = 0;
+    randomSeed(fileSize + bufferSize);
+    FlashLockGuard volumeGuard(flashMemory.getVolumeLock());
+    File rf = flashMemory.getFile(BENCH_DIR, "seq.bin");
+    unsigned long start = micros();
+    for (long i = 0 ; i < operations ; i++) {
+        rf.seek(random(0, (fileSize / bufferSize)) * bufferSize);
+        bytes += rf.read(buffer, bufferSize);
+    }
+    unsigned long elapsed = micros() - start;
+    rf.close();
+    printRow("raw_rand_read", fileSize, bufferSize, operations, bytes, elapsed);
+}
+
+// No helper writes at an offset, so random writes are only measured on the raw File
+void benchRawRandomWrite(long fileSize, int bufferSize) {
+    Adafruit_W25Q16BV_FatFs &fatfs = flashMemory.getFlashFileSystemInterface();
+    long operations = fileSize / bufferSize;
+    long bytes = 0;
+    memset(buffer, 'r', bufferSize);
+    randomSeed(fileSize * bufferSize);
+    FlashLockGuard volumeGuard(flashMemory.getVolumeLock());
+    File wf = fatfs.open(BENCH_DIR "/seq.bin", FILE_WRITE);
+    unsigned long start = micros();
+    for (long i = 0 ; i < operations ; i++) {
+        wf.seek(random(0, (fileSize / bufferSize)) * bufferSize);
+        bytes += wf.write(buffer, bufferSize);
+    }
+    wf.close();
+    printRow("raw_rand_write", fileSize, bufferSize, operations, bytes, micros() - start);
+}
+
+int compareLatency(const void *a, const void *b) {
+    unsigned long la = *(const unsigned long *) a;
+    unsigned long lb = *(const unsigned long *) b;
+    return (la > lb) - (la < lb);
+}
+
+void benchAppendLatency() {
+    char line[APPEND_LINE_SIZE + 1];
+    memset(line, 'a', APPEND_LINE_SIZE - 1);
+    line[APPEND_LINE_SIZE - 1] = '\n';
+    line[APPEND_LINE_SIZE] = 0;
+
+    flashMemory.deleteFile(BENCH_DIR, "append.log");
+    flashMemory.createFile(BENCH_DIR, "append.log");
+    unsigned long total = 0;
+    for (int i = 0 ; i < APPEND_SAMPLES ; i++) {
+        unsigned long start = micros();
+        flashMemory.appendToFile(BENCH_DIR, "append.log", line);
+        latencies[i] = micros() - start;
+        total += latencies[i];
+    }
+    printRow("append", 0, APPEND_LINE_SIZE, APPEND_SAMPLES, (long) APPEND_SAMPLES * APPEND_LINE_SIZE, total);
+
+    qsort(latencies, APPEND_SAMPLES, sizeof(latencies[0]), compareLatency);
+    printRow("append_latency_p50", 0, APPEND_LINE_SIZE, APPEND_SAMPLES, 0, latencies[(APPEND_SAMPLES * 50) / 100]);
+    printRow("append_latency_p90", 0, APPEND_LINE_SIZE, APPEND_SAMPLES, 0, latencies[(APPEND_SAMPLES * 90) / 100]);
+    printRow("append_latency_p99", 0, APPEND_LINE_SIZE, APPEND_SAMPLES, 0, latencies[(APPEND_SAMPLES * 99) / 100]);
+    printRow("append_latency_max", 0, APPEND_LINE_SIZE, APPEND_SAMPLES, 0, latencies[APPEND_SAMPLES - 1]);
+}
+
+void benchCreateAndList() {
+    char filename[16];
+    flashMemory.createDirectory(BENCH_DIR "/many");
+
+    unsigned long start = micros();
+    for (int i = 0 ; i < CREATE_FILE_COUNT ; i++) {
+        sprintf(filename, "file%d.txt", i);
+        flashMemory.createFile(BENCH_DIR "/many", filename);
+    }
+    printRow("create_file", 0, 0, CREATE_FILE_COUNT, 0, micros() - start);
+
+    long entries = 0;
+    start = micros();
+    {
+        FlashLockGuard volumeGuard(flashMemory.getVolumeLock());
+        File dir = flashMemory.getFilesInDirectory(BENCH_DIR "/many");
+        File child = dir.openNextFile();
+        while (child) {
+            entries++;
+            child.close();
+            child = dir.openNextFile();
+        }
+        dir.close();
+    }
+    printRow("list_dir", 0, 0, entries, 0, micros() - start);
+}
+
+// Replay a CSV log line by line: one byte at a time through File, then through FlashReader
+void benchLineReplay() {
+    char line[64];
+    flashMemory.deleteFile(BENCH_DIR, "replay.csv");
+    flashMemory.createFile(BENCH_DIR, "replay.csv");
+    for (int i = 0 ; i < REPLAY_LINES ; i++) {
+        sprintf(line, "%d,%lu,21.5,48.2,1013.25\r\n", i, (unsigned long) i * 1000);
+        flashMemory.appendToFile(BENCH_DIR, "replay.csv", line);
+    }
+
+    long lines = 0;
+    long bytes = 0;
+    int length = 0;
+    unsigned long start = micros();
+    {
+        FlashLockGuard volumeGuard(flashMemory.getVolumeLock());
+        File rf = flashMemory.getFile(BENCH_DIR, "replay.csv");
+        int c;
+        while ((c = rf.read()) >= 0) {
+            bytes++;
+            if (c == '\n') {
+                line[length] = 0;
+                length = 0;
+                lines++;
+            } else if (length < (int) sizeof(line) - 1) {
+                line[length++] = c;
+            }
+        }
+        rf.close();
+    }
+    printRow("line_replay_bytewise", bytes, 1, lines, bytes, micros() - start);
+
+    lines = 0;
+    start = micros();
+    char *next;
+    if (reader.open(BENCH_DIR, "replay.csv") == 0) {
+        while (reader.nextLine(next) >= 0) {
+            lines++;
+        }
+        reader.close();
+    }
+    printRow("line_replay_reader", bytes, QSPI_FLASH_READER_BUFFER_SIZE, lines, bytes, micros() - start);
+}
+
+void setup() {
+    Serial.begin(115200);
+    while(!Serial);
+
+    while (flashMemory.initialise(0) != 0) {
+        Serial.print("# Flash chip unavailable. Retrying...\n");
+        delay(2000);
+    }
+
+    Serial.print("test,file_size,buffer_size,operations,bytes,micros,bytes_per_sec\n");
+    benchFormat();
+    flashMemory.createDirectory(BENCH_DIR);
+
+    for (unsigned int f = 0 ; f < sizeof(fileSizes) / sizeof(fileSizes[0]) ; f++) {
+        for (unsigned int b = 0 ; b < sizeof(bufferSizes) / sizeof(bufferSizes[0]) ; b++) {
+            benchSequentialWrite(fileSizes[f], bufferSizes[b]);
+            benchSequentialRead(fileSizes[f], bufferSizes[b]);
+            benchRawSequentialRead(fileSizes[f], bufferSizes[b]);
+            benchRawRandomRead(fileSizes[f], bufferSizes[b]);
+            benchRawRandomWrite(fileSizes[f], bufferSizes[b]);
+        }
+        benchReadContents(fileSizes[f]);
+    }
+    benchAppendLatency();
+    benchCreateAndList();
+    benchLineReplay();
+
+    Serial.print("# ... Benchmark Complete ...\n");
+}
+
+void loop(){
+  // Unused
+}
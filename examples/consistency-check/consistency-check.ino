@@ -0,0 +1,68 @@
+#include <Arduino.h>
+#include <QSPI_Flash.h>
+#include <FlashConsistencyChecker.h>
+
+// Check (and repair) the filesystem in small slices from loop(), so boot isn't held up.
+// Each fsckStep() call spends at most ~2ms on the check before returning to the application.
+
+#define CHECK_BUDGET_MICROS 2000
+
+QSPIFlashMemory flashMemory;
+FlashConsistencyChecker checker(flashMemory);
+bool reported = false;
+
+
+void printReport() {
+    FlashCheckReport report = checker.getReport();
+    Serial.print("\nConsistency check complete");
+    Serial.print("\n -> clusters: "); Serial.print(report.clusters);
+    Serial.print(" (allocated: "); Serial.print(report.allocatedClusters); Serial.print(")");
+    Serial.print("\n -> directories / files: "); Serial.print(report.directories);
+    Serial.print(" / "); Serial.print(report.files);
+    Serial.print("\n -> lost clusters: "); Serial.print(report.lostClusters);
+    Serial.print(" in "); Serial.print(report.lostChains); Serial.print(" chains");
+    Serial.print("\n -> cross-links: "); Serial.print(report.crossLinks);
+    Serial.print("\n -> bad chains: "); Serial.print(report.badChains);
+    Serial.print("\n -> bad entries: "); Serial.print(report.badEntries);
+    Serial.print("\n -> size mismatches: "); Serial.print(report.sizeMismatches);
+    Serial.print("\n -> FAT copy mismatches: "); Serial.print(report.fatMismatches);
+    Serial.print("\n -> skipped directories: "); Serial.print(report.skippedDirectories);
+    Serial.print("\n -> repairs / unrepaired: "); Serial.print(report.repairs);
+    Serial.print(" / "); Serial.print(report.unrepaired);
+    Serial.print("\n -> passes: "); Serial.print(report.passes);
+    Serial.print("\n -> steps: "); Serial.print(report.steps);
+    Serial.print(" (longest "); Serial.print(report.maxStepMicros); Serial.print("us, total ");
+    Serial.print(report.totalMicros); Serial.print("us)\n");
+}
+
+void setup() {
+    Serial.begin(115200);
+    while(!Serial);
+
+    while (flashMemory.initialise(0) != 0) {
+        Serial.print("Flash chip unavailable. Retrying...");
+        delay(2000);
+    }
+
+    int res = checker.begin(true);
+    if (res != 0) {
+        Serial.print("\nConsistency check could not start: "); Serial.print(res);
+    }
+    // The application starts straight away, the check runs from loop()
+}
+
+void loop() {
+    if (!checker.isDone()) {
+        int res = checker.fsckStep(CHECK_BUDGET_MICROS);
+        if (res < 0) {
+            Serial.print("\nConsistency check failed: "); Serial.print(res);
+        } else if (res == 1 && checker.getProgress() % 10 == 0) {
+            Serial.print("\nChecking... "); Serial.print(checker.getProgress()); Serial.print("%");
+        }
+    } else if (!reported) {
+        printReport();
+        reported = true;
+    }
+
+    // ... application work ...
+}
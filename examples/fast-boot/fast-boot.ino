@@ -0,0 +1,45 @@
+#include <Arduino.h>
+#include <QSPI_Flash.h>
+
+// Boot-to-first-write for a node that wakes, logs one line and sleeps.
+// The geometry record would normally live in backup RAM or the MCU's own flash;
+// here it is kept in a .noinit variable so it survives a soft reset. After power-on that
+// variable holds garbage: initialiseFast() checks its magic and CRC, so garbage only costs one
+// refresh (return value 1) and never a wrong page count or size.
+
+QSPIFlashMemory flashMemory;
+
+__attribute__((section(".noinit"))) FlashGeometry cachedGeometry;
+
+
+void printTiming(const char *label) {
+    FlashStartupTiming timing = flashMemory.getStartupTiming();
+    Serial.print("\n"); Serial.print(label);
+    Serial.print("\n -> probe (us): "); Serial.print(timing.probeMicros);
+    Serial.print("\n -> identify (us): "); Serial.print(timing.identifyMicros);
+    Serial.print("\n -> mount (us): "); Serial.print(timing.mountMicros);
+    Serial.print("\n -> warm root dir (us): "); Serial.print(timing.warmMicros);
+    Serial.print("\n -> total (us): "); Serial.print(timing.totalMicros);
+}
+
+void setup() {
+    unsigned long bootStart = micros();
+    int8_t res = flashMemory.initialiseFast(cachedGeometry);
+    if (res < 0) {
+        return;
+    }
+    flashMemory.appendToFile("/fast-boot", "log.csv", "wake\n");
+    unsigned long bootToFirstWrite = micros() - bootStart;
+
+    Serial.begin(115200);
+    while(!Serial);
+    Serial.print(res == 0 ? "\nCached geometry used" : "\nCached geometry refreshed");
+    printTiming("initialiseFast():");
+    Serial.print("\n -> boot to first write (us): "); Serial.print(bootToFirstWrite);
+
+    Serial.print("\n\n... All Tests Complete ...\n");
+}
+
+void loop(){
+  // Unused
+}
@@ -0,0 +1,78 @@
+#include <Arduino.h>
+#include <QSPI_Flash.h>
+#include <FlashImageFormat.h>
+
+// Backup and restore the whole flash chip over USB serial.
+// Single character commands:
+//     e - export a full image (binary, see FlashImageFormat.h)
+//     d - export a delta: first receive the target's manifest (getSectorCount() x 4 bytes,
+//         little endian CRC-32 per sector), then send only the sectors that differ
+//     m - send this unit's manifest, for a delta export from another unit
+//     i - import an image. A delta is refused (-6) if this unit changed since it sent its manifest
+//     s - print the stats of the last operation
+// WARNING: importing overwrites the flash chip!
+
+QSPIFlashMemory flashMemory;
+
+// One CRC per 4KB sector, 512 entries for the 2MB chip
+uint32_t manifest[1024];
+
+
+void printStats() {
+    FlashImageStats stats = flashMemory.getImageStats();
+    Serial.print("\nData sectors: "); Serial.print(stats.dataSectors);
+    Serial.print("\nErased sectors: "); Serial.print(stats.erasedSectors);
+    Serial.print("\nSkipped sectors: "); Serial.print(stats.skippedSectors);
+    Serial.print("\nStream bytes: "); Serial.print(stats.streamBytes);
+    Serial.print("\nTime (us): "); Serial.print(stats.micros);
+    if (stats.failedSector != QSPI_FLASH_IMAGE_NO_SECTOR) {
+        Serial.print("\nFailed at sector: "); Serial.print(stats.failedSector);
+    }
+    if (stats.micros > 0) {
+        Serial.print("\nBytes/s: "); Serial.print((unsigned long) ((stats.streamBytes * 1000000.0) / stats.micros));
+    }
+    Serial.print("\n");
+}
+
+void setup() {
+    Serial.begin(115200);
+    while(!Serial);
+    Serial.setTimeout(5000);
+
+    while (flashMemory.initialise(0) != 0) {
+        delay(2000);
+    }
+}
+
+void loop() {
+    if (!Serial.available()) {
+        return;
+    }
+    uint32_t sectorCount = flashMemory.getSectorCount();
+    if (sectorCount > sizeof(manifest) / sizeof(manifest[0])) {
+        return;
+    }
+    switch (Serial.read()) {
+        case 'e':
+            flashMemory.exportImage(Serial);
+            break;
+        case 'd':
+            if (Serial.readBytes((uint8_t *) manifest, sectorCount * 4) == sectorCount * 4) {
+                flashMemory.exportImage(Serial, manifest);
+            }
+            break;
+        case 'm':
+            if (flashMemory.buildImageManifest(manifest, sectorCount) == 0) {
+                Serial.write((uint8_t *) manifest, sectorCount * 4);
+            }
+            break;
+        case 'i': {
+            long res = flashMemory.importImage(Serial);
+            Serial.print("\nImport result: "); Serial.print(res);
+            break;
+        }
+        case 's':
+            printStats();
+            break;
+    }
+}
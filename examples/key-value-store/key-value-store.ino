@@ -0,0 +1,50 @@
+#include <Arduino.h>
+#include <QSPI_Flash.h>
+#include <FlashKeyValueStore.h>
+
+QSPIFlashMemory flashMemory;
+FlashKeyValueStore settings(flashMemory);
+
+
+void setup() {
+    Serial.begin(115200);
+    while(!Serial);
+
+    while (flashMemory.initialise(0) != 0) {
+        Serial.print("Flash chip unavailable. Retrying...");
+        delay(2000);
+    }
+
+    int res = settings.begin();
+    if (res != 0) {
+        Serial.print("\nFailed to open settings store: "); Serial.print(res);
+        return;
+    }
+    Serial.print("\nKeys loaded: "); Serial.print(settings.getKeyCount());
+    Serial.print("\nLog size: "); Serial.print(settings.getLogSize());
+
+    // Boot counter, one record appended per boot
+    uint32_t boots = 0;
+    settings.get("boots", (uint8_t *) &boots, sizeof(boots));
+    boots++;
+    settings.put("boots", (uint8_t *) &boots, sizeof(boots));
+    Serial.print("\nBoot count: "); Serial.print(boots);
+
+    settings.put("device-name", "logger-01");
+    char name[33] = { 0 };
+    int length = settings.get("device-name", (uint8_t *) name, sizeof(name) - 1);
+    Serial.print("\nDevice name ("); Serial.print(length); Serial.print(" bytes): "); Serial.print(name);
+
+    settings.put("temporary", "to be removed");
+    Serial.print("\nHas temporary: "); Serial.print(settings.contains("temporary") ? "YES" : "NO");
+    settings.remove("temporary");
+    Serial.print("\nHas temporary: "); Serial.print(settings.contains("temporary") ? "YES" : "NO");
+
+    Serial.print("\n\n... All Tests Complete ...\n");
+}
+
+void loop(){
+    // Compacts the log in idle time once it is mostly superseded records
+    settings.maintain();
+    delay(1000);
+}
@@ -0,0 +1,116 @@
+#include <Arduino.h>
+#include <FreeRTOS_SAMD51.h>
+#include <QSPI_Flash.h>
+
+// Several FreeRTOS tasks logging to their own files through one QSPIFlashMemory.
+// Prints aggregate throughput with 1, 2 and 4 concurrent writers so lock contention shows up.
+
+#ifndef LINES_PER_TASK
+#define LINES_PER_TASK  200
+#endif
+#define MAX_TASKS       4
+// Words (4 bytes each). appendToFile() holds one 260 byte path buffer and a File object at a time
+// (nested helpers have returned before it resolves its path), plus FatFs' working storage.
+// 1024 words leaves a wide margin, the high water mark printed per run shows how much
+#define TASK_STACK_WORDS 1024
+
+QSPIFlashMemory flashMemory;
+
+FlashFreeRTOSLock *volumeLock;
+FlashLock *fileLocks[MAX_TASKS];
+
+SemaphoreHandle_t tasksDone;
+
+struct LoggerTask {
+    char filename[16];
+    int lineCount;
+    UBaseType_t stackMarginWords;
+};
+LoggerTask loggerTasks[MAX_TASKS];
+
+
+void loggerTask(void *parameter) {
+    LoggerTask *task = (LoggerTask *) parameter;
+    char line[] = "0123456789,sensor-value,0123456789\n";
+    for (int i = 0 ; i < task->lineCount ; i++) {
+        flashMemory.appendToFile("/rtos-logging", task->filename, line);
+    }
+    // Stack never touched by this task, if it gets close to 0 raise TASK_STACK_WORDS
+    task->stackMarginWords = uxTaskGetStackHighWaterMark(NULL);
+    xSemaphoreGive(tasksDone);
+    vTaskDelete(NULL);
+}
+
+void runWriters(int taskCount) {
+    for (int i = 0 ; i < taskCount ; i++) {
+        sprintf(loggerTasks[i].filename, "task%d.csv", i);
+        flashMemory.deleteFile("/rtos-logging", loggerTasks[i].filename);
+    }
+
+    unsigned long start = micros();
+    for (int i = 0 ; i < taskCount ; i++) {
+        loggerTasks[i].lineCount = LINES_PER_TASK;
+        xTaskCreate(loggerTask, "logger", TASK_STACK_WORDS, &loggerTasks[i], tskIDLE_PRIORITY + 1, NULL);
+    }
+    for (int i = 0 ; i < taskCount ; i++) {
+        xSemaphoreTake(tasksDone, portMAX_DELAY);
+    }
+    unsigned long elapsed = micros() - start;
+
+    long bytes = 0;
+    UBaseType_t stackMarginWords = TASK_STACK_WORDS;
+    for (int i = 0 ; i < taskCount ; i++) {
+        int size = flashMemory.getFilesize("/rtos-logging", loggerTasks[i].filename);
+        if (size > 0) {
+            bytes += size;
+        }
+        if (loggerTasks[i].stackMarginWords < stackMarginWords) {
+            stackMarginWords = loggerTasks[i].stackMarginWords;
+        }
+    }
+    Serial.print("\n -> Writers: "); Serial.print(taskCount);
+    Serial.print(", bytes: "); Serial.print(bytes);
+    Serial.print(", ms: "); Serial.print(elapsed / 1000);
+    Serial.print(", bytes/s: "); Serial.print(elapsed > 0 ? (unsigned long) ((bytes * 1000000.0) / elapsed) : 0);
+    Serial.print(", unused stack (words): "); Serial.print((unsigned long) stackMarginWords);
+}
+
+void controlTask(void *parameter) {
+    Serial.print("\n\nThroughput scaling (appendToFile, one file per task)");
+    runWriters(1);
+    runWriters(2);
+    runWriters(4);
+    Serial.print("\n\n... All Tests Complete ...\n");
+    vTaskDelete(NULL);
+}
+
+void setup() {
+    Serial.begin(115200);
+    while(!Serial);
+
+    if (flashMemory.initialise(0) != 0) {
+        Serial.print("Flash chip unavailable");
+        return;
+    }
+    // Blank chip (or the host simulation): format once
+    if (flashMemory.mount() != 0 && flashMemory.format() != 0) {
+        Serial.print("Flash chip could not be formatted");
+        return;
+    }
+
+    // Locks must be created before any task uses the flash
+    volumeLock = new FlashFreeRTOSLock();
+    for (int i = 0 ; i < MAX_TASKS ; i++) {
+        fileLocks[i] = new FlashFreeRTOSLock();
+    }
+    flashMemory.setLocks(volumeLock, fileLocks, MAX_TASKS);
+    flashMemory.createDirectory("/rtos-logging");
+
+    tasksDone = xSemaphoreCreateCounting(MAX_TASKS, 0);
+    xTaskCreate(controlTask, "control", TASK_STACK_WORDS, NULL, tskIDLE_PRIORITY + 2, NULL);
+    vTaskStartScheduler();
+}
+
+void loop(){
+  // Unused, FreeRTOS scheduler owns the CPU
+}
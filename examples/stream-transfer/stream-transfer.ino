@@ -0,0 +1,64 @@
+#include <Arduino.h>
+#include <QSPI_Flash.h>
+
+// Upload and download a file over USB serial without buffering it in RAM.
+// Single character commands:
+//     u - append everything received until the line is quiet for 2 seconds to /upload/data.bin
+//     d - send /upload/data.bin back
+//     x - delete /upload/data.bin
+//     s - print the stats of the last transfer
+
+QSPIFlashMemory flashMemory;
+
+char directory[] = "/upload";
+char filename[] = "data.bin";
+
+// Largest upload accepted
+#define MAX_UPLOAD_BYTES 1000000
+#define IDLE_TIMEOUT_MILLIS 2000
+
+
+void printStats() {
+    FlashStreamStats stats = flashMemory.getStreamStats();
+    Serial.print("\nBytes: "); Serial.print(stats.bytes);
+    Serial.print("\nFlash operations: "); Serial.print(stats.flashOperations);
+    Serial.print("\nFlash time (us): "); Serial.print(stats.flashMicros);
+    Serial.print("\nStream time (us): "); Serial.print(stats.streamMicros);
+    Serial.print("\nTime (us): "); Serial.print(stats.micros);
+    if (stats.flashMicros > 0) {
+        Serial.print("\nFlash bytes/s: "); Serial.print((unsigned long) ((stats.bytes * 1000000.0) / stats.flashMicros));
+    }
+    Serial.print("\n");
+}
+
+void setup() {
+    Serial.begin(115200);
+    while(!Serial);
+
+    while (flashMemory.initialise(0) != 0) {
+        delay(2000);
+    }
+    flashMemory.createDirectory(directory);
+}
+
+void loop() {
+    if (!Serial.available()) {
+        return;
+    }
+    switch (Serial.read()) {
+        case 'u': {
+            long res = flashMemory.appendFromStream(directory, filename, Serial, MAX_UPLOAD_BYTES, IDLE_TIMEOUT_MILLIS);
+            Serial.print("\nUpload result: "); Serial.print(res);
+            break;
+        }
+        case 'd':
+            flashMemory.writeToStream(directory, filename, Serial);
+            break;
+        case 'x':
+            flashMemory.deleteFile(directory, filename);
+            break;
+        case 's':
+            printStats();
+            break;
+    }
+}
@@ -0,0 +1,59 @@
+#include <Arduino.h>
+#include <QSPI_Flash.h>
+#include <FlashTimeSeries.h>
+
+QSPIFlashMemory flashMemory;
+FlashTimeSeries temperatureLog(flashMemory);
+
+struct Sample {
+    int16_t temperature;
+    uint16_t humidity;
+};
+
+
+void printSample(uint32_t timestamp, uint8_t data[], uint16_t length, void *context) {
+    Sample sample;
+    memcpy(&sample, data, sizeof(sample));
+    Serial.print("\n - "); Serial.print(timestamp);
+    Serial.print(": "); Serial.print(sample.temperature);
+    Serial.print(", "); Serial.print(sample.humidity);
+}
+
+void setup() {
+    Serial.begin(115200);
+    while(!Serial);
+
+    while (flashMemory.initialise(0) != 0) {
+        Serial.print("Flash chip unavailable. Retrying...");
+        delay(2000);
+    }
+
+    if (temperatureLog.begin("/series", "temperature.bin") != 0) {
+        Serial.print("\nFailed to open series");
+        return;
+    }
+
+    // One simulated sample per minute for a week
+    Serial.print("\nWriting samples...");
+    uint32_t start = temperatureLog.getLastTimestamp() + 60;
+    for (uint32_t i = 0 ; i < 7UL * 24 * 60 ; i++) {
+        Sample sample = { (int16_t) (200 + (i % 50)), (uint16_t) (400 + (i % 100)) };
+        temperatureLog.append(start + (i * 60), (uint8_t *) &sample, sizeof(sample));
+    }
+    uint32_t last = temperatureLog.getLastTimestamp();
+    temperatureLog.end();
+
+    // Only the pages covering the last hour are read
+    Serial.print("\nLast hour:");
+    unsigned long queryStart = micros();
+    long count = flashMemory.querySeries("/series", "temperature.bin", last - 3600, last, printSample);
+    unsigned long elapsed = micros() - queryStart;
+    Serial.print("\nRecords: "); Serial.print(count);
+    Serial.print(", query time (us): "); Serial.print(elapsed);
+
+    Serial.print("\n\n... All Tests Complete ...\n");
+}
+
+void loop(){
+  // Unused
+}
@@ -0,0 +1,36 @@
+#ifndef   _HOST_TEST_H
+#define   _HOST_TEST_H
+
+/*
+Minimal checks for the host tests (see tests/host/run.sh). Each test is its own program
+and exits non-zero when a check failed
+*/
+
+#include <stdio.h>
+
+static int hostTestFailures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            hostTestFailures++; \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+        } \
+    } while (0)
+
+#define CHECK_EQUAL(expected, actual) \
+    do { \
+        long long e = (long long) (expected); \
+        long long a = (long long) (actual); \
+        if (e != a) { \
+            hostTestFailures++; \
+            fprintf(stderr, "%s:%d: CHECK_EQUAL(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #expected, #actual, e, a); \
+        } \
+    } while (0)
+
+static int hostTestResult(const char *name) {
+    printf("%s: %s\n", name, hostTestFailures == 0 ? "passed" : "FAILED");
+    return hostTestFailures == 0 ? 0 : 1;
+}
+
+#endif // _HOST_TEST_H
@@ -0,0 +1,160 @@
+/*
+Round trip for tools/flash-image-builder, run by run.sh when the Adafruit_SPIFlash FatFs sources
+are available to build it against:
+    image_roundtrip fixture <directory>         write the source files, and <directory>.settings for -K
+    image_roundtrip check stream|raw <image>    put the image on the simulated chip (importImage(), or
+                                                copied in as a programmer would), mount() it and read
+                                                the files and settings back through the helpers
+The volume is read from the chip by the host filesystem (see tools/host/HostFileSystem.cpp), so
+what is checked is the FAT volume the builder's FatFs wrote, not a copy of the source tree
+*/
+
+#include <QSPI_Flash.h>
+#include <FlashReader.h>
+#include <FlashKeyValueStore.h>
+#include <sys/stat.h>
+#include "HostTest.h"
+
+#define SAMPLES_SIZE 20000
+
+QSPIFlashMemory flashMemory;
+FlashReader reader(flashMemory);
+FlashKeyValueStore store(flashMemory);
+uint8_t samples[SAMPLES_SIZE];
+uint8_t content[SAMPLES_SIZE];
+
+const char helloText[] = "hello from the factory\nsecond line\n";
+const char longNameText[] = "needs a long file name\n";
+const char nestedText[] = "three levels down\n";
+
+// Spans several clusters, with bytes that must survive as they are
+void fillSamples() {
+    for (uint32_t i = 0 ; i < SAMPLES_SIZE ; i++) {
+        samples[i] = (i % 5 == 0) ? 0 : (uint8_t) (i * 13 + 7);
+    }
+}
+
+/*
+Class: FileStream
+Description: Stream reading a host file, for importImage()
+*/
+class FileStream : public Stream {
+
+    public:
+        FileStream(FILE *file) : _file(file) {}
+        int available() { return feof(_file) ? 0 : 1; }
+        int read() { return fgetc(_file); }
+        int peek() {
+            int c = fgetc(_file);
+            if (c >= 0) {
+                ungetc(c, _file);
+            }
+            return c;
+        }
+        size_t write(uint8_t c) { return 0; }
+    private:
+        FILE *_file;
+};
+
+int writeHostFile(const std::string &path, const void *data, size_t length) {
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Error, cannot create %s\n", path.c_str());
+        return -1;
+    }
+    size_t written = fwrite(data, 1, length, file);
+    return (fclose(file) == 0 && written == length) ? 0 : -1;
+}
+
+int writeFixture(const std::string &directory) {
+    const char settings[] = "# written to /.config/kv.log by -K\nwifi=factory\nnode.id=17\n";
+    mkdir(directory.c_str(), 0755);
+    mkdir((directory + "/data").c_str(), 0755);
+    mkdir((directory + "/logs").c_str(), 0755);
+    mkdir((directory + "/logs/2024").c_str(), 0755);
+    mkdir((directory + "/logs/2024/march").c_str(), 0755);
+    if (writeHostFile(directory + "/hello.txt", helloText, strlen(helloText)) != 0
+        || writeHostFile(directory + "/Long file name.txt", longNameText, strlen(longNameText)) != 0
+        || writeHostFile(directory + "/data/samples.bin", samples, SAMPLES_SIZE) != 0
+        || writeHostFile(directory + "/data/empty.txt", "", 0) != 0
+        || writeHostFile(directory + "/logs/2024/march/notes.txt", nestedText, strlen(nestedText)) != 0
+        || writeHostFile(directory + ".settings", settings, strlen(settings)) != 0) {
+        return 1;
+    }
+    return 0;
+}
+
+void checkText(char directory[], char filename[], const char *expected) {
+    CHECK_EQUAL((int) strlen(expected), flashMemory.getFilesize(directory, filename));
+    memset(content, 0, sizeof(content));
+    CHECK_EQUAL(0, flashMemory.readFileContents(directory, filename, content, strlen(expected)));
+    CHECK(memcmp(expected, content, strlen(expected)) == 0);
+}
+
+void checkValue(char key[], const char *expected) {
+    uint8_t value[QSPI_FLASH_KV_DATA_SIZE + 1];
+    int length = store.get(key, value, QSPI_FLASH_KV_DATA_SIZE);
+    CHECK_EQUAL((int) strlen(expected), length);
+    if (length >= 0) {
+        value[length] = 0;
+        CHECK(strcmp(expected, (char *) value) == 0);
+    }
+}
+
+int checkImage(const char *format, const char *imagePath) {
+    FILE *image = fopen(imagePath, "rb");
+    if (image == NULL) {
+        fprintf(stderr, "Error, cannot open %s\n", imagePath);
+        return 1;
+    }
+    CHECK_EQUAL(0, flashMemory.initialise(0));
+    if (strcmp(format, "stream") == 0) {
+        FileStream stream(image);
+        FlashImageStats stats;
+        CHECK(flashMemory.importImage(stream, &stats) > 0);
+        CHECK(stats.dataSectors > 0);
+    } else {
+        CHECK_EQUAL(HOST_FLASH_SIZE, fread(hostFlashMemory(), 1, HOST_FLASH_SIZE, image));
+    }
+    fclose(image);
+    CHECK_EQUAL(0, flashMemory.mount());
+
+    checkText("/", "hello.txt", helloText);
+    checkText("/", "Long file name.txt", longNameText);
+    checkText("/logs/2024/march", "notes.txt", nestedText);
+    CHECK(flashMemory.checkDirectoryExists("/logs/2024"));
+    CHECK(flashMemory.checkFileExists("/data", "empty.txt"));
+    CHECK_EQUAL(0, flashMemory.getFilesize("/data", "empty.txt"));
+    CHECK_EQUAL(SAMPLES_SIZE, flashMemory.getFilesize("/data", "samples.bin"));
+
+    CHECK_EQUAL(0, reader.open("/data", "samples.bin"));
+    CHECK_EQUAL(SAMPLES_SIZE, reader.read(content, SAMPLES_SIZE));
+    CHECK(memcmp(samples, content, SAMPLES_SIZE) == 0);
+    reader.close();
+    char line[64];
+    CHECK_EQUAL(0, reader.open("/", "hello.txt"));
+    CHECK_EQUAL(22, reader.readLine(line, sizeof(line)));
+    CHECK(strcmp("hello from the factory", line) == 0);
+    reader.close();
+
+    CHECK_EQUAL(0, store.begin());
+    CHECK_EQUAL(2, store.getKeyCount());
+    checkValue("wifi", "factory");
+    checkValue("node.id", "17");
+    store.end();
+
+    CHECK_EQUAL(0, hostFileSystemOpenFiles());
+    return hostTestResult("image_roundtrip");
+}
+
+int main(int argc, char *argv[]) {
+    fillSamples();
+    if (argc == 3 && strcmp(argv[1], "fixture") == 0) {
+        return writeFixture(argv[2]);
+    }
+    if (argc == 4 && strcmp(argv[1], "check") == 0 && (strcmp(argv[2], "stream") == 0 || strcmp(argv[2], "raw") == 0)) {
+        return checkImage(argv[2], argv[3]);
+    }
+    fprintf(stderr, "usage: image_roundtrip fixture <directory> | check stream|raw <image>\n");
+    return 2;
+}
@@ -0,0 +1,59 @@
+#!/bin/sh
+# Build and run the host tests against the simulated chip and filesystem in tools/host.
+# Run from the library root:  sh tests/host/run.sh [test_name ...]
+# CXX and CXXFLAGS are honoured, e.g. CXXFLAGS=-fsanitize=thread sh tests/host/run.sh test_locking
+# A test that needs other configuration names it in a "// HOST_TEST_FLAGS: -D..." line, the
+# library is then compiled with those flags for that test only
+set -e
+
+CXX=${CXX:-g++}
+BUILD=${BUILD:-${TMPDIR:-/tmp}/qspi-flash-host-tests}
+FLAGS="-std=gnu++11 -g -O1 -Wall -Wno-write-strings -Wno-unused-parameter -pthread -DQSPI_FLASH_USE_STD_MUTEX -Itools/host -I. $CXXFLAGS"
+SOURCES="QSPI_Flash.cpp Path.cpp FlashCRC32.cpp FlashKeyValueStore.cpp FlashTimeSeries.cpp FlashReader.cpp FlashConsistencyChecker.cpp tools/host/HostArduino.cpp tools/host/HostFileSystem.cpp"
+
+# Example sketches that run unattended on the simulated backend, built with tools/host/build-sketch.sh
+SKETCHES="examples/benchmark examples/rtos-logging"
+# FatFs sources for the flash-image-builder round trip (tests/host/image_roundtrip.cpp), skipped without them
+ADAFRUIT_SPIFLASH=${ADAFRUIT_SPIFLASH:-$HOME/Arduino/libraries/Adafruit_SPIFlash}
+
+mkdir -p "$BUILD"
+failed=0
+if [ $# -eq 0 ]; then
+    set -- $(ls tests/host/test_*.cpp | sed 's|.*/||; s|\.cpp$||')
+    for sketch in $SKETCHES; do
+        name=$(basename "$sketch")
+        CXXFLAGS="$CXXFLAGS" sh tools/host/build-sketch.sh "$sketch" "$BUILD/$name"
+        if "$BUILD/$name" > "$BUILD/$name.out"; then
+            echo "$name: passed"
+        else
+            echo "$name: FAILED (output in $BUILD/$name.out)"
+            failed=1
+        fi
+    done
+
+    # Build an image with the real FatFs, put it on the simulated chip both ways and read it back
+    if [ -d "$ADAFRUIT_SPIFLASH" ] && [ -n "$(find "$ADAFRUIT_SPIFLASH" -name ff.c -o -name ff.cpp | head -n 1)" ]; then
+        roundtrip="$BUILD/image_roundtrip"
+        $CXX $FLAGS -o "$roundtrip" tests/host/image_roundtrip.cpp $SOURCES
+        rm -rf "$roundtrip.fixture"
+        if sh tools/flash-image-builder/build.sh "$ADAFRUIT_SPIFLASH" "$BUILD/flash-image-builder" > "$roundtrip.out" 2>&1 \
+            && "$roundtrip" fixture "$roundtrip.fixture" \
+            && "$BUILD/flash-image-builder" -K "$roundtrip.fixture.settings" -f stream "$roundtrip.fixture" "$roundtrip.qfi" >> "$roundtrip.out" 2>&1 \
+            && "$BUILD/flash-image-builder" -K "$roundtrip.fixture.settings" -f raw "$roundtrip.fixture" "$roundtrip.img" >> "$roundtrip.out" 2>&1; then
+            "$roundtrip" check stream "$roundtrip.qfi" || failed=1
+            "$roundtrip" check raw "$roundtrip.img" || failed=1
+        else
+            echo "image_roundtrip: FAILED building the image (output in $roundtrip.out)"
+            failed=1
+        fi
+    else
+        echo "image_roundtrip: skipped (no FatFs sources under $ADAFRUIT_SPIFLASH, set ADAFRUIT_SPIFLASH)"
+    fi
+fi
+
+for test in "$@"; do
+    TEST_FLAGS=$(sed -n 's|^// HOST_TEST_FLAGS:||p' "tests/host/$test.cpp")
+    $CXX $FLAGS $TEST_FLAGS -o "$BUILD/$test" "tests/host/$test.cpp" $SOURCES
+    "$BUILD/$test" || failed=1
+done
+exit $failed
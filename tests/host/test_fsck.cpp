@@ -0,0 +1,280 @@
+/*
+FlashConsistencyChecker progress before begin(), on a volume too small to hold a cluster
+and through a full check of a small empty FAT12 volume written straight to the chip.
+Then repair of each kind of damage, written with disk_write(): the report counts, a clean
+re-check, and a file changed between the first two passes kept as it was changed
+*/
+
+#include <QSPI_Flash.h>
+#include <FlashConsistencyChecker.h>
+#include "HostTest.h"
+
+QSPIFlashMemory flashMemory;
+FlashConsistencyChecker checker(flashMemory);
+uint8_t sector[512];
+
+// Repair volume: boot sector, two FAT copies of one sector, one root directory sector
+// (16 entries), then REPAIR_CLUSTERS one sector clusters
+#define REPAIR_CLUSTERS 64
+#define REPAIR_FAT      1
+#define REPAIR_ROOT     3
+#define REPAIR_DATA     4
+#define END_OF_CHAIN    0xFFF
+// Healthy file that is rewritten between the first two passes of every repair
+#define LIVE_CLUSTER    30
+#define LIVE_ENTRY      2
+
+uint8_t fats[2][512];
+uint8_t root[512];
+
+// Boot sector, one FAT sector and one root directory sector, then the data area
+void writeVolume(uint16_t totalSectors, uint8_t clusterSectors, uint8_t fatCount = 1) {
+    memset(sector, 0, sizeof(sector));
+    sector[0] = 0xEB;
+    sector[11] = 0x00; sector[12] = 0x02;       // 512 bytes per sector
+    sector[13] = clusterSectors;
+    sector[14] = 1;                             // reserved sectors
+    sector[16] = fatCount;                      // FAT copies
+    sector[17] = 16;                            // root entries
+    sector[19] = totalSectors & 0xFF; sector[20] = totalSectors >> 8;
+    sector[21] = 0xF8;
+    sector[22] = 1;                             // sectors per FAT
+    sector[510] = 0x55; sector[511] = 0xAA;
+    CHECK_EQUAL(RES_OK, disk_write(0, sector, 0, 1));
+    memset(sector, 0, sizeof(sector));
+    sector[0] = 0xF8; sector[1] = 0xFF; sector[2] = 0xFF;
+    CHECK_EQUAL(RES_OK, disk_write(0, sector, 1, 1));
+    memset(sector, 0, sizeof(sector));
+    CHECK_EQUAL(RES_OK, disk_write(0, sector, 2, 1));
+}
+
+void setFat(uint8_t copy, uint32_t cluster, uint32_t value) {
+    uint8_t *data = &fats[copy][cluster + cluster / 2];
+    if (cluster & 1) {
+        data[0] = (data[0] & 0x0F) | ((value << 4) & 0xF0);
+        data[1] = value >> 4;
+    } else {
+        data[0] = value & 0xFF;
+        data[1] = (data[1] & 0xF0) | ((value >> 8) & 0x0F);
+    }
+}
+
+void setChain(uint32_t cluster, uint32_t value) {
+    setFat(0, cluster, value);
+    setFat(1, cluster, value);
+}
+
+uint32_t getFat(uint8_t copy, uint32_t cluster) {
+    uint8_t *data = &fats[copy][cluster + cluster / 2];
+    uint32_t raw = data[0] | (data[1] << 8);
+    return (cluster & 1) ? (raw >> 4) : (raw & 0xFFF);
+}
+
+void setEntry(uint8_t index, const char name[11], uint8_t attributes, uint16_t cluster, uint32_t size) {
+    uint8_t *entry = &root[index * 32];
+    memset(entry, 0, 32);
+    memcpy(entry, name, 11);
+    entry[11] = attributes;
+    entry[26] = cluster; entry[27] = cluster >> 8;
+    entry[28] = size; entry[29] = size >> 8; entry[30] = size >> 16; entry[31] = size >> 24;
+}
+
+uint32_t entrySize(uint8_t index) {
+    uint8_t *entry = &root[index * 32];
+    return entry[28] | (entry[29] << 8) | ((uint32_t) entry[30] << 16) | ((uint32_t) entry[31] << 24);
+}
+
+void writeTables() {
+    CHECK_EQUAL(RES_OK, disk_write(0, fats[0], REPAIR_FAT, 1));
+    CHECK_EQUAL(RES_OK, disk_write(0, fats[1], REPAIR_FAT + 1, 1));
+    CHECK_EQUAL(RES_OK, disk_write(0, root, REPAIR_ROOT, 1));
+}
+
+void readTables() {
+    CHECK_EQUAL(RES_OK, disk_read(0, fats[0], REPAIR_FAT, 1));
+    CHECK_EQUAL(RES_OK, disk_read(0, fats[1], REPAIR_FAT + 1, 1));
+    CHECK_EQUAL(RES_OK, disk_read(0, root, REPAIR_ROOT, 1));
+}
+
+// Empty volume with one healthy one cluster file in root entry 2 (entries 0-1 are left for the
+// damaged files, the walk ends at the first unused entry). Damage is added to
+// fats/root before writeTables()
+void startRepairVolume() {
+    writeVolume(REPAIR_DATA + REPAIR_CLUSTERS, 1, 2);
+    memset(fats, 0, sizeof(fats));
+    memset(root, 0, sizeof(root));
+    for (uint8_t copy = 0 ; copy < 2 ; copy++) {
+        fats[copy][0] = 0xF8; fats[copy][1] = 0xFF; fats[copy][2] = 0xFF;
+    }
+    setEntry(LIVE_ENTRY, "LIVE    TXT", 0x20, LIVE_CLUSTER, 100);
+    setChain(LIVE_CLUSTER, END_OF_CHAIN);
+}
+
+// Run a repair check. Once the first pass is over the live file grows by a cluster, as a
+// write from another task would do it, so the passes differ and a third one is needed
+FlashCheckReport runRepair() {
+    CHECK_EQUAL(0, checker.begin(true));
+    bool changed = false;
+    int result;
+    while ((result = checker.fsckStep(0)) > 0) {
+        if (!changed && checker.getReport().passes == 2) {
+            CHECK_EQUAL(FLASH_CHECK_FAT_COUNT, checker.getPhase());
+            CHECK_EQUAL(RES_OK, disk_read(0, fats[0], REPAIR_FAT, 1));
+            CHECK_EQUAL(RES_OK, disk_read(0, fats[1], REPAIR_FAT + 1, 1));
+            CHECK_EQUAL(RES_OK, disk_read(0, root, REPAIR_ROOT, 1));
+            setChain(LIVE_CLUSTER, LIVE_CLUSTER + 1);
+            setChain(LIVE_CLUSTER + 1, END_OF_CHAIN);
+            setEntry(LIVE_ENTRY, "LIVE    TXT", 0x20, LIVE_CLUSTER, 600);
+            writeTables();
+            changed = true;
+        }
+    }
+    CHECK_EQUAL(0, result);
+    CHECK(changed);
+    FlashCheckReport report = checker.getReport();
+    CHECK_EQUAL(3, report.passes);
+    CHECK_EQUAL(0, report.unrepaired);
+
+    // The change made between the passes is kept
+    readTables();
+    CHECK_EQUAL(LIVE_CLUSTER + 1, getFat(0, LIVE_CLUSTER));
+    CHECK_EQUAL(END_OF_CHAIN, getFat(0, LIVE_CLUSTER + 1));
+    CHECK_EQUAL(600, entrySize(LIVE_ENTRY));
+    CHECK(root[LIVE_ENTRY * 32] == 'L');
+
+    // A read-only check afterwards finds nothing
+    CHECK_EQUAL(0, checker.begin());
+    while ((result = checker.fsckStep(1000)) > 0);
+    CHECK_EQUAL(0, result);
+    CHECK(!checker.hasProblems());
+    CHECK_EQUAL(3, checker.getReport().files);
+    return report;
+}
+
+int main() {
+    CHECK_EQUAL(0, flashMemory.initialise(0));
+    CHECK_EQUAL(0, flashMemory.format());
+    CHECK_EQUAL(0, checker.getProgress());
+
+    // One sector of data area with two sectors per cluster: no clusters at all
+    writeVolume(4, 2);
+    CHECK_EQUAL(-4, checker.begin());
+    CHECK_EQUAL(100, checker.getProgress());
+
+    writeVolume(3 + 64, 1);
+    CHECK_EQUAL(0, checker.begin());
+    uint8_t last = 0;
+    int result;
+    while ((result = checker.fsckStep(1)) > 0) {
+        uint8_t progress = checker.getProgress();
+        CHECK(progress >= last && progress <= 100);
+        last = progress;
+    }
+    CHECK_EQUAL(0, result);
+    CHECK_EQUAL(100, checker.getProgress());
+    CHECK(!checker.hasProblems());
+
+    // Lost chain: clusters 10-11 allocated, no entry refers to them. Kept files: A and B
+    {
+        startRepairVolume();
+        setEntry(0, "A       TXT", 0x20, 5, 300);
+        setChain(5, END_OF_CHAIN);
+        setEntry(1, "B       TXT", 0x20, 0, 0);
+        setChain(10, 11);
+        setChain(11, END_OF_CHAIN);
+        writeTables();
+        FlashCheckReport report = runRepair();
+        CHECK_EQUAL(2, report.lostClusters);
+        CHECK_EQUAL(1, report.lostChains);
+        CHECK_EQUAL(2, report.repairs);
+        CHECK_EQUAL(0, getFat(0, 10));
+        CHECK_EQUAL(0, getFat(0, 11));
+        CHECK_EQUAL(0, getFat(1, 11));
+        CHECK_EQUAL(END_OF_CHAIN, getFat(0, 5));
+    }
+
+    // Cross-link: B's chain 7 -> 6 runs into A's chain 5 -> 6, B is cut after cluster 7
+    {
+        startRepairVolume();
+        setEntry(0, "A       TXT", 0x20, 5, 1024);
+        setChain(5, 6);
+        setChain(6, END_OF_CHAIN);
+        setEntry(1, "B       TXT", 0x20, 7, 1024);
+        setChain(7, 6);
+        writeTables();
+        FlashCheckReport report = runRepair();
+        CHECK_EQUAL(1, report.crossLinks);
+        CHECK_EQUAL(0, report.lostClusters);
+        CHECK_EQUAL(1, report.repairs);
+        CHECK_EQUAL(END_OF_CHAIN, getFat(0, 7));
+        CHECK_EQUAL(END_OF_CHAIN, getFat(1, 7));
+        CHECK_EQUAL(512, entrySize(1));
+        CHECK_EQUAL(6, getFat(0, 5));
+        CHECK_EQUAL(1024, entrySize(0));
+    }
+
+    // Chain pointing at a free cluster: 12 -> 13, but 13 is free. Cut after cluster 12
+    {
+        startRepairVolume();
+        setEntry(0, "A       TXT", 0x20, 5, 300);
+        setChain(5, END_OF_CHAIN);
+        setEntry(1, "C       TXT", 0x20, 12, 1024);
+        setChain(12, 13);
+        writeTables();
+        FlashCheckReport report = runRepair();
+        CHECK_EQUAL(1, report.badChains);
+        CHECK_EQUAL(1, report.repairs);
+        CHECK_EQUAL(END_OF_CHAIN, getFat(0, 12));
+        CHECK_EQUAL(512, entrySize(1));
+    }
+
+    // Wrong file size: 5000 bytes recorded on a one cluster chain
+    {
+        startRepairVolume();
+        setEntry(0, "A       TXT", 0x20, 5, 300);
+        setChain(5, END_OF_CHAIN);
+        setEntry(1, "D       TXT", 0x20, 15, 5000);
+        setChain(15, END_OF_CHAIN);
+        writeTables();
+        FlashCheckReport report = runRepair();
+        CHECK_EQUAL(1, report.sizeMismatches);
+        CHECK_EQUAL(1, report.repairs);
+        CHECK_EQUAL(512, entrySize(1));
+        CHECK_EQUAL(END_OF_CHAIN, getFat(0, 15));
+    }
+
+    // Half-written entry: garbage name, its cluster is then lost. The entry is deleted and
+    // the cluster freed
+    {
+        startRepairVolume();
+        setEntry(0, "A       TXT", 0x20, 5, 300);
+        setChain(5, END_OF_CHAIN);
+        setEntry(1, "E?\x01    TXT", 0x20, 17, 100);
+        setChain(17, END_OF_CHAIN);
+        // Empty file after it, so the re-check still counts three files once E is deleted
+        setEntry(3, "F       TXT", 0x20, 0, 0);
+        writeTables();
+        FlashCheckReport report = runRepair();
+        CHECK_EQUAL(1, report.badEntries);
+        CHECK_EQUAL(1, report.lostClusters);
+        CHECK_EQUAL(2, report.repairs);
+        CHECK_EQUAL(0xE5, root[1 * 32]);
+        CHECK_EQUAL(0, getFat(0, 17));
+    }
+
+    // Mismatched FAT copies: the second copy has a chain the first doesn't, the first wins
+    {
+        startRepairVolume();
+        setEntry(0, "A       TXT", 0x20, 5, 300);
+        setChain(5, END_OF_CHAIN);
+        setEntry(1, "B       TXT", 0x20, 0, 0);
+        setFat(1, 40, END_OF_CHAIN);
+        writeTables();
+        FlashCheckReport report = runRepair();
+        CHECK_EQUAL(1, report.fatMismatches);
+        CHECK_EQUAL(1, report.repairs);
+        CHECK(memcmp(fats[0], fats[1], sizeof(fats[0])) == 0);
+        CHECK_EQUAL(0, getFat(1, 40));
+    }
+    return hostTestResult("test_fsck");
+}
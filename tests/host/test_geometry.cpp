@@ -0,0 +1,36 @@
+/*
+initialiseFast() must only trust a cached FlashGeometry written by getGeometry()
+*/
+
+#include <QSPI_Flash.h>
+#include "HostTest.h"
+
+QSPIFlashMemory flashMemory;
+
+int main() {
+    CHECK_EQUAL(0, flashMemory.initialise(0));
+    CHECK_EQUAL(0, flashMemory.format());
+
+    // Uninitialised RAM, e.g. a .noinit variable after power-on
+    FlashGeometry cached;
+    memset(&cached, 0xA5, sizeof(cached));
+    CHECK_EQUAL(1, flashMemory.initialiseFast(cached));
+    CHECK_EQUAL(HOST_FLASH_PAGE_SIZE, flashMemory.pageSize);
+
+    // Refreshed record is trusted on the next boot
+    CHECK_EQUAL(QSPI_FLASH_GEOMETRY_MAGIC, cached.magic);
+    CHECK_EQUAL(0, flashMemory.initialiseFast(cached));
+
+    // Right chip ID and magic, but a corrupted field
+    cached.pageSize = 512;
+    CHECK_EQUAL(1, flashMemory.initialiseFast(cached));
+    CHECK_EQUAL(HOST_FLASH_PAGE_SIZE, flashMemory.pageSize);
+    CHECK_EQUAL(HOST_FLASH_PAGE_COUNT, flashMemory.pageCount);
+
+    // Right fields without the magic (a record from before it existed)
+    cached.magic = 0;
+    CHECK_EQUAL(1, flashMemory.initialiseFast(cached));
+    CHECK_EQUAL(0, flashMemory.initialiseFast(cached));
+
+    return hostTestResult("test_geometry");
+}
@@ -0,0 +1,148 @@
+/*
+importImage() must check a whole frame before erasing its sector: a corrupt or truncated frame
+leaves the sector untouched and is reported in getImageStats().failedSector.
+exportImage() reads every sector once, and a delta image is only applied to the contents its
+manifest was built from
+*/
+
+#include <QSPI_Flash.h>
+#include <FlashImageFormat.h>
+#include <vector>
+#include "HostTest.h"
+
+#define SECTOR_A 10
+#define SECTOR_B 11
+#define SECTORS (HOST_FLASH_SIZE / QSPI_FLASH_SECTOR_SIZE)
+
+QSPIFlashMemory flashMemory;
+uint8_t sector[QSPI_FLASH_SECTOR_SIZE];
+uint32_t manifest[SECTORS];
+
+// Image held in memory, read back from the start
+class ImageStream : public Stream {
+
+    public:
+        std::vector<uint8_t> data;
+        size_t position = 0;
+        int available() { return data.size() - position; }
+        int read() { return position < data.size() ? data[position++] : -1; }
+        int peek() { return position < data.size() ? data[position] : -1; }
+        size_t write(uint8_t c) { data.push_back(c); return 1; }
+        using Print::write;
+};
+
+// Offset of the frame of a sector in an image
+size_t findFrame(const std::vector<uint8_t> &image, uint32_t wanted) {
+    size_t offset = QSPI_FLASH_IMAGE_HEADER_SIZE;
+    while (offset < image.size() && image[offset] != QSPI_FLASH_IMAGE_FRAME_END) {
+        if (flashImageGet32(&image[offset + 4]) == wanted) {
+            return offset;
+        }
+        offset += QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE + 4;
+        if (image[offset - QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE - 4] == QSPI_FLASH_IMAGE_FRAME_DATA) {
+            offset += QSPI_FLASH_SECTOR_SIZE;
+        }
+    }
+    return 0;
+}
+
+void fillSector(uint32_t number, uint8_t value) {
+    memset(sector, value, sizeof(sector));
+    CHECK_EQUAL(0, flashMemory.eraseSector(number));
+    CHECK_EQUAL(0, flashMemory.programPages(number * (QSPI_FLASH_SECTOR_SIZE / HOST_FLASH_PAGE_SIZE), QSPI_FLASH_SECTOR_SIZE / HOST_FLASH_PAGE_SIZE, sector));
+}
+
+bool sectorIs(uint32_t number, uint8_t value) {
+    const uint8_t *memory = hostFlashMemory() + number * QSPI_FLASH_SECTOR_SIZE;
+    for (uint32_t i = 0 ; i < QSPI_FLASH_SECTOR_SIZE ; i++) {
+        if (memory[i] != value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+long import(const std::vector<uint8_t> &image) {
+    ImageStream stream;
+    stream.data = image;
+    stream.setTimeout(10);
+    return flashMemory.importImage(stream);
+}
+
+int main() {
+    CHECK_EQUAL(0, flashMemory.initialise(0));
+    CHECK_EQUAL(0, flashMemory.format());
+    fillSector(SECTOR_A, 0xA1);
+    fillSector(SECTOR_B, 0xB2);
+
+    // One flash read per chunk of every sector, data and erased alike
+    ImageStream exported;
+    flashMemory.resetRawStats();
+    CHECK(flashMemory.exportImage(exported) > 0);
+    CHECK_EQUAL(SECTORS * (QSPI_FLASH_SECTOR_SIZE / QSPI_FLASH_IMAGE_CHUNK_SIZE), flashMemory.getRawStats().read.operations);
+    CHECK_EQUAL(HOST_FLASH_SIZE, flashMemory.getRawStats().read.bytes);
+    CHECK_EQUAL(QSPI_FLASH_IMAGE_NO_SECTOR, flashMemory.getImageStats().failedSector);
+    size_t frameB = findFrame(exported.data, SECTOR_B);
+    CHECK(frameB > 0 && exported.data[frameB] == QSPI_FLASH_IMAGE_FRAME_DATA);
+
+    // One flipped bit in sector B's contents: A is applied, B is left as it is
+    fillSector(SECTOR_A, 0x5A);
+    fillSector(SECTOR_B, 0x5B);
+    std::vector<uint8_t> image = exported.data;
+    image[frameB + QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE + 100] ^= 0x01;
+    CHECK_EQUAL(-2, import(image));
+    CHECK_EQUAL(SECTOR_B, flashMemory.getImageStats().failedSector);
+    CHECK(sectorIs(SECTOR_A, 0xA1));
+    CHECK(sectorIs(SECTOR_B, 0x5B));
+
+    // Stream ends inside sector B's contents
+    fillSector(SECTOR_A, 0x5A);
+    image = exported.data;
+    image.resize(frameB + QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE + QSPI_FLASH_SECTOR_SIZE / 2);
+    CHECK_EQUAL(-3, import(image));
+    CHECK_EQUAL(SECTOR_B, flashMemory.getImageStats().failedSector);
+    CHECK(sectorIs(SECTOR_A, 0xA1));
+    CHECK(sectorIs(SECTOR_B, 0x5B));
+
+    // Corrupt trailer of an ERASED frame
+    size_t frameErased = findFrame(exported.data, SECTOR_B + 1);
+    CHECK(frameErased > 0 && exported.data[frameErased] == QSPI_FLASH_IMAGE_FRAME_ERASED);
+    fillSector(SECTOR_B + 1, 0x5C);
+    image = exported.data;
+    image[frameErased + QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE] ^= 0x01;
+    CHECK_EQUAL(-2, import(image));
+    CHECK_EQUAL(SECTOR_B + 1, flashMemory.getImageStats().failedSector);
+    CHECK(sectorIs(SECTOR_B + 1, 0x5C));
+
+    // Intact image restores everything and remounts
+    CHECK(import(exported.data) > 0);
+    CHECK_EQUAL(QSPI_FLASH_IMAGE_NO_SECTOR, flashMemory.getImageStats().failedSector);
+    CHECK(sectorIs(SECTOR_B, 0xB2));
+    CHECK(sectorIs(SECTOR_B + 1, 0xFF));
+    CHECK_EQUAL(0, flashMemory.appendToFile("/image", "after.txt", "ok"));
+
+    // Delta against this unit's manifest: only sector A differs on the source
+    CHECK_EQUAL(0, flashMemory.buildImageManifest(manifest, SECTORS));
+    fillSector(SECTOR_A, 0xC3);
+    ImageStream delta;
+    FlashImageStats deltaStats;
+    CHECK_EQUAL(1, flashMemory.exportImage(delta, manifest, &deltaStats));
+    CHECK_EQUAL(SECTORS - 1, deltaStats.skippedSectors);
+    CHECK_EQUAL(1, deltaStats.dataSectors);
+    CHECK_EQUAL(SECTORS - 1, flashMemory.getImageStats().skippedSectors);
+    CHECK_EQUAL(QSPI_FLASH_IMAGE_FLAG_DELTA, delta.data[5]);
+
+    // Applied to a unit with the manifest's contents
+    fillSector(SECTOR_A, 0xA1);
+    CHECK_EQUAL(1, import(delta.data));
+    CHECK(sectorIs(SECTOR_A, 0xC3));
+
+    // Rejected on a unit whose contents have moved on, nothing is written
+    fillSector(SECTOR_A, 0xA1);
+    fillSector(SECTOR_B, 0x7E);
+    CHECK_EQUAL(-6, import(delta.data));
+    CHECK(sectorIs(SECTOR_A, 0xA1));
+    CHECK(sectorIs(SECTOR_B, 0x7E));
+
+    return hostTestResult("test_image");
+}
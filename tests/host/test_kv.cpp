@@ -0,0 +1,174 @@
+/*
+FlashKeyValueStore: put/get/remove, the unchanged-value skip, the index rebuilt on re-open,
+a torn last record, both interrupted compactions, tombstones surviving compaction, the key and
+log limits, and re-opening the log after the filesystem was mounted again
+*/
+// HOST_TEST_FLAGS: -DQSPI_FLASH_KV_INDEX_SIZE=16 -DQSPI_FLASH_KV_MAX_LOG_SIZE=768
+
+#include <QSPI_Flash.h>
+#include <FlashKeyValueStore.h>
+#include "HostTest.h"
+
+// (QSPI_FLASH_KV_INDEX_SIZE * 3) / 4, and QSPI_FLASH_KV_MAX_LOG_SIZE holds exactly that many records
+#define MAX_KEYS 12
+
+QSPIFlashMemory flashMemory;
+FlashKeyValueStore store(flashMemory);
+Adafruit_W25Q16BV_FatFs &fatfs = flashMemory.getFlashFileSystemInterface();
+
+// Compare a stored string value, -1 expected = key must be missing
+void checkValue(char key[], const char *expected) {
+    uint8_t value[QSPI_FLASH_KV_DATA_SIZE + 1];
+    int length = store.get(key, value, QSPI_FLASH_KV_DATA_SIZE);
+    if (expected == NULL) {
+        CHECK_EQUAL(-1, length);
+        return;
+    }
+    CHECK_EQUAL((int) strlen(expected), length);
+    if (length >= 0) {
+        value[length] = 0;
+        CHECK(strcmp(expected, (char *) value) == 0);
+    }
+}
+
+// Append raw bytes to a file, as a write cut short by a power cut would leave them
+void appendRaw(const char *path, uint8_t bytes[], uint16_t length) {
+    File f = fatfs.open(path, FILE_WRITE);
+    CHECK(f.write(bytes, length) == length);
+    f.close();
+}
+
+int main() {
+    CHECK_EQUAL(0, flashMemory.initialise(0));
+    CHECK_EQUAL(0, flashMemory.format());
+
+    // put/get/remove
+    CHECK_EQUAL(0, store.begin());
+    CHECK_EQUAL(0, store.put("wifi", "home"));
+    CHECK_EQUAL(0, store.put("interval", "60"));
+    CHECK_EQUAL(0, store.put("wifi", "office"));
+    checkValue("wifi", "office");
+    checkValue("interval", "60");
+    checkValue("missing", NULL);
+    CHECK_EQUAL(2, store.getKeyCount());
+    CHECK_EQUAL(0, store.remove("interval"));
+    CHECK_EQUAL(-1, store.remove("interval"));
+    CHECK(!store.contains("interval"));
+    CHECK(store.contains("wifi"));
+    CHECK_EQUAL(1, store.getKeyCount());
+    CHECK_EQUAL(4 * QSPI_FLASH_KV_RECORD_SIZE, store.getLogSize());
+
+    // Writing the value already stored appends nothing
+    CHECK_EQUAL(0, store.put("wifi", "office"));
+    CHECK_EQUAL(4 * QSPI_FLASH_KV_RECORD_SIZE, store.getLogSize());
+
+    // begin() rebuilds the index from the log
+    store.end();
+    CHECK_EQUAL(-3, store.put("wifi", "cafe"));
+    CHECK_EQUAL(0, store.begin());
+    CHECK_EQUAL(1, store.getKeyCount());
+    CHECK_EQUAL(4 * QSPI_FLASH_KV_RECORD_SIZE, store.getLogSize());
+    checkValue("wifi", "office");
+    checkValue("interval", NULL);
+
+    // A torn last record (bad CRC) is ignored and the next append goes after it
+    {
+        store.end();
+        uint8_t record[QSPI_FLASH_KV_RECORD_SIZE];
+        CHECK_EQUAL(0, flashKVEncodeRecord(record, "wifi", 4, (uint8_t *) "torn", 4, 0));
+        record[QSPI_FLASH_KV_RECORD_SIZE - 1] ^= 0xFF;
+        appendRaw("/.config/kv.log", record, sizeof(record));
+        CHECK_EQUAL(0, store.begin());
+        checkValue("wifi", "office");
+        CHECK_EQUAL(1, store.getKeyCount());
+        CHECK_EQUAL(5 * QSPI_FLASH_KV_RECORD_SIZE, store.getLogSize());
+        CHECK_EQUAL(0, store.put("wifi", "cafe"));
+        store.end();
+        CHECK_EQUAL(0, store.begin());
+        checkValue("wifi", "cafe");
+    }
+
+    // A tombstone stays removed after compaction and re-opening
+    CHECK_EQUAL(0, store.put("colour", "red"));
+    CHECK_EQUAL(0, store.remove("colour"));
+    CHECK_EQUAL(0, store.compact());
+    CHECK_EQUAL(1 * QSPI_FLASH_KV_RECORD_SIZE, store.getLogSize());
+    checkValue("colour", NULL);
+    store.end();
+    CHECK_EQUAL(0, store.begin());
+    checkValue("colour", NULL);
+    checkValue("wifi", "cafe");
+
+    // Interrupted compaction, the new log wasn't finished: the old log is kept, the .tmp removed
+    {
+        store.end();
+        uint8_t record[QSPI_FLASH_KV_RECORD_SIZE];
+        CHECK_EQUAL(0, flashKVEncodeRecord(record, "wifi", 4, (uint8_t *) "partial", 7, 0));
+        appendRaw("/.config/kv.log.tmp", record, sizeof(record));
+        CHECK_EQUAL(0, store.begin());
+        CHECK(!fatfs.exists("/.config/kv.log.tmp"));
+        checkValue("wifi", "cafe");
+    }
+
+    // Interrupted compaction, the new log was finished but not renamed yet: it becomes the log
+    CHECK_EQUAL(0, store.put("colour", "blue"));
+    CHECK_EQUAL(0, store.compact());
+    store.end();
+    CHECK_EQUAL(FR_OK, f_rename("/.config/kv.log", "/.config/kv.log.tmp"));
+    CHECK(!fatfs.exists("/.config/kv.log"));
+    CHECK_EQUAL(0, store.begin());
+    CHECK(fatfs.exists("/.config/kv.log"));
+    CHECK(!fatfs.exists("/.config/kv.log.tmp"));
+    checkValue("wifi", "cafe");
+    checkValue("colour", "blue");
+    CHECK_EQUAL(2, store.getKeyCount());
+
+    // -4: the index is full. Filling it runs past QSPI_FLASH_KV_MAX_LOG_SIZE once, which put()
+    // handles by compacting
+    {
+        char key[16];
+        CHECK_EQUAL(0, store.put("wifi", "library"));
+        for (int i = store.getKeyCount() ; i < MAX_KEYS ; i++) {
+            sprintf(key, "key%d", i);
+            CHECK_EQUAL(0, store.put(key, "v"));
+        }
+        CHECK_EQUAL(MAX_KEYS, store.getKeyCount());
+        CHECK_EQUAL(-4, store.put("onemore", "v"));
+        checkValue("wifi", "library");
+        checkValue("key11", "v");
+    }
+
+    // -5: every record is live, compaction frees nothing and the log can't grow
+    {
+        CHECK_EQUAL(0, store.compact());
+        CHECK_EQUAL(QSPI_FLASH_KV_MAX_LOG_SIZE, store.getLogSize());
+        CHECK_EQUAL(-5, store.put("wifi", "station"));
+        CHECK_EQUAL(-5, store.remove("wifi"));
+        checkValue("wifi", "library");
+        CHECK_EQUAL(-1, store.remove("onemore"));
+    }
+
+    // A raw write remounts the filesystem: the next call re-opens the log and finds the same data
+    {
+        uint32_t mounts = flashMemory.getMountCount();
+        CHECK_EQUAL(0, flashMemory.eraseSector(flashMemory.getSectorCount() - 1));
+        checkValue("wifi", "library");
+        CHECK(flashMemory.getMountCount() > mounts);
+        CHECK_EQUAL(MAX_KEYS, store.getKeyCount());
+    }
+
+    // After a format the store is empty and usable without calling begin() again
+    CHECK_EQUAL(0, flashMemory.format());
+    checkValue("wifi", NULL);
+    CHECK_EQUAL(0, store.getKeyCount());
+    CHECK_EQUAL(0, store.put("wifi", "fresh"));
+    checkValue("wifi", "fresh");
+    CHECK_EQUAL(1 * QSPI_FLASH_KV_RECORD_SIZE, store.getLogSize());
+    store.end();
+    CHECK_EQUAL(0, store.begin());
+    checkValue("wifi", "fresh");
+    store.end();
+
+    CHECK_EQUAL(0, hostFileSystemOpenFiles());
+    return hostTestResult("test_kv");
+}
@@ -0,0 +1,195 @@
+/*
+Stress test for the volume lock and the striped per-file locks (FlashStdMutexLock).
+Several threads append, read back and delete on one shared file and on files of their own,
+while the simulated filesystem counts every call made with another thread inside it and the
+locks check that no file lock is taken while the volume lock is already held
+*/
+
+#include <QSPI_Flash.h>
+#include <atomic>
+#include <map>
+#include <thread>
+#include <vector>
+#include "HostTest.h"
+
+#define SHARED_WRITERS  3
+#define OWN_WRITERS     3
+#define ITERATIONS      300
+#define LINE_LENGTH     9       // "tt:nnnnn\n"
+#define TIMEOUT_SECONDS 120
+
+QSPIFlashMemory flashMemory;
+std::atomic<unsigned long> orderViolations(0);
+std::atomic<bool> finished(false);
+
+/*
+Class: OrderCheckedLock
+Description: FlashStdMutexLock that records a file lock newly taken by a thread which
+             already holds the volume lock (the reverse of the documented order)
+*/
+class OrderCheckedLock : public FlashLock {
+
+    public:
+        OrderCheckedLock(bool volume = false) : _volume(volume) {}
+        void lock() {
+            if (!_volume && volumeDepth > 0 && held[this] == 0) {
+                orderViolations++;
+            }
+            _lock.lock();
+            held[this]++;
+            if (_volume) {
+                volumeDepth++;
+            }
+        }
+        void unlock() {
+            held[this]--;
+            if (_volume) {
+                volumeDepth--;
+            }
+            _lock.unlock();
+        }
+    private:
+        bool _volume;
+        FlashStdMutexLock _lock;
+        static thread_local int volumeDepth;
+        static thread_local std::map<OrderCheckedLock *, int> held;
+};
+
+thread_local int OrderCheckedLock::volumeDepth = 0;
+thread_local std::map<OrderCheckedLock *, int> OrderCheckedLock::held;
+
+// Lines read back must be whole and each writer's sequence numbers must increase
+bool checkLines(const char content[], long length, int lastSeen[]) {
+    if (length % LINE_LENGTH != 0) {
+        return false;
+    }
+    for (long offset = 0 ; offset < length ; offset += LINE_LENGTH) {
+        int writer;
+        int sequence;
+        if (sscanf(&content[offset], "%02d:%05d", &writer, &sequence) != 2 || content[offset + LINE_LENGTH - 1] != '\n'
+            || writer < 0 || writer >= SHARED_WRITERS + OWN_WRITERS || sequence <= lastSeen[writer]) {
+            return false;
+        }
+        lastSeen[writer] = sequence;
+    }
+    return true;
+}
+
+void sharedWriter(int id, std::atomic<int> *failures) {
+    char line[LINE_LENGTH + 1];
+    static char content[ITERATIONS * (SHARED_WRITERS + 1) * LINE_LENGTH];
+    static std::atomic<int> reader(0);
+    for (int i = 1 ; i <= ITERATIONS ; i++) {
+        snprintf(line, sizeof(line), "%02d:%05d\n", id, i);
+        if (flashMemory.appendToFile("/stress", "shared.log", line) != 0) {
+            (*failures)++;
+        }
+        if (i % 10 == id) {
+            // One reader at a time through the static buffer, the file lock keeps the size stable
+            if (reader.exchange(1) == 0) {
+                FlashLockGuard fileGuard(flashMemory.getFileLock("/stress", "shared.log"));
+                int size = flashMemory.getFilesize("/stress", "shared.log");
+                if (size > 0 && size <= (int) sizeof(content)) {
+                    int lastSeen[SHARED_WRITERS + OWN_WRITERS] = {};
+                    if (flashMemory.readFileContents("/stress", "shared.log", (uint8_t *) content, size) != 0 || !checkLines(content, size, lastSeen)) {
+                        (*failures)++;
+                    }
+                }
+                reader = 0;
+            }
+        }
+        if (id == 0 && i % 50 == 0) {
+            flashMemory.deleteFile("/stress", "shared.log");
+        }
+    }
+}
+
+void ownWriter(int id, std::atomic<int> *failures) {
+    char line[LINE_LENGTH + 1];
+    char filename[16];
+    char content[100 * LINE_LENGTH];
+    // Last writer works in a directory of its own
+    char *directory = (id == SHARED_WRITERS + OWN_WRITERS - 1) ? (char *) "/stress-other" : (char *) "/stress";
+    snprintf(filename, sizeof(filename), "own%d.log", id);
+    int lines = 0;
+    for (int i = 1 ; i <= ITERATIONS ; i++) {
+        snprintf(line, sizeof(line), "%02d:%05d\n", id, i);
+        if (flashMemory.appendToFile(directory, filename, line) != 0) {
+            (*failures)++;
+        }
+        lines++;
+        if (i % 25 == 0) {
+            int lastSeen[SHARED_WRITERS + OWN_WRITERS] = {};
+            for (int w = 0 ; w < SHARED_WRITERS + OWN_WRITERS ; w++) {
+                lastSeen[w] = i - lines;
+            }
+            if (flashMemory.getFilesize(directory, filename) != lines * LINE_LENGTH
+                || flashMemory.readFileContents(directory, filename, (uint8_t *) content, lines * LINE_LENGTH) != 0
+                || !checkLines(content, lines * LINE_LENGTH, lastSeen) || lastSeen[id] != i) {
+                (*failures)++;
+            }
+        }
+        if (i % 100 == 0) {
+            if (flashMemory.deleteFile(directory, filename) != 0) {
+                (*failures)++;
+            }
+            lines = 0;
+        }
+    }
+}
+
+void runStress(uint8_t fileLockCount) {
+    OrderCheckedLock volumeLock(true);
+    OrderCheckedLock stripes[4];
+    FlashLock *fileLocks[4] = { &stripes[0], &stripes[1], &stripes[2], &stripes[3] };
+    flashMemory.setLocks(&volumeLock, fileLocks, fileLockCount);
+    CHECK_EQUAL(0, flashMemory.format());
+
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+    for (int id = 0 ; id < SHARED_WRITERS ; id++) {
+        threads.push_back(std::thread(sharedWriter, id, &failures));
+    }
+    for (int id = SHARED_WRITERS ; id < SHARED_WRITERS + OWN_WRITERS ; id++) {
+        threads.push_back(std::thread(ownWriter, id, &failures));
+    }
+    for (size_t i = 0 ; i < threads.size() ; i++) {
+        threads[i].join();
+    }
+    flashMemory.setLocks(NULL);
+
+    CHECK_EQUAL(0, failures.load());
+    CHECK_EQUAL(0, hostFileSystemViolations());
+    CHECK_EQUAL(0, orderViolations.load());
+    CHECK_EQUAL(0, hostFileSystemOpenFiles());
+}
+
+int main() {
+    // A deadlock fails the test instead of hanging it
+    std::thread watchdog([] {
+        for (int s = 0 ; s < TIMEOUT_SECONDS && !finished ; s++) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+        if (!finished) {
+            fprintf(stderr, "test_locking: timed out (deadlock?)\n");
+            _Exit(1);
+        }
+    });
+
+    CHECK_EQUAL(0, flashMemory.initialise(0));
+    runStress(4);
+    // Every file on one stripe
+    runStress(1);
+    // Without any locks the simulation must notice the overlapping calls
+    flashMemory.setLocks(NULL);
+    std::atomic<int> ignored(0);
+    std::thread first(ownWriter, SHARED_WRITERS, &ignored);
+    std::thread second(ownWriter, SHARED_WRITERS + 1, &ignored);
+    first.join();
+    second.join();
+    CHECK(hostFileSystemViolations() > 0);
+
+    finished = true;
+    watchdog.join();
+    return hostTestResult("test_locking");
+}
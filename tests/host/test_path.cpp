@@ -0,0 +1,62 @@
+/*
+Paths longer than QSPI_FLASH_MAX_PATH_LENGTH are reported as -8 by every helper instead of
+acting on an empty path, and (with QSPI_FLASH_STATIC_ARENA) the path buffer pool
+*/
+
+#include <QSPI_Flash.h>
+#include <FlashReader.h>
+#include "HostTest.h"
+
+QSPIFlashMemory flashMemory;
+FlashReader reader(flashMemory);
+char longName[QSPI_FLASH_MAX_PATH_LENGTH];
+uint8_t content[16];
+
+int main() {
+    CHECK_EQUAL(0, flashMemory.initialise(0));
+    CHECK_EQUAL(0, flashMemory.format());
+    CHECK_EQUAL(0, flashMemory.appendToFile("/path", "short.txt", "kept"));
+
+    // "/path" + "/" + longName is one byte over
+    memset(longName, 'a', sizeof(longName) - 6);
+    longName[sizeof(longName) - 6] = 0;
+    char path[QSPI_FLASH_MAX_PATH_LENGTH];
+    CHECK_EQUAL(-1, flashMemory.path.resolve(path, "/path", longName));
+    CHECK_EQUAL(0, (int) strlen(path));
+    longName[sizeof(longName) - 7] = 0;
+    CHECK_EQUAL(0, flashMemory.path.resolve(path, "/path", longName));
+    longName[sizeof(longName) - 7] = 'a';
+
+    CHECK_EQUAL(-8, flashMemory.createFile("/path", longName));
+    CHECK_EQUAL(-8, flashMemory.saveFile("/path", longName, "x", true));
+    CHECK_EQUAL(-8, flashMemory.appendToFile("/path", longName, "x"));
+    CHECK_EQUAL(-8, flashMemory.appendToFile("/path", longName, 'x'));
+    CHECK_EQUAL(-8, flashMemory.appendToFile("/path", longName, 1, true));
+    int values[2] = { 1, 2 };
+    CHECK_EQUAL(-8, flashMemory.appendToFile("/path", longName, values, 2, true));
+    CHECK_EQUAL(-8, flashMemory.getFilesize("/path", longName));
+    CHECK_EQUAL(-8, flashMemory.readFileContents("/path", longName, content, sizeof(content)));
+    CHECK_EQUAL(-8, (int) flashMemory.appendFromStream("/path", longName, Serial, 1, 1));
+    CHECK_EQUAL(-8, (int) flashMemory.writeToStream("/path", longName, Serial));
+    CHECK_EQUAL(-8, flashMemory.deleteFile("/path", longName));
+    CHECK_EQUAL(-8, reader.open("/path", longName));
+    CHECK(!flashMemory.checkFileExists("/path", longName));
+    File file = flashMemory.getFile("/path", longName);
+    CHECK(!file);
+
+    // Nothing was written to or removed from the directory
+    CHECK_EQUAL(4, flashMemory.getFilesize("/path", "short.txt"));
+
+#if QSPI_FLASH_STATIC_ARENA
+    // Scoped buffers come back to the pool, one past the pool size is refused
+    {
+        FlashPathBuffer buffers[QSPI_FLASH_PATH_BUFFERS];
+        FlashPathBuffer extra;
+        CHECK(extra == NULL);
+        CHECK_EQUAL(-1, flashMemory.path.resolve(extra, "/path", "short.txt"));
+        CHECK(buffers[QSPI_FLASH_PATH_BUFFERS - 1] != NULL);
+    }
+    CHECK_EQUAL(4, flashMemory.getFilesize("/path", "short.txt"));
+#endif
+    return hostTestResult("test_path");
+}
@@ -0,0 +1,51 @@
+/*
+Raw block API: page counts and scatter-gather lengths that would wrap a uint32_t, and the
+remount after raw programs and erases
+*/
+
+#include <QSPI_Flash.h>
+#include "HostTest.h"
+
+QSPIFlashMemory flashMemory;
+uint8_t pages[2 * HOST_FLASH_PAGE_SIZE];
+
+int main() {
+    CHECK_EQUAL(0, flashMemory.initialise(0));
+    CHECK_EQUAL(0, flashMemory.format());
+
+    // count * pageSize wraps to 0 and to one page
+    CHECK_EQUAL(-1, flashMemory.readPages(0, 0x01000000UL, pages));
+    CHECK_EQUAL(-1, flashMemory.readPages(0, 0x01000001UL, pages));
+    CHECK_EQUAL(-1, flashMemory.programPages(0, 0x01000001UL, pages));
+    CHECK_EQUAL(-1, flashMemory.readPages(0, HOST_FLASH_PAGE_COUNT + 1, pages));
+    CHECK_EQUAL(0, flashMemory.readPages(HOST_FLASH_PAGE_COUNT - 2, 2, pages));
+
+    // Vector lengths summing past 4GB back to one page
+    FlashIOVec vectors[2] = { { pages, 2 * HOST_FLASH_PAGE_SIZE }, { pages, 0xFFFFFFFFUL - HOST_FLASH_PAGE_SIZE + 1 } };
+    CHECK_EQUAL(-1, flashMemory.readPages(0, vectors, 2));
+    CHECK_EQUAL(-1, flashMemory.programPages(0, vectors, 2));
+
+    // Raw writes make the next helper remount, reads don't
+    unsigned long mounts = hostFileSystemMounts();
+    CHECK_EQUAL(0, flashMemory.appendToFile("/raw", "a.txt", "a"));
+    CHECK_EQUAL(mounts, hostFileSystemMounts());
+    CHECK_EQUAL(0, flashMemory.readPages(0, 1, pages));
+    CHECK_EQUAL(0, flashMemory.appendToFile("/raw", "a.txt", "a"));
+    CHECK_EQUAL(mounts, hostFileSystemMounts());
+
+    CHECK_EQUAL(0, flashMemory.eraseSector(flashMemory.getSectorCount() - 1));
+    CHECK_EQUAL(0, flashMemory.appendToFile("/raw", "a.txt", "a"));
+    CHECK_EQUAL(mounts + 1, hostFileSystemMounts());
+
+    memset(pages, 0x5A, sizeof(pages));
+    CHECK_EQUAL(0, flashMemory.programPages(HOST_FLASH_PAGE_COUNT - 2, 2, pages));
+    CHECK_EQUAL(0, flashMemory.appendToFile("/raw", "a.txt", "a"));
+    CHECK_EQUAL(mounts + 2, hostFileSystemMounts());
+
+    CHECK_EQUAL(0, flashMemory.eraseBlock(flashMemory.getBlockCount() - 1));
+    CHECK_EQUAL(0, flashMemory.appendToFile("/raw", "a.txt", "a"));
+    CHECK_EQUAL(mounts + 3, hostFileSystemMounts());
+    CHECK_EQUAL(5, flashMemory.getFilesize("/raw", "a.txt"));
+
+    return hostTestResult("test_raw");
+}
@@ -0,0 +1,166 @@
+/*
+FlashReader: lines longer than the caller's buffer (and ones that fill it exactly), "\r\n" split
+across a refill, a last line without a newline, bulk reads past the read-ahead buffer and
+peekBuffer()/consume() across refills, with position() checked along the way
+*/
+
+#include <QSPI_Flash.h>
+#include <FlashReader.h>
+#include "HostTest.h"
+
+#define BULK_SIZE 3000
+
+QSPIFlashMemory flashMemory;
+FlashReader reader(flashMemory);
+char text[BULK_SIZE + 1];
+
+void writeText(char filename[], const char *content) {
+    strncpy(text, content, sizeof(text) - 1);
+    CHECK_EQUAL(0, flashMemory.saveFile("/reader", filename, text, true));
+}
+
+// Next line through readLine(), NULL expected = end of file
+void checkLine(char line[], uint32_t maxLength, const char *expected) {
+    int length = reader.readLine(line, maxLength);
+    if (expected == NULL) {
+        CHECK_EQUAL(-1, length);
+        return;
+    }
+    CHECK_EQUAL((int) strlen(expected), length);
+    CHECK(strcmp(expected, line) == 0);
+}
+
+void checkNextLine(const char *expected) {
+    char *line;
+    int length = reader.nextLine(line);
+    if (expected == NULL) {
+        CHECK_EQUAL(-1, length);
+        return;
+    }
+    CHECK_EQUAL((int) strlen(expected), length);
+    if (length >= 0) {
+        CHECK(strcmp(expected, line) == 0);
+    }
+}
+
+int main() {
+    CHECK_EQUAL(0, flashMemory.initialise(0));
+    CHECK_EQUAL(0, flashMemory.format());
+    char line[QSPI_FLASH_READER_BUFFER_SIZE * 2];
+
+    // A line longer than the caller's buffer comes back in pieces
+    writeText("long.txt", "abcdefghij\nxy\n");
+    CHECK_EQUAL(0, reader.open("/reader", "long.txt"));
+    checkLine(line, 5, "abcd");
+    checkLine(line, 5, "efgh");
+    checkLine(line, 5, "ij");
+    checkLine(line, 5, "xy");
+    checkLine(line, 5, NULL);
+    CHECK_EQUAL(14, reader.position());
+    reader.close();
+
+    // A line that fills the buffer exactly: its line end is consumed, no empty line follows
+    writeText("exact.txt", "abcd\nefgh\r\nij\n");
+    CHECK_EQUAL(0, reader.open("/reader", "exact.txt"));
+    checkLine(line, 5, "abcd");
+    checkLine(line, 5, "efgh");
+    checkLine(line, 5, "ij");
+    checkLine(line, 5, NULL);
+    reader.close();
+    writeText("exact.csv", "abcd,ef,ghij,");
+    CHECK_EQUAL(0, reader.open("/reader", "exact.csv"));
+    CHECK_EQUAL(4, reader.readUntil(',', line, 5));
+    CHECK(strcmp("abcd", line) == 0);
+    CHECK_EQUAL(2, reader.readUntil(',', line, 5));
+    CHECK(strcmp("ef", line) == 0);
+    CHECK_EQUAL(4, reader.readUntil(',', line, 5));
+    CHECK(strcmp("ghij", line) == 0);
+    CHECK_EQUAL(-1, reader.readUntil(',', line, 5));
+    reader.close();
+
+    // "\r\n" split across a refill: the "\r" is the last byte of the first read-ahead buffer
+    {
+        uint32_t secondLength = QSPI_FLASH_READER_BUFFER_SIZE - 8;
+        strcpy(text, "hello\r\n");
+        memset(&text[7], 'x', secondLength);
+        strcpy(&text[7 + secondLength], "\r\nlast\r\n");
+        CHECK_EQUAL(0, flashMemory.saveFile("/reader", "split.txt", text, true));
+        char expected[QSPI_FLASH_READER_BUFFER_SIZE];
+        memset(expected, 'x', secondLength);
+        expected[secondLength] = 0;
+
+        CHECK_EQUAL(0, reader.open("/reader", "split.txt"));
+        checkLine(line, sizeof(line), "hello");
+        checkLine(line, sizeof(line), expected);
+        CHECK_EQUAL(QSPI_FLASH_READER_BUFFER_SIZE + 1, reader.position());
+        checkLine(line, sizeof(line), "last");
+        checkLine(line, sizeof(line), NULL);
+        reader.close();
+
+        CHECK_EQUAL(0, reader.open("/reader", "split.txt"));
+        checkNextLine("hello");
+        checkNextLine(expected);
+        checkNextLine("last");
+        checkNextLine(NULL);
+        reader.close();
+    }
+
+    // End of file without a trailing newline
+    writeText("tail.txt", "one\r\ntwo");
+    CHECK_EQUAL(0, reader.open("/reader", "tail.txt"));
+    checkLine(line, sizeof(line), "one");
+    checkLine(line, sizeof(line), "two");
+    checkLine(line, sizeof(line), NULL);
+    reader.close();
+    CHECK_EQUAL(0, reader.open("/reader", "tail.txt"));
+    checkNextLine("one");
+    checkNextLine("two");
+    checkNextLine(NULL);
+    reader.close();
+
+    // Bulk reads: a small one fills the read-ahead buffer, a larger one goes around it
+    {
+        for (int i = 0 ; i < BULK_SIZE ; i++) {
+            text[i] = 'A' + (i * 7) % 26;
+        }
+        text[BULK_SIZE] = 0;
+        CHECK_EQUAL(0, flashMemory.saveFile("/reader", "bulk.bin", text, true));
+        uint8_t data[BULK_SIZE];
+        CHECK_EQUAL(0, reader.open("/reader", "bulk.bin"));
+        CHECK_EQUAL(BULK_SIZE, reader.size());
+        CHECK_EQUAL(10, reader.read(data, 10));
+        CHECK_EQUAL(10, reader.position());
+        CHECK_EQUAL(1500, reader.read(&data[10], 1500));
+        CHECK_EQUAL(1510, reader.position());
+        CHECK_EQUAL(100, reader.read(&data[1510], 100));
+        CHECK_EQUAL(1610, reader.position());
+        CHECK_EQUAL(BULK_SIZE - 1610, reader.read(&data[1610], BULK_SIZE));
+        CHECK_EQUAL(BULK_SIZE, reader.position());
+        CHECK_EQUAL(0, reader.read(data, 1));
+        CHECK(memcmp(text, data, BULK_SIZE) == 0);
+        reader.close();
+    }
+
+    // peekBuffer()/consume() in pieces that don't line up with the refills
+    {
+        CHECK_EQUAL(0, reader.open("/reader", "bulk.bin"));
+        uint32_t consumed = 0;
+        uint8_t *data;
+        int available;
+        bool matches = true;
+        while ((available = reader.peekBuffer(data)) > 0) {
+            uint32_t piece = (available < 77) ? available : 77;
+            matches = matches && memcmp(&text[consumed], data, piece) == 0;
+            reader.consume(piece);
+            consumed += piece;
+            CHECK_EQUAL(consumed, reader.position());
+        }
+        CHECK_EQUAL(0, available);
+        CHECK(matches);
+        CHECK_EQUAL(BULK_SIZE, consumed);
+        reader.close();
+    }
+
+    CHECK_EQUAL(0, hostFileSystemOpenFiles());
+    return hostTestResult("test_reader");
+}
@@ -0,0 +1,106 @@
+/*
+FlashTimeSeries recovery: a torn record at the end of the data file followed by a shorter
+append must not leave stale bytes that later read back as records
+*/
+
+#include <QSPI_Flash.h>
+#include <FlashTimeSeries.h>
+#include "HostTest.h"
+
+#define RECORDS         40
+#define PAYLOAD_LENGTH  20
+
+QSPIFlashMemory flashMemory;
+uint32_t timestamps[RECORDS + 4];
+long received;
+
+void collect(uint32_t timestamp, uint8_t data[], uint16_t length, void *context) {
+    if (received < RECORDS + 4) {
+        timestamps[received] = timestamp;
+    }
+    received++;
+}
+
+void encodeRecord(uint8_t record[], uint32_t timestamp, uint8_t payload[], uint16_t length) {
+    record[0] = timestamp;
+    record[1] = timestamp >> 8;
+    record[2] = timestamp >> 16;
+    record[3] = timestamp >> 24;
+    record[4] = length;
+    record[5] = length >> 8;
+    uint32_t crc = flashCRC32(payload, length, flashCRC32(record, 6));
+    record[6] = crc;
+    record[7] = crc >> 8;
+    record[8] = crc >> 16;
+    record[9] = crc >> 24;
+    memcpy(&record[QSPI_FLASH_SERIES_HEADER_SIZE], payload, length);
+}
+
+// Append raw bytes straight to the data file, as a write cut short by a power cut would leave them
+void appendRaw(char filename[], uint8_t bytes[], uint16_t length) {
+    char resolvedPath[QSPI_FLASH_MAX_PATH_LENGTH];
+    snprintf(resolvedPath, sizeof(resolvedPath), "/series/%s", filename);
+    File f = flashMemory.getFlashFileSystemInterface().open(resolvedPath, FILE_WRITE);
+    CHECK(f.write(bytes, length) == length);
+    f.close();
+}
+
+// staleRecord: what the bytes left behind the short append decode as
+void tornTailThenShortAppend(char filename[], uint32_t staleTimestamp, bool staleCRCValid) {
+    FlashTimeSeries series(flashMemory);
+    uint8_t payload[PAYLOAD_LENGTH];
+    CHECK_EQUAL(0, series.begin("/series", filename));
+    for (uint32_t i = 1 ; i <= RECORDS ; i++) {
+        memset(payload, i, sizeof(payload));
+        CHECK_EQUAL(0, series.append(i * 10, payload, sizeof(payload)));
+    }
+    uint32_t seriesSize = series.getDataSize();
+    series.end();
+
+    // Torn record: header and the first 12 payload bytes of a 30 byte record. Payload bytes 2-11
+    // hold a complete zero length record, which is all that remains once a 12 byte record
+    // (header + 2 bytes) is appended over the torn one
+    uint8_t torn[QSPI_FLASH_SERIES_HEADER_SIZE + 30] = {};
+    uint8_t inner[QSPI_FLASH_SERIES_HEADER_SIZE];
+    encodeRecord(inner, staleTimestamp, NULL, 0);
+    if (!staleCRCValid) {
+        inner[6] ^= 0xFF;
+    }
+    memcpy(&payload[2], inner, sizeof(inner));
+    encodeRecord(torn, 1000, payload, 30);
+    appendRaw(filename, torn, QSPI_FLASH_SERIES_HEADER_SIZE + 12);
+
+    CHECK_EQUAL(0, series.begin("/series", filename));
+    CHECK_EQUAL(seriesSize, series.getDataSize());
+    CHECK_EQUAL(RECORDS * 10, series.getLastTimestamp());
+    uint8_t shortPayload[2] = { 0xAA, 0x55 };
+    CHECK_EQUAL(0, series.append(RECORDS * 10 + 1, shortPayload, sizeof(shortPayload)));
+    series.end();
+
+    // The stale bytes must not become a record, whichever way the series is opened
+    CHECK_EQUAL(0, series.begin("/series", filename));
+    CHECK_EQUAL(seriesSize + QSPI_FLASH_SERIES_HEADER_SIZE + 2, series.getDataSize());
+    CHECK_EQUAL(RECORDS * 10 + 1, series.getLastTimestamp());
+    CHECK_EQUAL(0, series.append(RECORDS * 10 + 2, shortPayload, sizeof(shortPayload)));
+    received = 0;
+    CHECK_EQUAL(RECORDS + 2, series.query(0, 0xFFFFFFFFUL, collect, NULL));
+    series.end();
+
+    received = 0;
+    CHECK_EQUAL(RECORDS + 2, flashMemory.querySeries("/series", filename, 0, 0xFFFFFFFFUL, collect));
+    CHECK_EQUAL(RECORDS * 10 + 1, timestamps[RECORDS]);
+    CHECK_EQUAL(RECORDS * 10 + 2, timestamps[RECORDS + 1]);
+    for (long i = 1 ; i < received && i < RECORDS + 4 ; i++) {
+        CHECK(timestamps[i] > timestamps[i - 1]);
+    }
+}
+
+int main() {
+    CHECK_EQUAL(0, flashMemory.initialise(0));
+    CHECK_EQUAL(0, flashMemory.format());
+    // Stale record newer than the series, caught by its CRC
+    tornTailThenShortAppend("newer.ts", 5000, false);
+    // Stale record with a good CRC but older than the series, caught by its timestamp
+    tornTailThenShortAppend("older.ts", 5, true);
+    return hostTestResult("test_series");
+}
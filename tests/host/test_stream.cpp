@@ -0,0 +1,143 @@
+/*
+appendFromStream()/writeToStream() over a pipe: binary data with NULs, the maxBytes limit,
+the idle timeout with a slow sender, a destination that stops accepting bytes, and each of two
+concurrent transfers getting its own stats
+*/
+
+#include <QSPI_Flash.h>
+#include <HostPipeStream.h>
+#include <thread>
+#include "HostTest.h"
+
+#define BINARY_SIZE 1000
+#define TIMEOUT_MILLIS 200
+
+QSPIFlashMemory flashMemory;
+uint8_t data[80000];
+uint8_t content[80000];
+
+int main() {
+    CHECK_EQUAL(0, flashMemory.initialise(0));
+    CHECK_EQUAL(0, flashMemory.format());
+    // Every byte value, NULs included, and not a multiple of the stream buffer
+    for (uint32_t i = 0 ; i < sizeof(data) ; i++) {
+        data[i] = (i % 7 == 0) ? 0 : (uint8_t) (i * 31);
+    }
+
+    // Binary data, ends at the idle timeout
+    {
+        HostPipeStream pipe;
+        CHECK_EQUAL(BINARY_SIZE, (int) pipe.write(data, BINARY_SIZE));
+        unsigned long start = millis();
+        CHECK_EQUAL(BINARY_SIZE, flashMemory.appendFromStream("/stream", "binary.bin", pipe, 100000, TIMEOUT_MILLIS));
+        CHECK(millis() - start >= TIMEOUT_MILLIS);
+        CHECK_EQUAL(BINARY_SIZE, flashMemory.getStreamStats().bytes);
+        CHECK_EQUAL(BINARY_SIZE, flashMemory.getFilesize("/stream", "binary.bin"));
+        CHECK_EQUAL(0, flashMemory.readFileContents("/stream", "binary.bin", content, BINARY_SIZE));
+        CHECK(memcmp(data, content, BINARY_SIZE) == 0);
+    }
+
+    // maxBytes stops the transfer without waiting, the rest stays in the stream
+    {
+        HostPipeStream pipe;
+        pipe.write(data, BINARY_SIZE);
+        unsigned long start = millis();
+        CHECK_EQUAL(300, flashMemory.appendFromStream("/stream", "limit.bin", pipe, 300, 5000));
+        CHECK(millis() - start < 5000);
+        CHECK_EQUAL(BINARY_SIZE - 300, pipe.available());
+        CHECK_EQUAL(300, flashMemory.getFilesize("/stream", "limit.bin"));
+    }
+
+    // Gaps shorter than the timeout keep the transfer going, the first longer one ends it
+    {
+        HostPipeStream pipe;
+        std::thread sender([&pipe] {
+            for (int i = 0 ; i < 4 ; i++) {
+                pipe.write(&data[i * 100], 100);
+                delay(TIMEOUT_MILLIS / 4);
+            }
+            delay(TIMEOUT_MILLIS * 3);
+            pipe.write(data, 100);
+        });
+        CHECK_EQUAL(400, flashMemory.appendFromStream("/stream", "slow.bin", pipe, 100000, TIMEOUT_MILLIS));
+        sender.join();
+        CHECK_EQUAL(0, flashMemory.readFileContents("/stream", "slow.bin", content, 400));
+        CHECK(memcmp(data, content, 400) == 0);
+
+        // Nothing at all arrives
+        HostPipeStream silent;
+        CHECK_EQUAL(0, flashMemory.appendFromStream("/stream", "empty.bin", silent, 100000, TIMEOUT_MILLIS / 4));
+        CHECK_EQUAL(0, flashMemory.getFilesize("/stream", "empty.bin"));
+    }
+
+    // File back out, byte for byte
+    {
+        HostPipeStream pipe;
+        CHECK_EQUAL(BINARY_SIZE, flashMemory.writeToStream("/stream", "binary.bin", pipe));
+        CHECK_EQUAL(BINARY_SIZE, pipe.available());
+        CHECK_EQUAL(BINARY_SIZE, (int) pipe.readBytes(content, BINARY_SIZE));
+        CHECK(memcmp(data, content, BINARY_SIZE) == 0);
+    }
+
+    // Destination fills up part way: -4, and the stats count what was accepted
+    {
+        HostPipeStream pipe;
+        int capacity = pipe.setCapacity(4096);
+        if (capacity <= 0) {
+            capacity = 65536;
+        }
+        CHECK((uint32_t) capacity + 1000 <= sizeof(data));
+        HostPipeStream source;
+        std::thread sender([&source, capacity] {
+            for (int sent = 0 ; sent < capacity + 1000 ; ) {
+                sent += source.write(&data[sent], capacity + 1000 - sent);
+                yield();
+            }
+        });
+        CHECK_EQUAL(capacity + 1000, flashMemory.appendFromStream("/stream", "large.bin", source, capacity + 1000, TIMEOUT_MILLIS));
+        sender.join();
+        CHECK_EQUAL(-4, flashMemory.writeToStream("/stream", "large.bin", pipe));
+        uint32_t accepted = flashMemory.getStreamStats().bytes;
+        CHECK(accepted > 0 && accepted < (uint32_t) capacity + 1000);
+        CHECK_EQUAL(accepted, pipe.available());
+        CHECK_EQUAL(accepted, pipe.readBytes(content, accepted));
+        CHECK(memcmp(data, content, accepted) == 0);
+    }
+
+    // Two transfers on different files at once: each gets its own stats through the pointer,
+    // getStreamStats() holds whichever finished last, never a mix of both
+    {
+        FlashStdMutexLock volumeLock;
+        FlashStdMutexLock stripes[4];
+        FlashLock *fileLocks[4] = { &stripes[0], &stripes[1], &stripes[2], &stripes[3] };
+        flashMemory.setLocks(&volumeLock, fileLocks, 4);
+        HostPipeStream first;
+        HostPipeStream second;
+        first.write(data, BINARY_SIZE);
+        second.write(data, 300);
+        FlashStreamStats firstStats;
+        FlashStreamStats secondStats;
+        long secondResult = 0;
+        std::thread other([&second, &secondStats, &secondResult] {
+            secondResult = flashMemory.appendFromStream("/stream", "second.bin", second, 100000, TIMEOUT_MILLIS / 2, &secondStats);
+        });
+        CHECK_EQUAL(BINARY_SIZE, flashMemory.appendFromStream("/stream", "first.bin", first, 100000, TIMEOUT_MILLIS, &firstStats));
+        other.join();
+        CHECK_EQUAL(300, secondResult);
+        CHECK_EQUAL(BINARY_SIZE, firstStats.bytes);
+        CHECK_EQUAL(300, secondStats.bytes);
+        FlashStreamStats last = flashMemory.getStreamStats();
+        CHECK(memcmp(&last, &firstStats, sizeof(last)) == 0 || memcmp(&last, &secondStats, sizeof(last)) == 0);
+
+        HostPipeStream out;
+        CHECK_EQUAL(300, flashMemory.writeToStream("/stream", "second.bin", out, &secondStats));
+        CHECK_EQUAL(300, secondStats.bytes);
+        CHECK(secondStats.flashOperations > 0);
+        last = flashMemory.getStreamStats();
+        CHECK(memcmp(&last, &secondStats, sizeof(last)) == 0);
+        flashMemory.setLocks(NULL);
+    }
+
+    CHECK_EQUAL(0, hostFileSystemOpenFiles());
+    return hostTestResult("test_stream");
+}
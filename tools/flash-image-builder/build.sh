@@ -0,0 +1,61 @@
+#!/bin/sh
+# Build flash-image-builder against the FatFs sources bundled with Adafruit_SPIFlash, so the
+# volume is made by the same f_fdisk()/f_mkfs() as QSPIFlashMemory::format().
+# Run from the library root:  sh tools/flash-image-builder/build.sh <Adafruit_SPIFlash directory> [output]
+# Only ff.c and its code page tables are used, the library's own diskio layer is replaced by a
+# chip image in memory (see flash-image-builder.cpp). Its GET_BLOCK_SIZE answer is read from the
+# source and becomes the -b default
+set -e
+
+if [ $# -lt 1 ]; then
+    echo "usage: $0 <Adafruit_SPIFlash directory> [output]" >&2
+    exit 2
+fi
+OUTPUT=${2:-flash-image-builder}
+CC=${CC:-cc}
+CXX=${CXX:-g++}
+BUILD=${TMPDIR:-/tmp}/flash-image-builder
+
+FF=$(find "$1" -name ff.c -o -name ff.cpp | head -n 1)
+if [ -z "$FF" ]; then
+    echo "$0: no FatFs ff.c under $1" >&2
+    exit 1
+fi
+FATFS=$(dirname "$FF")
+# Unicode/code page conversion for long file names (empty when _USE_LFN is 0)
+UNICODE=$(find "$FATFS" -name unicode.c | head -n 1)
+if [ -z "$UNICODE" ]; then
+    UNICODE=$(find "$FATFS" -name ccsbcs.c | head -n 1)
+fi
+
+# The erase block the library's diskio layer reports to f_mkfs() (GET_BLOCK_SIZE), which places
+# the data area. Without a plain number to copy there is no default and the tool needs -b
+BLOCK_SECTORS=""
+for diskio in $(grep -rl --include='*.c' --include='*.cpp' 'case[[:space:]]*GET_BLOCK_SIZE' "$1" | grep -v '/ff\.c'); do
+    BLOCK_SECTORS=$(sed -n '/case[[:space:]]*GET_BLOCK_SIZE/,/return\|break/p' "$diskio" \
+        | sed -n 's/.*=[[:space:]]*\([0-9][0-9]*\)[[:space:]]*;.*/\1/p' | head -n 1)
+    if [ -n "$BLOCK_SECTORS" ]; then
+        echo "GET_BLOCK_SIZE in $diskio: $BLOCK_SECTORS sectors, the -b default"
+        CXXFLAGS="$CXXFLAGS -DIMAGE_DEFAULT_BLOCK_SECTORS=$BLOCK_SECTORS"
+        break
+    fi
+done
+if [ -z "$BLOCK_SECTORS" ]; then
+    echo "$0: no GET_BLOCK_SIZE value found under $1, flash-image-builder will need -b" >&2
+fi
+if ! grep -q '^#define[[:space:]]*_USE_EXPAND[[:space:]]*1' "$FATFS/ffconf.h" 2>/dev/null; then
+    echo "FatFs has no _USE_EXPAND: files are written in order but not forced contiguous"
+fi
+
+mkdir -p "$BUILD"
+OBJECTS=""
+for source in "$FF" $UNICODE; do
+    object="$BUILD/$(basename "$source").o"
+    case "$source" in
+        *.c) $CC -O2 -I"$FATFS" $CFLAGS -c "$source" -o "$object" ;;
+        *) $CXX -O2 -I"$FATFS" $CXXFLAGS -c "$source" -o "$object" ;;
+    esac
+    OBJECTS="$OBJECTS $object"
+done
+
+$CXX -std=c++11 -O2 -Wall -I. -I"$FATFS" $CXXFLAGS -o "$OUTPUT" tools/flash-image-builder/flash-image-builder.cpp FlashCRC32.cpp $OBJECTS
@@ -0,0 +1,855 @@
+/*
+flash-image-builder - builds a ready-to-flash image of the QSPI chip on a Linux host
+
+The volume is made by the FatFs calls QSPIFlashMemory::format() makes (f_fdisk() with one
+partition over 100% of the chip, then f_mkfs(FM_ANY)), run against a chip image in memory, and
+then filled from a host directory with f_mkdir(), f_open() and f_write(). FatFs is compiled from
+the sources bundled with Adafruit_SPIFlash, so the partition table, boot sector, FAT and
+directory entries are the ones the device writes. Where FatFs is built with _USE_EXPAND, f_expand()
+gives each file one contiguous run of clusters. The stock R0.12 configuration has it off, files
+are then written one after the other on the fresh volume and placed wherever FatFs allocates,
+which is not guaranteed to be contiguous (the summary line says which applied). Settings given
+with -k/-K are written as FlashKeyValueStore records to /.config/kv.log, so begin() on the device
+finds them.
+
+The result is written either as a raw chip image (for a programmer, or programPages() from
+another source) or as an exportImage() stream that importImage() on the device can apply
+directly, e.g. with examples/image-transfer. Either way the unit needs no format() run.
+
+Build from the library root, giving the Adafruit_SPIFlash library directory:
+    sh tools/flash-image-builder/build.sh ~/Arduino/libraries/Adafruit_SPIFlash
+build.sh takes the -b default from the GET_BLOCK_SIZE answer in that library's diskio layer. When
+it cannot find one there is no default and -b must be given.
+
+Usage:
+    flash-image-builder [options] <source directory> <output file>
+    -s <bytes>          Chip size (default 2097152, the 2MB chips on Adafruit SAMD51 boards)
+    -b <sectors>        Erase block size in 512 byte sectors given to f_mkfs() (default: what the
+                        Adafruit_SPIFlash diskio layer reports for GET_BLOCK_SIZE, see build.sh)
+    -k <key>=<value>    Add a setting to the key-value store (repeatable, applied in order)
+    -K <file>           Add the settings in a file of key=value lines
+    -f raw|stream       Output a raw chip image (default) or an exportImage() stream
+    -v                  List the files as they are placed
+
+Names that are not plain 8.3 names need long file names, so they are rejected when FatFs is built
+without _USE_LFN. Unless it is built with _LFN_UNICODE, names must also fit its code page
+(_CODE_PAGE). Files are read in sorted order, symbolic links are followed and anything that is
+neither a file nor a directory is skipped.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "ff.h"
+#include "diskio.h"
+#include "QSPI_Flash_Config.h"
+#include "FlashCRC32.h"
+#include "FlashImageFormat.h"
+#include "FlashKeyValueRecord.h"
+
+#ifndef _USE_LFN
+#error "Build against the FatFs R0.12 sources bundled with Adafruit_SPIFlash, see build.sh"
+#endif
+#if !_MULTI_PARTITION
+#error "format() partitions with f_fdisk(), which FatFs only has with _MULTI_PARTITION"
+#endif
+
+// FatFs sector size used by the Adafruit_SPIFlash diskio layer
+#define IMAGE_FAT_SECTOR_SIZE 512
+// Erase block the Adafruit_SPIFlash diskio layer reports to f_mkfs(), which aligns the data area
+// to it. build.sh reads it from the library source, 0 = unknown, -b is then required
+#ifndef IMAGE_DEFAULT_BLOCK_SECTORS
+#define IMAGE_DEFAULT_BLOCK_SECTORS 0
+#endif
+#define IMAGE_COPY_CHUNK 4096
+// f_expand() is only there with _USE_EXPAND, which the stock R0.12 ffconf.h leaves at 0
+#if defined(_USE_EXPAND) && _USE_EXPAND
+#define IMAGE_EXPAND 1
+#else
+#define IMAGE_EXPAND 0
+#endif
+
+// A name or path as FatFs takes it
+typedef std::basic_string<TCHAR> VolumePath;
+
+/*
+One file or directory to place on the volume
+*/
+struct ImageNode {
+    std::string name;
+    std::string hostPath;           // empty when content holds the data
+    std::vector<uint8_t> content;
+    bool directory;
+    uint32_t size;
+    time_t modified;
+    std::vector<ImageNode> children;
+    VolumePath volumeName;
+};
+
+static bool verbose = false;
+
+// The chip image FatFs works on through the diskio functions below
+static std::vector<uint8_t> diskImage;
+static DWORD diskBlockSectors = IMAGE_DEFAULT_BLOCK_SECTORS;
+// What get_fattime() returns, set to the host time of each entry before FatFs creates it
+static DWORD currentTimestamp;
+// "" as a TCHAR string, _T() gives wchar_t strings which don't match a 16 bit TCHAR on Linux
+static const TCHAR rootPath[] = { 0 };
+
+// Volume 0 is the first partition, as on the device
+PARTITION VolToPart[_VOLUMES] = { { 0, 1 } };
+
+/*
+FatFs diskio layer over diskImage (drive 0 only)
+*/
+DSTATUS disk_initialize(BYTE pdrv) {
+    return (pdrv == 0) ? 0 : STA_NOINIT;
+}
+
+DSTATUS disk_status(BYTE pdrv) {
+    return (pdrv == 0) ? 0 : STA_NOINIT;
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
+    if (pdrv != 0 || ((uint64_t) sector + count) * IMAGE_FAT_SECTOR_SIZE > diskImage.size()) {
+        return RES_PARERR;
+    }
+    memcpy(buff, &diskImage[sector * IMAGE_FAT_SECTOR_SIZE], count * IMAGE_FAT_SECTOR_SIZE);
+    return RES_OK;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count) {
+    if (pdrv != 0 || ((uint64_t) sector + count) * IMAGE_FAT_SECTOR_SIZE > diskImage.size()) {
+        return RES_PARERR;
+    }
+    memcpy(&diskImage[sector * IMAGE_FAT_SECTOR_SIZE], buff, count * IMAGE_FAT_SECTOR_SIZE);
+    return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff) {
+    if (pdrv != 0) {
+        return RES_PARERR;
+    }
+    switch (cmd) {
+        case CTRL_SYNC:
+            return RES_OK;
+        case GET_SECTOR_COUNT:
+            *(DWORD *) buff = diskImage.size() / IMAGE_FAT_SECTOR_SIZE;
+            return RES_OK;
+        case GET_SECTOR_SIZE:
+            *(WORD *) buff = IMAGE_FAT_SECTOR_SIZE;
+            return RES_OK;
+        case GET_BLOCK_SIZE:
+            *(DWORD *) buff = diskBlockSectors;
+            return RES_OK;
+        default:
+            return RES_PARERR;
+    }
+}
+
+#if !_FS_NORTC
+DWORD get_fattime(void) {
+    return currentTimestamp;
+}
+#endif
+
+#if _USE_LFN == 3
+void *ff_memalloc(UINT msize) {
+    return malloc(msize);
+}
+
+void ff_memfree(void *mblock) {
+    free(mblock);
+}
+#endif
+
+#if _FS_REENTRANT
+// Single threaded, nothing ever waits on the sync object
+int ff_cre_syncobj(BYTE vol, _SYNC_t *sobj) {
+    return 1;
+}
+
+int ff_req_grant(_SYNC_t sobj) {
+    return 1;
+}
+
+void ff_rel_grant(_SYNC_t sobj) {
+}
+
+int ff_del_syncobj(_SYNC_t sobj) {
+    return 1;
+}
+#endif
+
+/*
+Method: fatTimestamp()
+Description: Pack a host time into FAT date (high 16 bits) and time (low 16 bits)
+Input:
+    time_t value: Host time, converted as local time like a device clock would be set
+Output: uint32_t packed date and time
+*/
+static uint32_t fatTimestamp(time_t value) {
+    struct tm *local = localtime(&value);
+    if (local == NULL || local->tm_year < 80) {
+        return (1 << 21) | (1 << 16);      // 1980-01-01 00:00:00
+    }
+    return ((uint32_t) (local->tm_year - 80) << 25) | ((uint32_t) (local->tm_mon + 1) << 21)
+         | ((uint32_t) local->tm_mday << 16) | ((uint32_t) local->tm_hour << 11)
+         | ((uint32_t) local->tm_min << 5) | ((uint32_t) local->tm_sec / 2);
+}
+
+/*
+Method: decodeName()
+Description: Convert a UTF-8 name to the UTF-16 code units of a long file name
+Input:
+    const std::string &name: UTF-8 name
+    std::vector<uint16_t> &units: Set to the code units
+Output:
+     0: success
+    -1: invalid UTF-8, a character outside the BMP or longer than 255 characters
+*/
+static int decodeName(const std::string &name, std::vector<uint16_t> &units) {
+    units.clear();
+    for (size_t i = 0 ; i < name.size() ; ) {
+        uint8_t c = name[i];
+        uint32_t codePoint;
+        size_t extra;
+        if (c < 0x80) {
+            codePoint = c;
+            extra = 0;
+        } else if ((c & 0xE0) == 0xC0) {
+            codePoint = c & 0x1F;
+            extra = 1;
+        } else if ((c & 0xF0) == 0xE0) {
+            codePoint = c & 0x0F;
+            extra = 2;
+        } else {
+            return -1;
+        }
+        for (size_t k = 1 ; k <= extra ; k++) {
+            if (i + k >= name.size() || (name[i + k] & 0xC0) != 0x80) {
+                return -1;
+            }
+            codePoint = (codePoint << 6) | (name[i + k] & 0x3F);
+        }
+        units.push_back((uint16_t) codePoint);
+        i += extra + 1;
+    }
+    return (units.empty() || units.size() > 255) ? -1 : 0;
+}
+
+static bool isNameCharacter(unsigned char c) {
+    return c >= 0x20 && strchr("\"*/:<>?\\|", c) == NULL;
+}
+
+#if !_USE_LFN
+static bool isShortNameCharacter(char c) {
+    return (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || (c != 0 && strchr("!#$%&'()-@^_`{}~", c) != NULL);
+}
+
+/*
+Method: isShortName()
+Description: Check if a name fits an 8.3 entry. FatFs without long file names stores it upper case
+Input:
+    const std::string &name: Name to check
+Output:
+    true: name fits an 8.3 entry
+    false: a long file name would be needed
+*/
+static bool isShortName(const std::string &name) {
+    size_t dot = name.find('.');
+    if (dot == 0 || name.find('.', dot + 1) != std::string::npos) {
+        return false;
+    }
+    std::string base = (dot == std::string::npos) ? name : name.substr(0, dot);
+    std::string extension = (dot == std::string::npos) ? "" : name.substr(dot + 1);
+    if (base.empty() || base.size() > 8 || extension.size() > 3 || (dot != std::string::npos && extension.empty())) {
+        return false;
+    }
+    for (size_t i = 0 ; i < name.size() ; i++) {
+        if (i != dot && !isShortNameCharacter(toupper((unsigned char) name[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+/*
+Method: volumeName()
+Description: Convert a UTF-8 host name to the name FatFs is given for it, checking FatFs can store
+             it. Without _USE_LFN only 8.3 names exist, without _LFN_UNICODE names are in the
+             code page FatFs is built for
+Input:
+    const std::string &name: UTF-8 name
+    VolumePath &converted: Set to the FatFs name
+Output:
+     0: success
+    -1: name not allowed on FAT
+    -2: name needs a long file name and FatFs is built without _USE_LFN
+    -3: name has a character outside the FatFs code page
+*/
+static int volumeName(const std::string &name, VolumePath &converted) {
+    std::vector<uint16_t> units;
+    if (decodeName(name, units) != 0 || name.find_last_not_of(". ") == std::string::npos) {
+        return -1;
+    }
+    for (size_t i = 0 ; i < name.size() ; i++) {
+        if (!isNameCharacter(name[i])) {
+            return -1;
+        }
+    }
+    converted.clear();
+#if _USE_LFN
+    if (units.size() > _MAX_LFN) {
+        return -1;
+    }
+    for (size_t i = 0 ; i < units.size() ; i++) {
+#if _LFN_UNICODE
+        converted += (TCHAR) units[i];
+#else
+        WCHAR code = (units[i] < 0x80) ? units[i] : ff_convert(units[i], 0);
+        if (code == 0) {
+            return -3;
+        }
+        if (code > 0xFF) {
+            // Double byte code page
+            converted += (TCHAR) (code >> 8);
+        }
+        converted += (TCHAR) (code & 0xFF);
+#endif
+    }
+#else
+    if (!isShortName(name)) {
+        return -2;
+    }
+    converted.assign(name.begin(), name.end());
+#endif
+    return 0;
+}
+
+/*
+Method: convertNames()
+Description: Set the FatFs name of every entry of a directory tree
+Input:
+    ImageNode &directory: Directory to name the children of (recursively)
+Output:
+     0: success
+    -1: a name FatFs cannot store, or names differing only in case (already reported)
+*/
+static int convertNames(ImageNode &directory) {
+    std::vector<std::string> folded;
+    for (size_t i = 0 ; i < directory.children.size() ; i++) {
+        ImageNode &child = directory.children[i];
+        const char *shown = child.hostPath.empty() ? child.name.c_str() : child.hostPath.c_str();
+        int result = volumeName(child.name, child.volumeName);
+        if (result == -2) {
+            fprintf(stderr, "Error, %s is not an 8.3 name and FatFs is built without _USE_LFN\n", shown);
+            return -1;
+        }
+        if (result == -3) {
+            fprintf(stderr, "Error, %s has characters outside the FatFs code page (_CODE_PAGE %d)\n", shown, _CODE_PAGE);
+            return -1;
+        }
+        if (result != 0) {
+            fprintf(stderr, "Error, name not allowed on FAT: %s\n", shown);
+            return -1;
+        }
+        // FAT names are case insensitive
+        std::string key = child.name;
+        std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+        if (std::find(folded.begin(), folded.end(), key) != folded.end()) {
+            fprintf(stderr, "Error, names differ only in case: %s in %s\n", child.name.c_str(), directory.name.c_str());
+            return -1;
+        }
+        folded.push_back(key);
+        if (child.directory && convertNames(child) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static bool compareNodes(const ImageNode &a, const ImageNode &b) {
+    return a.name < b.name;
+}
+
+/*
+Method: scanDirectory()
+Description: Read a host directory tree into nodes (file contents are read later, when placed)
+Input:
+    const std::string &hostPath: Directory to read
+    ImageNode &directory: Node to add the children to
+Output:
+     0: success
+    -1: directory could not be read
+*/
+static int scanDirectory(const std::string &hostPath, ImageNode &directory) {
+    DIR *handle = opendir(hostPath.c_str());
+    if (handle == NULL) {
+        fprintf(stderr, "Error, cannot open directory %s\n", hostPath.c_str());
+        return -1;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(handle)) != NULL) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        ImageNode child = ImageNode();
+        child.name = name;
+        child.hostPath = hostPath + "/" + name;
+        struct stat info;
+        if (stat(child.hostPath.c_str(), &info) != 0) {
+            fprintf(stderr, "Warning, skipping %s (cannot stat)\n", child.hostPath.c_str());
+            continue;
+        }
+        child.modified = info.st_mtime;
+        if (S_ISDIR(info.st_mode)) {
+            child.directory = true;
+            if (scanDirectory(child.hostPath, child) != 0) {
+                closedir(handle);
+                return -1;
+            }
+        } else if (S_ISREG(info.st_mode)) {
+            if ((uint64_t) info.st_size > 0xFFFFFFFFULL) {
+                fprintf(stderr, "Error, %s is too large for FAT\n", child.hostPath.c_str());
+                closedir(handle);
+                return -1;
+            }
+            child.size = info.st_size;
+        } else {
+            fprintf(stderr, "Warning, skipping %s (not a file or directory)\n", child.hostPath.c_str());
+            continue;
+        }
+        directory.children.push_back(child);
+    }
+    closedir(handle);
+    std::sort(directory.children.begin(), directory.children.end(), compareNodes);
+    return 0;
+}
+
+/*
+Method: findOrAddChild()
+Description: Get a child by name, adding a generated one if it doesn't exist
+Input:
+    ImageNode &directory: Parent
+    const std::string &name: Child name
+    bool isDirectory: Kind of node to add
+Output: ImageNode * child, NULL if a node of the other kind has that name
+*/
+static ImageNode *findOrAddChild(ImageNode &directory, const std::string &name, bool isDirectory) {
+    for (size_t i = 0 ; i < directory.children.size() ; i++) {
+        if (directory.children[i].name == name) {
+            return (directory.children[i].directory == isDirectory) ? &directory.children[i] : NULL;
+        }
+    }
+    ImageNode child = ImageNode();
+    child.name = name;
+    child.directory = isDirectory;
+    child.modified = time(NULL);
+    directory.children.push_back(child);
+    std::sort(directory.children.begin(), directory.children.end(), compareNodes);
+    for (size_t i = 0 ; i < directory.children.size() ; i++) {
+        if (directory.children[i].name == name) {
+            return &directory.children[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+Method: addSettings()
+Description: Append key-value store records for the given settings to the log file, after any
+             log already in the source directory
+Input:
+    ImageNode &root: Root of the tree
+    const std::vector<std::string> &settings: key=value strings
+Output:
+     0: success
+    -1: bad setting or the log path is taken by something else
+*/
+static int addSettings(ImageNode &root, const std::vector<std::string> &settings) {
+    if (settings.empty()) {
+        return 0;
+    }
+    ImageNode *directory = &root;
+    std::string path = QSPI_FLASH_KV_DEFAULT_DIRECTORY;
+    size_t start = 0;
+    while (directory != NULL && start < path.size()) {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+        if (end > start) {
+            directory = findOrAddChild(*directory, path.substr(start, end - start), true);
+        }
+        start = end + 1;
+    }
+    ImageNode *log = (directory != NULL) ? findOrAddChild(*directory, QSPI_FLASH_KV_DEFAULT_FILENAME, false) : NULL;
+    if (log == NULL) {
+        fprintf(stderr, "Error, %s/%s is not a file\n", QSPI_FLASH_KV_DEFAULT_DIRECTORY, QSPI_FLASH_KV_DEFAULT_FILENAME);
+        return -1;
+    }
+    if (!log->hostPath.empty()) {
+        FILE *existing = fopen(log->hostPath.c_str(), "rb");
+        if (existing == NULL) {
+            fprintf(stderr, "Error, cannot read %s\n", log->hostPath.c_str());
+            return -1;
+        }
+        log->content.resize(log->size);
+        size_t readCount = fread(log->content.data(), 1, log->size, existing);
+        fclose(existing);
+        if (readCount != log->size) {
+            fprintf(stderr, "Error, cannot read %s\n", log->hostPath.c_str());
+            return -1;
+        }
+        if (log->size % QSPI_FLASH_KV_RECORD_SIZE != 0) {
+            fprintf(stderr, "Warning, %s is not a whole number of records\n", log->hostPath.c_str());
+        }
+        log->hostPath.clear();
+    }
+
+    uint8_t record[QSPI_FLASH_KV_RECORD_SIZE];
+    for (size_t i = 0 ; i < settings.size() ; i++) {
+        size_t equals = settings[i].find('=');
+        if (equals == std::string::npos || equals == 0 || equals > 255 || settings[i].size() - equals - 1 > 255) {
+            fprintf(stderr, "Error, setting must be key=value: %s\n", settings[i].c_str());
+            return -1;
+        }
+        std::string key = settings[i].substr(0, equals);
+        std::string value = settings[i].substr(equals + 1);
+        if (flashKVEncodeRecord(record, key.data(), key.size(), (const uint8_t *) value.data(), value.size(), 0) != 0) {
+            fprintf(stderr, "Error, key and value longer than %d bytes: %s\n", QSPI_FLASH_KV_DATA_SIZE, settings[i].c_str());
+            return -1;
+        }
+        log->content.insert(log->content.end(), record, record + QSPI_FLASH_KV_RECORD_SIZE);
+    }
+    log->size = log->content.size();
+    if (log->size > QSPI_FLASH_KV_MAX_LOG_SIZE) {
+        fprintf(stderr, "Warning, key-value log is %u bytes, the first put() will compact it\n", (unsigned) log->size);
+    }
+    return 0;
+}
+
+/*
+Method: readSettingsFile()
+Description: Read key=value lines, skipping blank lines and lines starting with #
+Input:
+    const char path[]: File to read
+    std::vector<std::string> &settings: Lines are appended here
+Output:
+     0: success
+    -1: file could not be read
+*/
+static int readSettingsFile(const char path[], std::vector<std::string> &settings) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Error, cannot open %s\n", path);
+        return -1;
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        size_t length = strlen(line);
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            line[--length] = 0;
+        }
+        if (length > 0 && line[0] != '#') {
+            settings.push_back(line);
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+/*
+Method: reportResult()
+Description: Print why FatFs could not create an entry
+Input:
+    FRESULT result: FatFs result
+    const std::string &listedPath: Path of the entry, UTF-8
+Output: N/A
+*/
+static void reportResult(FRESULT result, const std::string &listedPath) {
+    if (result == FR_DENIED) {
+        fprintf(stderr, "Error, no room for %s (volume or root directory full)\n", listedPath.c_str());
+    } else if (result == FR_EXIST) {
+        fprintf(stderr, "Error, %s clashes with another name in its directory\n", listedPath.c_str());
+    } else {
+        fprintf(stderr, "Error, FatFs error %d creating %s\n", (int) result, listedPath.c_str());
+    }
+}
+
+/*
+Method: writeFile()
+Description: Create a file on the volume and copy its contents in, reserving one contiguous run of
+             clusters first where FatFs has f_expand() (_USE_EXPAND)
+Input:
+    const ImageNode &node: File
+    const VolumePath &path: Path on the volume
+    const std::string &listedPath: Same path, UTF-8
+Output:
+     0: success
+    -1: FatFs error, or the host file could not be read or shrank while building (already reported)
+*/
+static int writeFile(const ImageNode &node, const VolumePath &path, const std::string &listedPath) {
+    FILE *source = NULL;
+    if (!node.hostPath.empty() && node.size > 0) {
+        source = fopen(node.hostPath.c_str(), "rb");
+        if (source == NULL) {
+            fprintf(stderr, "Error, cannot read %s\n", node.hostPath.c_str());
+            return -1;
+        }
+    }
+    FIL file;
+    FRESULT result = f_open(&file, path.c_str(), FA_WRITE | FA_CREATE_NEW);
+    if (result != FR_OK) {
+        if (source != NULL) {
+            fclose(source);
+        }
+        reportResult(result, listedPath);
+        return -1;
+    }
+#if IMAGE_EXPAND
+    if (node.size > 0) {
+        result = f_expand(&file, node.size, 1);
+    }
+#endif
+    bool readFailed = false;
+    uint8_t buffer[IMAGE_COPY_CHUNK];
+    for (uint32_t offset = 0 ; result == FR_OK && offset < node.size ; ) {
+        UINT chunk = std::min((uint32_t) IMAGE_COPY_CHUNK, node.size - offset);
+        const uint8_t *data = (source == NULL) ? &node.content[offset] : buffer;
+        if (source != NULL && fread(buffer, 1, chunk, source) != chunk) {
+            readFailed = true;
+            break;
+        }
+        UINT written = 0;
+        result = f_write(&file, data, chunk, &written);
+        if (result == FR_OK && written != chunk) {
+            // f_write() stops short when the volume is full
+            result = FR_DENIED;
+        }
+        offset += chunk;
+    }
+    FRESULT closeResult = f_close(&file);
+    if (source != NULL) {
+        fclose(source);
+    }
+    if (readFailed) {
+        fprintf(stderr, "Error, cannot read %s\n", node.hostPath.c_str());
+        return -1;
+    }
+    if (result == FR_OK) {
+        result = closeResult;
+    }
+    if (result != FR_OK) {
+        reportResult(result, listedPath);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+Method: writeTree()
+Description: Create the children of a directory on the volume: subdirectories first, then files,
+             then the contents of each subdirectory
+Input:
+    const ImageNode &directory: Directory whose children are written
+    const VolumePath &volumePath: Path of the directory on the volume, empty for the root
+    const std::string &listedPath: Same path, UTF-8
+Output:
+     0: success
+    -1: FatFs error or a file could not be read (already reported)
+*/
+static int writeTree(const ImageNode &directory, const VolumePath &volumePath, const std::string &listedPath) {
+    for (size_t pass = 0 ; pass < 2 ; pass++) {
+        for (size_t i = 0 ; i < directory.children.size() ; i++) {
+            const ImageNode &child = directory.children[i];
+            if (child.directory != (pass == 0)) {
+                continue;
+            }
+            VolumePath path = volumePath + (TCHAR) '/' + child.volumeName;
+            std::string listed = listedPath + "/" + child.name;
+            // Entries carry the host modification time
+            currentTimestamp = fatTimestamp(child.modified);
+            if (child.directory) {
+                FRESULT result = f_mkdir(path.c_str());
+                if (result != FR_OK) {
+                    reportResult(result, listed);
+                    return -1;
+                }
+                if (verbose) { printf("  %-40s  directory\n", (listed + "/").c_str()); }
+            } else {
+                if (writeFile(child, path, listed) != 0) {
+                    return -1;
+                }
+                if (verbose) { printf("  %-40s %10u\n", listed.c_str(), (unsigned) child.size); }
+            }
+        }
+    }
+    for (size_t i = 0 ; i < directory.children.size() ; i++) {
+        const ImageNode &child = directory.children[i];
+        if (child.directory && writeTree(child, volumePath + (TCHAR) '/' + child.volumeName, listedPath + "/" + child.name) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+Method: writeStream()
+Description: Write the image in the exportImage() stream format, blank sectors as ERASED frames
+Input:
+    FILE *output: Destination
+    const std::vector<uint8_t> &image: Chip image
+Output:
+     0: success
+    -1: write error
+*/
+static int writeStream(FILE *output, const std::vector<uint8_t> &image) {
+    uint32_t sectorCount = image.size() / QSPI_FLASH_SECTOR_SIZE;
+    uint8_t header[QSPI_FLASH_IMAGE_HEADER_SIZE];
+    uint8_t frame[QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE + 4];
+    flashImageEncodeHeader(header, QSPI_FLASH_SECTOR_SIZE, sectorCount, 0);
+    if (fwrite(header, 1, sizeof(header), output) != sizeof(header)) {
+        return -1;
+    }
+    for (uint32_t sector = 0 ; sector < sectorCount ; sector++) {
+        const uint8_t *data = &image[sector * QSPI_FLASH_SECTOR_SIZE];
+        bool erased = flashImageIsErased(data, QSPI_FLASH_SECTOR_SIZE);
+        flashImageEncodeFrameHeader(frame, erased ? QSPI_FLASH_IMAGE_FRAME_ERASED : QSPI_FLASH_IMAGE_FRAME_DATA, sector);
+        uint32_t crc = erased ? 0 : flashCRC32(data, QSPI_FLASH_SECTOR_SIZE);
+        flashImagePut32(&frame[QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE], flashImageFrameCRC(frame, crc));
+        if (fwrite(frame, 1, QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE, output) != QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE
+            || (!erased && fwrite(data, 1, QSPI_FLASH_SECTOR_SIZE, output) != QSPI_FLASH_SECTOR_SIZE)
+            || fwrite(&frame[QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE], 1, 4, output) != 4) {
+            return -1;
+        }
+    }
+    flashImageEncodeFrameHeader(frame, QSPI_FLASH_IMAGE_FRAME_END, sectorCount);
+    flashImagePut32(&frame[QSPI_FLASH_IMAGE_FRAME_HEADER_SIZE], flashImageFrameCRC(frame, 0));
+    return (fwrite(frame, 1, sizeof(frame), output) == sizeof(frame)) ? 0 : -1;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: flash-image-builder [-s bytes] [-b sectors] [-k key=value]... [-K file] [-f raw|stream] [-v] <source directory> <output file>\n");
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t chipBytes = 2 * 1024 * 1024;
+    bool stream = false;
+    std::vector<std::string> settings;
+    std::vector<const char *> positional;
+
+    for (int i = 1 ; i < argc ; i++) {
+        std::string option = argv[i];
+        if ((option == "-s" || option == "-b" || option == "-k" || option == "-K" || option == "-f") && i + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        if (option == "-s") {
+            chipBytes = strtoul(argv[++i], NULL, 0);
+        } else if (option == "-b") {
+            diskBlockSectors = strtoul(argv[++i], NULL, 0);
+        } else if (option == "-k") {
+            settings.push_back(argv[++i]);
+        } else if (option == "-K") {
+            if (readSettingsFile(argv[++i], settings) != 0) {
+                return 1;
+            }
+        } else if (option == "-f") {
+            std::string format = argv[++i];
+            if (format != "raw" && format != "stream") {
+                usage();
+                return 2;
+            }
+            stream = (format == "stream");
+        } else if (option == "-v") {
+            verbose = true;
+        } else if (option.size() > 1 && option[0] == '-') {
+            usage();
+            return 2;
+        } else {
+            positional.push_back(argv[i]);
+        }
+    }
+    if (positional.size() != 2) {
+        usage();
+        return 2;
+    }
+    if (chipBytes == 0 || chipBytes % QSPI_FLASH_SECTOR_SIZE != 0) {
+        fprintf(stderr, "Error, chip size must be a multiple of %d\n", QSPI_FLASH_SECTOR_SIZE);
+        return 1;
+    }
+    if (diskBlockSectors == 0) {
+        fprintf(stderr, "Error, the erase block size of the Adafruit_SPIFlash diskio layer wasn't found when building, give it with -b\n");
+        return 1;
+    }
+    if (diskBlockSectors > 32768 || (diskBlockSectors & (diskBlockSectors - 1)) != 0) {
+        fprintf(stderr, "Error, erase block size must be a power of 2 from 1 to 32768 sectors\n");
+        return 1;
+    }
+
+    ImageNode root = ImageNode();
+    root.directory = true;
+    root.name = "/";
+    if (scanDirectory(positional[0], root) != 0 || addSettings(root, settings) != 0 || convertNames(root) != 0) {
+        return 1;
+    }
+
+    // Format as format() does, on an erased chip
+    diskImage.assign(chipBytes, 0xFF);
+    currentTimestamp = fatTimestamp(time(NULL));
+    static BYTE work[QSPI_FLASH_FORMAT_BUFFER_SIZE];
+    DWORD plist[] = { 100, 0, 0, 0 };
+    FATFS fatfs;
+    FRESULT result = f_fdisk(0, plist, work);
+    if (result == FR_OK) {
+        result = f_mkfs(rootPath, FM_ANY, 0, work, QSPI_FLASH_FORMAT_BUFFER_SIZE);
+    }
+    if (result == FR_OK) {
+        result = f_mount(&fatfs, rootPath, 1);
+    }
+    if (result != FR_OK) {
+        fprintf(stderr, "Error, formatting a %u byte chip failed with FatFs error %d\n", (unsigned) chipBytes, (int) result);
+        return 1;
+    }
+    if (writeTree(root, VolumePath(), "") != 0) {
+        return 1;
+    }
+    DWORD freeClusters = 0;
+    FATFS *volume = NULL;
+    if (f_getfree(rootPath, &freeClusters, &volume) != FR_OK) {
+        freeClusters = 0;
+    }
+    uint32_t clusterCount = fatfs.n_fatent - 2;
+    uint32_t clusterBytes = fatfs.csize * IMAGE_FAT_SECTOR_SIZE;
+    const char *fatType = (fatfs.fs_type == FS_FAT12) ? "FAT12" : (fatfs.fs_type == FS_FAT16) ? "FAT16" : (fatfs.fs_type == FS_FAT32) ? "FAT32" : "exFAT";
+    f_mount(NULL, rootPath, 0);
+
+    FILE *output = fopen(positional[1], "wb");
+    if (output == NULL) {
+        fprintf(stderr, "Error, cannot create %s\n", positional[1]);
+        return 1;
+    }
+    int written = stream ? writeStream(output, diskImage) : (fwrite(diskImage.data(), 1, diskImage.size(), output) == diskImage.size() ? 0 : -1);
+    if (fclose(output) != 0 || written != 0) {
+        fprintf(stderr, "Error, failed writing %s\n", positional[1]);
+        return 1;
+    }
+
+    printf("%s volume: %u clusters of %u bytes, %u used (%u%%), %u settings, files %s\n",
+           fatType, (unsigned) clusterCount, (unsigned) clusterBytes, (unsigned) (clusterCount - freeClusters),
+           (unsigned) ((clusterCount - freeClusters) * 100ULL / clusterCount), (unsigned) settings.size(),
+           IMAGE_EXPAND ? "contiguous (f_expand)" : "placed by FatFs, not forced contiguous (_USE_EXPAND 0)");
+    return 0;
+}
@@ -0,0 +1 @@
+// Host build: nothing to declare, see tools/host/Arduino.h
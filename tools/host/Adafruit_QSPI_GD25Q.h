@@ -0,0 +1,37 @@
+#ifndef   _HOST_ADAFRUIT_QSPI_GD25Q_H
+#define   _HOST_ADAFRUIT_QSPI_GD25Q_H
+
+#include <Adafruit_SPIFlash.h>
+
+#define HOST_FLASH_PAGE_SIZE    256
+#define HOST_FLASH_PAGE_COUNT   8192
+#define HOST_FLASH_SIZE         ((uint32_t) HOST_FLASH_PAGE_SIZE * HOST_FLASH_PAGE_COUNT)
+
+/*
+Class: Adafruit_QSPI_GD25Q (host build)
+Description: 2MB GD25Q16 held in RAM. Programming only clears bits and erases set them,
+             as on the chip, so a program without an erase first shows up in the contents
+*/
+class Adafruit_QSPI_GD25Q : public Adafruit_SPIFlash_Base {
+
+    public:
+        bool begin();
+        void GetManufacturerInfo(uint8_t *manufID, uint8_t *deviceID);
+        uint32_t GetJEDECID();
+        bool eraseSector(uint32_t sectorNumber);
+        bool eraseBlock(uint32_t blockNumber);
+        bool eraseChip();
+        bool readMemory(uint32_t addr, uint8_t *data, uint32_t size);
+        bool writeMemory(uint32_t addr, uint8_t *data, uint32_t size);
+        bool setFlashType(spiflash_type_t t);
+        uint32_t readBuffer(uint32_t address, uint8_t *buffer, uint32_t len);
+        uint32_t writeBuffer(uint32_t address, uint8_t *buffer, uint32_t len);
+        uint32_t getAddr();
+        uint16_t numPages();
+        uint16_t pageSize();
+};
+
+// Contents of the simulated chip, for tests to inspect or corrupt directly
+uint8_t *hostFlashMemory();
+
+#endif // _HOST_ADAFRUIT_QSPI_GD25Q_H
@@ -0,0 +1,19 @@
+#ifndef   _HOST_ADAFRUIT_SPIFLASH_H
+#define   _HOST_ADAFRUIT_SPIFLASH_H
+
+#include <Arduino.h>
+
+typedef enum {
+    SPIFLASHTYPE_W25Q16BV,
+    SPIFLASHTYPE_25C02,
+    SPIFLASHTYPE_W25X40CL,
+    SPIFLASHTYPE_AT25SF041,
+} spiflash_type_t;
+
+class Adafruit_SPIFlash_Base {
+
+    public:
+        virtual ~Adafruit_SPIFlash_Base() {}
+};
+
+#endif // _HOST_ADAFRUIT_SPIFLASH_H
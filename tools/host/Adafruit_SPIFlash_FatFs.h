@@ -0,0 +1,133 @@
+#ifndef   _HOST_ADAFRUIT_SPIFLASH_FATFS_H
+#define   _HOST_ADAFRUIT_SPIFLASH_FATFS_H
+
+/*
+Host build of the Adafruit_SPIFlash FatFs wrapper: the same File/filesystem API over an
+in-memory directory tree. The raw FatFs calls the library makes (f_fdisk, f_mkfs, f_rename,
+disk_read, disk_write) are provided too. disk_read/disk_write address the simulated chip,
+the directory tree is not stored on it. Until f_mkfs() runs, begin() reads the tree from a FAT
+volume already written to the chip (e.g. by importImage()) if there is one.
+
+Every call checks that no other thread is inside the filesystem at the same time, which is
+what the library's volume lock has to guarantee on the real (non-reentrant) FatFs.
+See hostFileSystemViolations()
+*/
+
+#include <Arduino.h>
+#include <Adafruit_SPIFlash.h>
+
+typedef unsigned int UINT;
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef char TCHAR;
+
+typedef enum {
+    FR_OK = 0,
+    FR_DISK_ERR,
+    FR_INT_ERR,
+    FR_NOT_READY,
+    FR_NO_FILE,
+    FR_NO_PATH,
+    FR_INVALID_NAME,
+    FR_DENIED,
+    FR_EXIST,
+    FR_INVALID_OBJECT,
+    FR_WRITE_PROTECTED,
+    FR_INVALID_DRIVE,
+    FR_NOT_ENABLED,
+    FR_NO_FILESYSTEM,
+    FR_MKFS_ABORTED,
+    FR_TIMEOUT,
+    FR_LOCKED,
+    FR_NOT_ENOUGH_CORE,
+    FR_TOO_MANY_OPEN_FILES,
+    FR_INVALID_PARAMETER
+} FRESULT;
+
+typedef enum {
+    RES_OK = 0,
+    RES_ERROR,
+    RES_WRPRT,
+    RES_NOTRDY,
+    RES_PARERR
+} DRESULT;
+
+#define FM_FAT      0x01
+#define FM_FAT32    0x02
+#define FM_EXFAT    0x04
+#define FM_ANY      0x07
+#define FM_SFD      0x08
+
+#define _USE_LFN    1
+#define _MAX_LFN    255
+
+FRESULT f_fdisk(BYTE pdrv, const DWORD *szt, void *work);
+FRESULT f_mkfs(const TCHAR *path, BYTE opt, DWORD au, void *work, UINT len);
+FRESULT f_rename(const TCHAR *path_old, const TCHAR *path_new);
+DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count);
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count);
+
+#define FILE_READ   0x01
+#define FILE_WRITE  0x13
+
+struct HostFileState;
+
+class File : public Stream {
+
+    public:
+        File(const char *filepath = NULL, uint8_t mode = FILE_READ);
+        File(const File &other);
+        File &operator=(const File &other);
+        ~File();
+        size_t write(uint8_t c);
+        size_t write(const uint8_t *buf, size_t size);
+        using Print::write;
+        int read();
+        int read(void *buf, uint16_t nbyte);
+        int peek();
+        int available();
+        void flush();
+        bool seek(uint32_t pos);
+        uint32_t position();
+        uint32_t size();
+        void close();
+        operator bool();
+        char *name();
+        bool isDirectory();
+        File openNextFile(uint8_t mode = FILE_READ);
+        void rewindDirectory();
+    private:
+        HostFileState *_state;
+        void release();
+};
+
+class Adafruit_SPIFlash_FatFs {
+
+    public:
+        Adafruit_SPIFlash_FatFs(Adafruit_SPIFlash_Base &flash) {}
+        bool begin();
+        void activate();
+        File open(const char *filepath, uint8_t mode = FILE_READ);
+        bool exists(const char *filepath);
+        bool mkdir(const char *filepath);
+        bool remove(const char *filepath);
+        bool rmdir(const char *filepath);
+};
+
+class Adafruit_W25Q16BV_FatFs : public Adafruit_SPIFlash_FatFs {
+
+    public:
+        Adafruit_W25Q16BV_FatFs(Adafruit_SPIFlash_Base &flash) : Adafruit_SPIFlash_FatFs(flash) {}
+};
+
+// Calls that found another thread already inside the filesystem (missing volume lock)
+unsigned long hostFileSystemViolations();
+// Files and directories opened and not yet closed
+int hostFileSystemOpenFiles();
+// Successful begin() calls, i.e. mounts
+unsigned long hostFileSystemMounts();
+// Drop the directory tree, the volume is unformatted until the next f_mkfs()
+void hostFileSystemReset();
+
+#endif // _HOST_ADAFRUIT_SPIFLASH_FATFS_H
@@ -0,0 +1,141 @@
+#ifndef   _HOST_ARDUINO_H
+#define   _HOST_ARDUINO_H
+
+/*
+Host build of the Arduino core subset used by the library, its examples and tests/host.
+Serial writes to stdout, time comes from std::chrono. See tests/host/run.sh
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#define HEX 16
+#define DEC 10
+
+typedef bool boolean;
+
+unsigned long micros();
+unsigned long millis();
+void delay(unsigned long ms);
+void yield();
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+template<class T, class U> inline T min(T a, U b) { return (b < a) ? b : a; }
+template<class T, class U> inline T max(T a, U b) { return (a < b) ? b : a; }
+
+class String {
+
+    public:
+        String(const char *value = "") : _value(value != NULL ? value : "") {}
+        explicit String(char value) : _value(1, value) {}
+        explicit String(int value, unsigned char base = DEC) { format((long) value, base); }
+        explicit String(unsigned int value, unsigned char base = DEC) { formatUnsigned(value, base); }
+        explicit String(long value, unsigned char base = DEC) { format(value, base); }
+        explicit String(unsigned long value, unsigned char base = DEC) { formatUnsigned(value, base); }
+        const char *c_str() const { return _value.c_str(); }
+        unsigned int length() const { return _value.length(); }
+    private:
+        std::string _value;
+        void format(long value, unsigned char base) {
+            if (value < 0) { _value = "-"; formatUnsigned(0UL - (unsigned long) value, base, true); }
+            else { formatUnsigned((unsigned long) value, base); }
+        }
+        void formatUnsigned(unsigned long value, unsigned char base, bool append = false) {
+            char digits[sizeof(unsigned long) * 8 + 1];
+            int i = sizeof(digits) - 1;
+            digits[i] = 0;
+            do {
+                digits[--i] = "0123456789ABCDEF"[value % base];
+                value /= base;
+            } while (value != 0);
+            _value = append ? _value + &digits[i] : std::string(&digits[i]);
+        }
+};
+
+class Print {
+
+    public:
+        virtual ~Print() {}
+        virtual size_t write(uint8_t c) = 0;
+        virtual size_t write(const uint8_t *buffer, size_t size) {
+            size_t n = 0;
+            while (size-- > 0 && write(*buffer++) == 1) { n++; }
+            return n;
+        }
+        size_t write(const char *str) { return str == NULL ? 0 : write((const uint8_t *) str, strlen(str)); }
+        size_t write(const char *buffer, size_t size) { return write((const uint8_t *) buffer, size); }
+        virtual void flush() {}
+
+        size_t print(const char value[]) { return write(value); }
+        size_t print(char value) { return write((uint8_t) value); }
+        size_t print(const String &value) { return write(value.c_str()); }
+        size_t print(unsigned char value, int base = DEC) { return print((unsigned long) value, base); }
+        size_t print(int value, int base = DEC) { return print((long) value, base); }
+        size_t print(unsigned int value, int base = DEC) { return print((unsigned long) value, base); }
+        size_t print(long value, int base = DEC) { return print(String(value, base)); }
+        size_t print(unsigned long value, int base = DEC) { return print(String(value, base)); }
+        size_t print(double value, int digits = 2) {
+            char text[64];
+            snprintf(text, sizeof(text), "%.*f", digits, value);
+            return write(text);
+        }
+
+        size_t println() { return write("\r\n"); }
+        template<class T> size_t println(T value) { size_t n = print(value); return n + println(); }
+        template<class T> size_t println(T value, int format) { size_t n = print(value, format); return n + println(); }
+};
+
+class Stream : public Print {
+
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+        void setTimeout(unsigned long timeout) { _timeout = timeout; }
+        size_t readBytes(char *buffer, size_t length) { return readBytes((uint8_t *) buffer, length); }
+        size_t readBytes(uint8_t *buffer, size_t length) {
+            size_t count = 0;
+            while (count < length) {
+                int c = timedRead();
+                if (c < 0) { break; }
+                buffer[count++] = (uint8_t) c;
+            }
+            return count;
+        }
+    protected:
+        unsigned long _timeout = 1000;
+        int timedRead() {
+            unsigned long start = millis();
+            do {
+                int c = read();
+                if (c >= 0) { return c; }
+                yield();
+            } while (millis() - start < _timeout);
+            return -1;
+        }
+};
+
+// Serial: output to stdout, no input
+class HostSerial : public Stream {
+
+    public:
+        void begin(unsigned long) {}
+        int available() { return 0; }
+        int read() { return -1; }
+        int peek() { return -1; }
+        size_t write(uint8_t c) { return fputc(c, stdout) == EOF ? 0 : 1; }
+        size_t write(const uint8_t *buffer, size_t size) { return fwrite(buffer, 1, size, stdout); }
+        using Print::write;
+        void flush() { fflush(stdout); }
+        operator bool() { return true; }
+};
+
+extern HostSerial Serial;
+
+#endif // _HOST_ARDUINO_H
@@ -0,0 +1,32 @@
+#ifndef   INC_FREERTOS_H
+#define   INC_FREERTOS_H
+
+/*
+Host build of the FreeRTOS subset used by the examples. Tasks are std::threads started by
+vTaskStartScheduler(), which returns once every task has deleted itself (so the sketch's
+setup() returns on the host). Priorities and stack sizes are ignored, ticks are milliseconds
+*/
+
+#include <stdint.h>
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+typedef struct HostTask *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE              1
+#define pdFALSE             0
+#define pdPASS              pdTRUE
+#define pdFAIL              pdFALSE
+#define portMAX_DELAY       ((TickType_t) 0xFFFFFFFFUL)
+#define tskIDLE_PRIORITY    0
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stackDepth, void *parameter, UBaseType_t priority, TaskHandle_t *createdTask);
+// Only a task deleting itself (NULL) is supported
+void vTaskDelete(TaskHandle_t task);
+void vTaskStartScheduler();
+// Stack use isn't measured on the host, always 0
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+#endif // INC_FREERTOS_H
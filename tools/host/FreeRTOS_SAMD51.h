@@ -0,0 +1,3 @@
+// Host build: the FreeRTOS shim in tools/host/FreeRTOS.h and semphr.h
+#include <FreeRTOS.h>
+#include <semphr.h>
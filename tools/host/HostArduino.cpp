@@ -0,0 +1,129 @@
+#include <Arduino.h>
+#include <Adafruit_QSPI_GD25Q.h>
+#include <chrono>
+#include <thread>
+
+HostSerial Serial;
+
+static std::chrono::steady_clock::time_point bootTime = std::chrono::steady_clock::now();
+static uint8_t flashMemory[HOST_FLASH_SIZE];
+static bool flashErased = false;
+
+unsigned long micros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - bootTime).count();
+}
+
+unsigned long millis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - bootTime).count();
+}
+
+void delay(unsigned long ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void yield() {
+    std::this_thread::yield();
+}
+
+long random(long howbig) {
+    return howbig <= 0 ? 0 : rand() % howbig;
+}
+
+long random(long howsmall, long howbig) {
+    return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall);
+}
+
+void randomSeed(unsigned long seed) {
+    srand(seed);
+}
+
+/*
+Adafruit_QSPI_GD25Q (host build)
+*/
+uint8_t *hostFlashMemory() {
+    // A new chip reads back erased
+    if (!flashErased) {
+        memset(flashMemory, 0xFF, sizeof(flashMemory));
+        flashErased = true;
+    }
+    return flashMemory;
+}
+
+bool Adafruit_QSPI_GD25Q::begin() {
+    hostFlashMemory();
+    return true;
+}
+
+void Adafruit_QSPI_GD25Q::GetManufacturerInfo(uint8_t *manufID, uint8_t *deviceID) {
+    *manufID = 0xC8;
+    *deviceID = 0x14;
+}
+
+uint32_t Adafruit_QSPI_GD25Q::GetJEDECID() {
+    return 0xC84015;
+}
+
+bool Adafruit_QSPI_GD25Q::eraseSector(uint32_t sectorNumber) {
+    if (sectorNumber >= HOST_FLASH_SIZE / 4096) {
+        return false;
+    }
+    memset(hostFlashMemory() + sectorNumber * 4096, 0xFF, 4096);
+    return true;
+}
+
+bool Adafruit_QSPI_GD25Q::eraseBlock(uint32_t blockNumber) {
+    if (blockNumber >= HOST_FLASH_SIZE / 65536) {
+        return false;
+    }
+    memset(hostFlashMemory() + blockNumber * 65536, 0xFF, 65536);
+    return true;
+}
+
+bool Adafruit_QSPI_GD25Q::eraseChip() {
+    memset(hostFlashMemory(), 0xFF, HOST_FLASH_SIZE);
+    return true;
+}
+
+bool Adafruit_QSPI_GD25Q::readMemory(uint32_t addr, uint8_t *data, uint32_t size) {
+    return readBuffer(addr, data, size) == size;
+}
+
+bool Adafruit_QSPI_GD25Q::writeMemory(uint32_t addr, uint8_t *data, uint32_t size) {
+    return writeBuffer(addr, data, size) == size;
+}
+
+bool Adafruit_QSPI_GD25Q::setFlashType(spiflash_type_t t) {
+    return true;
+}
+
+uint32_t Adafruit_QSPI_GD25Q::readBuffer(uint32_t address, uint8_t *buffer, uint32_t len) {
+    if (address >= HOST_FLASH_SIZE || len > HOST_FLASH_SIZE - address) {
+        return 0;
+    }
+    memcpy(buffer, hostFlashMemory() + address, len);
+    return len;
+}
+
+uint32_t Adafruit_QSPI_GD25Q::writeBuffer(uint32_t address, uint8_t *buffer, uint32_t len) {
+    if (address >= HOST_FLASH_SIZE || len > HOST_FLASH_SIZE - address) {
+        return 0;
+    }
+    // Programming can only clear bits
+    uint8_t *memory = hostFlashMemory() + address;
+    for (uint32_t i = 0 ; i < len ; i++) {
+        memory[i] &= buffer[i];
+    }
+    return len;
+}
+
+uint32_t Adafruit_QSPI_GD25Q::getAddr() {
+    return 0;
+}
+
+uint16_t Adafruit_QSPI_GD25Q::numPages() {
+    return HOST_FLASH_PAGE_COUNT;
+}
+
+uint16_t Adafruit_QSPI_GD25Q::pageSize() {
+    return HOST_FLASH_PAGE_SIZE;
+}
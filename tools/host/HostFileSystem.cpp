@@ -0,0 +1,714 @@
+#include <Adafruit_SPIFlash_FatFs.h>
+#include <Adafruit_QSPI_GD25Q.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <ctype.h>
+#include <strings.h>
+
+#define HOST_SECTOR_SIZE        512
+// Space the 2MB volume leaves for file contents once the FAT and root directory are taken
+#define HOST_VOLUME_CAPACITY    (HOST_FLASH_SIZE - 65536)
+
+struct HostNode;
+typedef std::shared_ptr<HostNode> HostNodePtr;
+
+struct HostNode {
+    std::string name;
+    bool directory;
+    std::vector<uint8_t> data;
+    std::vector<HostNodePtr> children;  // in creation order, like FAT directory slots
+};
+
+struct HostFileState {
+    int references;
+    bool open;
+    uint8_t mode;
+    HostNodePtr node;
+    uint32_t position;
+    size_t nextChild;
+    char name[_MAX_LFN + 1];
+};
+
+static std::mutex fileSystemMutex;
+static std::atomic<int> callsInside(0);
+static std::atomic<unsigned long> violations(0);
+static HostNodePtr root;
+static uint32_t usedBytes = 0;
+static int openFiles = 0;
+static unsigned long mounts = 0;
+
+/*
+Class: HostCall
+Description: Held for every filesystem call. Records a violation when another thread is
+             already inside, then serialises anyway so the simulation itself stays consistent
+*/
+class HostCall {
+
+    public:
+        HostCall() {
+            if (callsInside.fetch_add(1) != 0) {
+                violations++;
+            }
+            // Widen the window so unlocked callers overlap often enough to be caught
+            std::this_thread::yield();
+            fileSystemMutex.lock();
+        }
+        ~HostCall() {
+            fileSystemMutex.unlock();
+            callsInside.fetch_sub(1);
+        }
+};
+
+static HostNodePtr findChild(const HostNodePtr &directory, const std::string &name, size_t *index = NULL) {
+    for (size_t i = 0 ; i < directory->children.size() ; i++) {
+        // FAT names are case-insensitive
+        if (strcasecmp(directory->children[i]->name.c_str(), name.c_str()) == 0) {
+            if (index != NULL) { *index = i; }
+            return directory->children[i];
+        }
+    }
+    return HostNodePtr();
+}
+
+static std::vector<std::string> splitPath(const char *filepath) {
+    std::vector<std::string> parts;
+    std::string part;
+    for (const char *c = filepath ; ; c++) {
+        if (*c == '/' || *c == 0) {
+            if (!part.empty() && part != ".") { parts.push_back(part); }
+            part.clear();
+            if (*c == 0) { break; }
+        } else {
+            part += *c;
+        }
+    }
+    return parts;
+}
+
+// Directory holding the last component of filepath, leaf gets that component ("" for the root)
+static HostNodePtr findParent(const char *filepath, std::string &leaf) {
+    if (!root || filepath == NULL) {
+        return HostNodePtr();
+    }
+    std::vector<std::string> parts = splitPath(filepath);
+    leaf = parts.empty() ? "" : parts.back();
+    HostNodePtr node = root;
+    for (size_t i = 0 ; i + 1 < parts.size() ; i++) {
+        node = findChild(node, parts[i]);
+        if (!node || !node->directory) {
+            return HostNodePtr();
+        }
+    }
+    return node;
+}
+
+static HostNodePtr findNode(const char *filepath) {
+    std::string leaf;
+    HostNodePtr parent = findParent(filepath, leaf);
+    if (!parent || leaf.empty()) {
+        return parent;
+    }
+    return findChild(parent, leaf);
+}
+
+static void releaseNode(const HostNodePtr &node) {
+    usedBytes -= node->data.size();
+    for (size_t i = 0 ; i < node->children.size() ; i++) {
+        releaseNode(node->children[i]);
+    }
+}
+
+/*
+FAT volume on the simulated chip, read by begin() while no volume is mounted (see loadVolume())
+*/
+struct HostVolume {
+    uint32_t fatStart;
+    uint32_t rootStart;
+    uint32_t rootSectors;
+    uint32_t rootCluster;       // FAT32 only
+    uint32_t dataStart;
+    uint32_t clusterSectors;
+    uint32_t clusterCount;
+    uint8_t fatType;
+};
+
+static uint32_t readLE(const uint8_t *data, uint8_t length) {
+    uint32_t value = 0;
+    for (uint8_t i = length ; i > 0 ; i--) {
+        value = (value << 8) | data[i - 1];
+    }
+    return value;
+}
+
+static const uint8_t *chipSector(uint32_t sector) {
+    return hostFlashMemory() + sector * HOST_SECTOR_SIZE;
+}
+
+// Boot sector at sector 0, or in the first partition as format() creates it
+static bool readVolume(HostVolume &volume) {
+    uint32_t volumeStart = 0;
+    const uint8_t *boot = chipSector(0);
+    if (boot[510] != 0x55 || boot[511] != 0xAA) {
+        return false;
+    }
+    if (!((boot[0] == 0xEB || boot[0] == 0xE9) && readLE(&boot[11], 2) == HOST_SECTOR_SIZE)) {
+        volumeStart = readLE(&boot[0x1BE + 8], 4);
+        if (volumeStart == 0 || volumeStart >= HOST_FLASH_SIZE / HOST_SECTOR_SIZE) {
+            return false;
+        }
+        boot = chipSector(volumeStart);
+        if (boot[510] != 0x55 || boot[511] != 0xAA || readLE(&boot[11], 2) != HOST_SECTOR_SIZE) {
+            return false;
+        }
+    }
+    volume.clusterSectors = boot[13];
+    uint32_t fatCount = boot[16];
+    uint32_t reservedSectors = readLE(&boot[14], 2);
+    uint32_t rootEntries = readLE(&boot[17], 2);
+    uint32_t totalSectors = readLE(&boot[19], 2);
+    if (totalSectors == 0) {
+        totalSectors = readLE(&boot[32], 4);
+    }
+    uint32_t fatSectors = readLE(&boot[22], 2);
+    if (fatSectors == 0) {
+        fatSectors = readLE(&boot[36], 4);
+    }
+    if (volume.clusterSectors == 0 || fatCount == 0 || reservedSectors == 0 || fatSectors == 0
+        || volumeStart + totalSectors > HOST_FLASH_SIZE / HOST_SECTOR_SIZE) {
+        return false;
+    }
+    volume.fatStart = volumeStart + reservedSectors;
+    volume.rootStart = volume.fatStart + fatCount * fatSectors;
+    volume.rootSectors = (rootEntries * 32 + HOST_SECTOR_SIZE - 1) / HOST_SECTOR_SIZE;
+    volume.dataStart = volume.rootStart + volume.rootSectors;
+    if (totalSectors <= volume.dataStart - volumeStart) {
+        return false;
+    }
+    volume.clusterCount = (totalSectors - (volume.dataStart - volumeStart)) / volume.clusterSectors;
+    volume.fatType = (volume.clusterCount < 4085) ? 12 : (volume.clusterCount < 65525) ? 16 : 32;
+    volume.rootCluster = (volume.fatType == 32) ? readLE(&boot[44], 4) : 0;
+    return volume.clusterCount > 0;
+}
+
+static uint32_t readFatEntry(const HostVolume &volume, uint32_t cluster) {
+    const uint8_t *fat = chipSector(volume.fatStart);
+    if (volume.fatType == 12) {
+        uint32_t raw = readLE(&fat[cluster + cluster / 2], 2);
+        return (cluster & 1) ? (raw >> 4) : (raw & 0xFFF);
+    }
+    if (volume.fatType == 16) {
+        return readLE(&fat[cluster * 2], 2);
+    }
+    return readLE(&fat[cluster * 4], 4) & 0x0FFFFFFF;
+}
+
+// Contents of a cluster chain, false on a chain that leaves the volume or loops
+static bool readChain(const HostVolume &volume, uint32_t cluster, std::vector<uint8_t> &data) {
+    uint32_t clusterBytes = volume.clusterSectors * HOST_SECTOR_SIZE;
+    uint32_t endOfChain = (volume.fatType == 12) ? 0xFF8 : (volume.fatType == 16) ? 0xFFF8 : 0x0FFFFFF8;
+    data.clear();
+    for (uint32_t walked = 0 ; cluster < endOfChain ; walked++) {
+        if (cluster < 2 || cluster >= volume.clusterCount + 2 || walked >= volume.clusterCount) {
+            return false;
+        }
+        const uint8_t *contents = chipSector(volume.dataStart + (cluster - 2) * volume.clusterSectors);
+        data.insert(data.end(), contents, contents + clusterBytes);
+        cluster = readFatEntry(volume, cluster);
+    }
+    return true;
+}
+
+// UTF-16 code unit as UTF-8
+static void appendUTF8(std::string &name, uint16_t unit) {
+    if (unit < 0x80) {
+        name += (char) unit;
+    } else if (unit < 0x800) {
+        name += (char) (0xC0 | (unit >> 6));
+        name += (char) (0x80 | (unit & 0x3F));
+    } else {
+        name += (char) (0xE0 | (unit >> 12));
+        name += (char) (0x80 | ((unit >> 6) & 0x3F));
+        name += (char) (0x80 | (unit & 0x3F));
+    }
+}
+
+// 8.3 name, lower case where the NT case bits (byte 12) ask for it
+static std::string shortName(const uint8_t entry[]) {
+    std::string name;
+    for (int i = 0 ; i < 11 ; i++) {
+        if (i == 8 && entry[8] != ' ') {
+            name += '.';
+        }
+        if (entry[i] != ' ') {
+            char c = (i == 0 && entry[0] == 0x05) ? (char) 0xE5 : (char) entry[i];
+            bool lower = (i < 8) ? (entry[12] & 0x08) : (entry[12] & 0x10);
+            name += lower ? (char) tolower((unsigned char) c) : c;
+        }
+    }
+    return name;
+}
+
+static uint8_t shortNameChecksum(const uint8_t entry[]) {
+    uint8_t sum = 0;
+    for (int i = 0 ; i < 11 ; i++) {
+        sum = ((sum & 1) ? 0x80 : 0) + (sum >> 1) + entry[i];
+    }
+    return sum;
+}
+
+// Add the entries of a directory (its raw entry bytes) and everything below them
+static bool loadDirectory(const HostVolume &volume, const std::vector<uint8_t> &entries, const HostNodePtr &directory, int depth) {
+    std::vector<uint16_t> longName;
+    uint8_t longChecksum = 0;
+    for (size_t offset = 0 ; offset + 32 <= entries.size() ; offset += 32) {
+        const uint8_t *entry = &entries[offset];
+        if (entry[0] == 0x00) {
+            break;
+        }
+        if (entry[0] == 0xE5) {
+            longName.clear();
+            continue;
+        }
+        if (entry[11] == 0x0F) {
+            // Long name pieces come last piece first, 13 UTF-16 units each
+            if (entry[0] & 0x40) {
+                longName.assign(((entry[0] & 0x1F)) * 13, 0xFFFF);
+                longChecksum = entry[13];
+            }
+            uint32_t piece = (entry[0] & 0x1F);
+            static const uint8_t unitOffsets[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+            if (piece == 0 || piece * 13 > longName.size()) {
+                longName.clear();
+                continue;
+            }
+            for (int i = 0 ; i < 13 ; i++) {
+                longName[(piece - 1) * 13 + i] = readLE(&entry[unitOffsets[i]], 2);
+            }
+            continue;
+        }
+        if ((entry[11] & 0x08) || entry[0] == '.') {
+            longName.clear();
+            continue;
+        }
+        HostNodePtr node = std::make_shared<HostNode>();
+        if (!longName.empty() && longChecksum == shortNameChecksum(entry)) {
+            for (size_t i = 0 ; i < longName.size() && longName[i] != 0x0000 && longName[i] != 0xFFFF ; i++) {
+                appendUTF8(node->name, longName[i]);
+            }
+        } else {
+            node->name = shortName(entry);
+        }
+        longName.clear();
+        node->directory = (entry[11] & 0x10) != 0;
+        uint32_t cluster = readLE(&entry[26], 2) | (volume.fatType == 32 ? readLE(&entry[20], 2) << 16 : 0);
+        if (node->directory) {
+            std::vector<uint8_t> children;
+            if (depth > 32 || !readChain(volume, cluster, children) || !loadDirectory(volume, children, node, depth + 1)) {
+                return false;
+            }
+        } else {
+            uint32_t size = readLE(&entry[28], 4);
+            if (size > 0 && (!readChain(volume, cluster, node->data) || node->data.size() < size)) {
+                return false;
+            }
+            node->data.resize(size);
+            usedBytes += size;
+        }
+        directory->children.push_back(node);
+    }
+    return true;
+}
+
+/*
+Method: loadVolume()
+Description: Build the directory tree from a FAT12/16/32 volume written to the simulated chip,
+             e.g. by importImage() of a tools/flash-image-builder image. Only read, later
+             changes stay in the tree as usual
+Input: None
+Output: HostNodePtr root, empty if the chip holds no readable volume
+*/
+static HostNodePtr loadVolume() {
+    HostVolume volume;
+    if (!readVolume(volume)) {
+        return HostNodePtr();
+    }
+    std::vector<uint8_t> entries;
+    if (volume.fatType == 32) {
+        if (!readChain(volume, volume.rootCluster, entries)) {
+            return HostNodePtr();
+        }
+    } else {
+        entries.assign(chipSector(volume.rootStart), chipSector(volume.rootStart + volume.rootSectors));
+    }
+    HostNodePtr loaded = std::make_shared<HostNode>();
+    loaded->directory = true;
+    usedBytes = 0;
+    if (!loadDirectory(volume, entries, loaded, 0)) {
+        usedBytes = 0;
+        return HostNodePtr();
+    }
+    return loaded;
+}
+
+/*
+Raw FatFs calls
+*/
+FRESULT f_fdisk(BYTE pdrv, const DWORD *szt, void *work) {
+    HostCall call;
+    return pdrv == 0 ? FR_OK : FR_INVALID_DRIVE;
+}
+
+FRESULT f_mkfs(const TCHAR *path, BYTE opt, DWORD au, void *work, UINT len) {
+    HostCall call;
+    root = std::make_shared<HostNode>();
+    root->directory = true;
+    usedBytes = 0;
+    return FR_OK;
+}
+
+FRESULT f_rename(const TCHAR *path_old, const TCHAR *path_new) {
+    HostCall call;
+    std::string oldLeaf;
+    std::string newLeaf;
+    HostNodePtr oldParent = findParent(path_old, oldLeaf);
+    HostNodePtr newParent = findParent(path_new, newLeaf);
+    size_t index;
+    if (!oldParent || !newParent || oldLeaf.empty() || newLeaf.empty() || !findChild(oldParent, oldLeaf, &index)) {
+        return FR_NO_FILE;
+    }
+    if (findChild(newParent, newLeaf)) {
+        return FR_EXIST;
+    }
+    HostNodePtr node = oldParent->children[index];
+    oldParent->children.erase(oldParent->children.begin() + index);
+    node->name = newLeaf;
+    newParent->children.push_back(node);
+    return FR_OK;
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, DWORD sector, UINT count) {
+    HostCall call;
+    if (pdrv != 0 || ((uint64_t) sector + count) * HOST_SECTOR_SIZE > HOST_FLASH_SIZE) {
+        return RES_PARERR;
+    }
+    memcpy(buff, hostFlashMemory() + sector * HOST_SECTOR_SIZE, count * HOST_SECTOR_SIZE);
+    return RES_OK;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, DWORD sector, UINT count) {
+    HostCall call;
+    if (pdrv != 0 || ((uint64_t) sector + count) * HOST_SECTOR_SIZE > HOST_FLASH_SIZE) {
+        return RES_PARERR;
+    }
+    memcpy(hostFlashMemory() + sector * HOST_SECTOR_SIZE, buff, count * HOST_SECTOR_SIZE);
+    return RES_OK;
+}
+
+/*
+File
+*/
+static HostFileState *openState(const HostNodePtr &node, uint8_t mode) {
+    HostFileState *state = new HostFileState();
+    state->references = 1;
+    state->open = true;
+    state->mode = mode;
+    state->node = node;
+    // FILE_WRITE appends, as with the SD library
+    state->position = (mode & 0x02) != 0 ? node->data.size() : 0;
+    state->nextChild = 0;
+    strncpy(state->name, node->name.c_str(), _MAX_LFN);
+    state->name[_MAX_LFN] = 0;
+    openFiles++;
+    return state;
+}
+
+File::File(const char *filepath, uint8_t mode) : _state(NULL) {
+    if (filepath == NULL) {
+        return;
+    }
+    HostCall call;
+    std::string leaf;
+    HostNodePtr parent = findParent(filepath, leaf);
+    if (!parent) {
+        return;
+    }
+    HostNodePtr node = leaf.empty() ? parent : findChild(parent, leaf);
+    if (!node) {
+        if ((mode & 0x02) == 0) {
+            return;
+        }
+        node = std::make_shared<HostNode>();
+        node->name = leaf;
+        node->directory = false;
+        parent->children.push_back(node);
+    }
+    _state = openState(node, mode);
+}
+
+File::File(const File &other) : Stream(other), _state(other._state) {
+    if (_state != NULL) {
+        _state->references++;
+    }
+}
+
+File &File::operator=(const File &other) {
+    if (other._state != NULL) {
+        other._state->references++;
+    }
+    release();
+    _state = other._state;
+    return *this;
+}
+
+File::~File() {
+    release();
+}
+
+// Copies share one handle. Dropping the last copy without close() leaks it, as FatFs would
+void File::release() {
+    if (_state != NULL && --_state->references == 0) {
+        delete _state;
+    }
+    _state = NULL;
+}
+
+size_t File::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t File::write(const uint8_t *buf, size_t size) {
+    HostCall call;
+    if (_state == NULL || !_state->open || _state->node->directory || (_state->mode & 0x02) == 0) {
+        return 0;
+    }
+    std::vector<uint8_t> &data = _state->node->data;
+    uint32_t end = _state->position + size;
+    if (end > data.size()) {
+        // Volume full: write what fits
+        uint32_t growth = end - data.size();
+        if (usedBytes + growth > HOST_VOLUME_CAPACITY) {
+            growth = HOST_VOLUME_CAPACITY - usedBytes;
+            end = data.size() + growth;
+            size = end > _state->position ? end - _state->position : 0;
+        }
+        usedBytes += growth;
+        data.resize(end);
+    }
+    if (size > 0) {
+        memcpy(&data[_state->position], buf, size);
+    }
+    _state->position += size;
+    return size;
+}
+
+int File::read() {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+}
+
+int File::read(void *buf, uint16_t nbyte) {
+    HostCall call;
+    if (_state == NULL || !_state->open || _state->node->directory) {
+        return -1;
+    }
+    std::vector<uint8_t> &data = _state->node->data;
+    uint32_t count = _state->position < data.size() ? data.size() - _state->position : 0;
+    if (count > nbyte) {
+        count = nbyte;
+    }
+    if (count > 0) {
+        memcpy(buf, &data[_state->position], count);
+    }
+    _state->position += count;
+    return count;
+}
+
+int File::peek() {
+    HostCall call;
+    if (_state == NULL || !_state->open || _state->node->directory || _state->position >= _state->node->data.size()) {
+        return -1;
+    }
+    return _state->node->data[_state->position];
+}
+
+int File::available() {
+    HostCall call;
+    if (_state == NULL || !_state->open || _state->node->directory || _state->position >= _state->node->data.size()) {
+        return 0;
+    }
+    return _state->node->data.size() - _state->position;
+}
+
+void File::flush() {
+    HostCall call;
+}
+
+bool File::seek(uint32_t pos) {
+    HostCall call;
+    if (_state == NULL || !_state->open || _state->node->directory) {
+        return false;
+    }
+    std::vector<uint8_t> &data = _state->node->data;
+    if (pos > data.size()) {
+        // f_lseek() stretches a file open for writing, and stops at the end otherwise
+        if ((_state->mode & 0x02) == 0 || usedBytes + (pos - data.size()) > HOST_VOLUME_CAPACITY) {
+            _state->position = data.size();
+            return true;
+        }
+        usedBytes += pos - data.size();
+        data.resize(pos);
+    }
+    _state->position = pos;
+    return true;
+}
+
+uint32_t File::position() {
+    HostCall call;
+    return (_state == NULL || !_state->open) ? 0 : _state->position;
+}
+
+uint32_t File::size() {
+    HostCall call;
+    return (_state == NULL || !_state->open) ? 0 : _state->node->data.size();
+}
+
+void File::close() {
+    HostCall call;
+    if (_state != NULL && _state->open) {
+        _state->open = false;
+        _state->node.reset();
+        openFiles--;
+    }
+}
+
+File::operator bool() {
+    return _state != NULL && _state->open;
+}
+
+char *File::name() {
+    return _state == NULL ? NULL : _state->name;
+}
+
+bool File::isDirectory() {
+    return _state != NULL && _state->open && _state->node->directory;
+}
+
+File File::openNextFile(uint8_t mode) {
+    HostCall call;
+    File next;
+    if (_state == NULL || !_state->open || !_state->node->directory || _state->nextChild >= _state->node->children.size()) {
+        return next;
+    }
+    next._state = openState(_state->node->children[_state->nextChild++], mode);
+    return next;
+}
+
+void File::rewindDirectory() {
+    HostCall call;
+    if (_state != NULL) {
+        _state->nextChild = 0;
+    }
+}
+
+/*
+Adafruit_SPIFlash_FatFs
+*/
+bool Adafruit_SPIFlash_FatFs::begin() {
+    HostCall call;
+    // Unformatted until f_mkfs(), or a volume written to the chip is found
+    if (!root) {
+        root = loadVolume();
+    }
+    if (!root) {
+        return false;
+    }
+    mounts++;
+    return true;
+}
+
+void Adafruit_SPIFlash_FatFs::activate() {
+}
+
+File Adafruit_SPIFlash_FatFs::open(const char *filepath, uint8_t mode) {
+    return File(filepath, mode);
+}
+
+bool Adafruit_SPIFlash_FatFs::exists(const char *filepath) {
+    HostCall call;
+    return (bool) findNode(filepath);
+}
+
+bool Adafruit_SPIFlash_FatFs::mkdir(const char *filepath) {
+    HostCall call;
+    if (!root || filepath == NULL) {
+        return false;
+    }
+    // Intermediate directories are created too
+    std::vector<std::string> parts = splitPath(filepath);
+    HostNodePtr node = root;
+    for (size_t i = 0 ; i < parts.size() ; i++) {
+        HostNodePtr child = findChild(node, parts[i]);
+        if (!child) {
+            child = std::make_shared<HostNode>();
+            child->name = parts[i];
+            child->directory = true;
+            node->children.push_back(child);
+        } else if (!child->directory) {
+            return false;
+        }
+        node = child;
+    }
+    return true;
+}
+
+bool Adafruit_SPIFlash_FatFs::remove(const char *filepath) {
+    HostCall call;
+    std::string leaf;
+    HostNodePtr parent = findParent(filepath, leaf);
+    size_t index;
+    if (!parent || leaf.empty() || !findChild(parent, leaf, &index) || parent->children[index]->directory) {
+        return false;
+    }
+    releaseNode(parent->children[index]);
+    parent->children.erase(parent->children.begin() + index);
+    return true;
+}
+
+bool Adafruit_SPIFlash_FatFs::rmdir(const char *filepath) {
+    HostCall call;
+    std::string leaf;
+    HostNodePtr parent = findParent(filepath, leaf);
+    size_t index;
+    if (!parent || leaf.empty() || !findChild(parent, leaf, &index) || !parent->children[index]->directory) {
+        return false;
+    }
+    // Removes everything below it as well
+    releaseNode(parent->children[index]);
+    parent->children.erase(parent->children.begin() + index);
+    return true;
+}
+
+unsigned long hostFileSystemViolations() {
+    return violations;
+}
+
+int hostFileSystemOpenFiles() {
+    HostCall call;
+    return openFiles;
+}
+
+unsigned long hostFileSystemMounts() {
+    HostCall call;
+    return mounts;
+}
+
+void hostFileSystemReset() {
+    HostCall call;
+    root.reset();
+    usedBytes = 0;
+    openFiles = 0;
+    violations = 0;
+}
@@ -0,0 +1,159 @@
+#include <FreeRTOS.h>
+#include <semphr.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct HostTask {
+    TaskFunction_t code;
+    void *parameter;
+};
+
+struct HostSemaphore {
+    bool recursive;
+    std::mutex mutex;
+    std::condition_variable changed;
+    UBaseType_t count;          // counting: available, recursive: depth held by owner
+    UBaseType_t maxCount;
+    std::thread::id owner;
+};
+
+// Thrown by vTaskDelete(NULL) to end the calling task's thread
+struct HostTaskExit {};
+
+static std::mutex schedulerMutex;
+static std::condition_variable tasksChanged;
+static std::vector<HostTask *> pendingTasks;
+static int runningTasks = 0;
+static bool schedulerStarted = false;
+
+static void runTask(HostTask *task) {
+    try {
+        task->code(task->parameter);
+    } catch (HostTaskExit &) {
+    }
+    delete task;
+    std::lock_guard<std::mutex> guard(schedulerMutex);
+    runningTasks--;
+    tasksChanged.notify_all();
+}
+
+static void startTask(HostTask *task) {
+    runningTasks++;
+    std::thread(runTask, task).detach();
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stackDepth, void *parameter, UBaseType_t priority, TaskHandle_t *createdTask) {
+    HostTask *task = new HostTask();
+    task->code = code;
+    task->parameter = parameter;
+    if (createdTask != NULL) {
+        *createdTask = task;
+    }
+    std::lock_guard<std::mutex> guard(schedulerMutex);
+    // Tasks created before the scheduler starts wait for it, as on the device
+    if (schedulerStarted) {
+        startTask(task);
+    } else {
+        pendingTasks.push_back(task);
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (task != NULL) {
+        fprintf(stderr, "vTaskDelete() of another task isn't supported on the host\n");
+        abort();
+    }
+    throw HostTaskExit();
+}
+
+void vTaskStartScheduler() {
+    std::unique_lock<std::mutex> lock(schedulerMutex);
+    schedulerStarted = true;
+    for (size_t i = 0 ; i < pendingTasks.size() ; i++) {
+        startTask(pendingTasks[i]);
+    }
+    pendingTasks.clear();
+    tasksChanged.wait(lock, [] { return runningTasks == 0; });
+    schedulerStarted = false;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    return 0;
+}
+
+static SemaphoreHandle_t createSemaphore(bool recursive, UBaseType_t maxCount, UBaseType_t initialCount) {
+    HostSemaphore *semaphore = new HostSemaphore();
+    semaphore->recursive = recursive;
+    semaphore->count = initialCount;
+    semaphore->maxCount = maxCount;
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() {
+    return createSemaphore(true, 1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount) {
+    return createSemaphore(false, maxCount, initialCount);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    delete semaphore;
+}
+
+// Wait until ready() holds, for ticksToWait milliseconds or forever with portMAX_DELAY
+template<class Ready> static bool waitFor(HostSemaphore *semaphore, std::unique_lock<std::mutex> &lock, TickType_t ticksToWait, Ready ready) {
+    if (ticksToWait == portMAX_DELAY) {
+        semaphore->changed.wait(lock, ready);
+        return true;
+    }
+    return semaphore->changed.wait_for(lock, std::chrono::milliseconds(ticksToWait), ready);
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t semaphore, TickType_t ticksToWait) {
+    std::thread::id self = std::this_thread::get_id();
+    std::unique_lock<std::mutex> lock(semaphore->mutex);
+    if (!waitFor(semaphore, lock, ticksToWait, [semaphore, self] { return semaphore->count == 0 || semaphore->owner == self; })) {
+        return pdFALSE;
+    }
+    semaphore->owner = self;
+    semaphore->count++;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t semaphore) {
+    std::lock_guard<std::mutex> guard(semaphore->mutex);
+    if (semaphore->count == 0 || semaphore->owner != std::this_thread::get_id()) {
+        return pdFALSE;
+    }
+    if (--semaphore->count == 0) {
+        semaphore->owner = std::thread::id();
+        semaphore->changed.notify_all();
+    }
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait) {
+    std::unique_lock<std::mutex> lock(semaphore->mutex);
+    if (!waitFor(semaphore, lock, ticksToWait, [semaphore] { return semaphore->count > 0; })) {
+        return pdFALSE;
+    }
+    semaphore->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    std::lock_guard<std::mutex> guard(semaphore->mutex);
+    if (semaphore->count >= semaphore->maxCount) {
+        return pdFALSE;
+    }
+    semaphore->count++;
+    semaphore->changed.notify_all();
+    return pdTRUE;
+}
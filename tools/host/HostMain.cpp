@@ -0,0 +1,28 @@
+#include <Arduino.h>
+#include <Adafruit_SPIFlash_FatFs.h>
+
+/*
+Runs an example sketch on the host (see build-sketch.sh): setup() once, then loop()
+HOST_LOOP_COUNT times. Exits with 1 when the sketch left files or directories open
+*/
+
+#ifndef HOST_LOOP_COUNT
+#define HOST_LOOP_COUNT 1
+#endif
+
+void setup();
+void loop();
+
+int main() {
+    setup();
+    for (int i = 0 ; i < HOST_LOOP_COUNT ; i++) {
+        loop();
+    }
+    fflush(stdout);
+    int openFiles = hostFileSystemOpenFiles();
+    if (openFiles != 0) {
+        fprintf(stderr, "%d file(s) left open\n", openFiles);
+        return 1;
+    }
+    return 0;
+}
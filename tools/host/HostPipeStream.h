@@ -0,0 +1,80 @@
+#ifndef   _HOST_PIPE_STREAM_H
+#define   _HOST_PIPE_STREAM_H
+
+/*
+Host build: Stream over a non-blocking pipe, standing in for a serial port or socket in the
+tests of appendFromStream()/writeToStream(). Bytes written come back out of read(), a feeder
+thread can write while the library reads. available() is what the pipe holds, and write()
+stops short (like a full serial buffer) once the pipe is full, see setCapacity()
+*/
+
+#include <Arduino.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+class HostPipeStream : public Stream {
+
+    public:
+        HostPipeStream() {
+            if (pipe(_fds) != 0) {
+                _fds[0] = _fds[1] = -1;
+            }
+            fcntl(_fds[0], F_SETFL, O_NONBLOCK);
+            fcntl(_fds[1], F_SETFL, O_NONBLOCK);
+        }
+        ~HostPipeStream() {
+            close(_fds[0]);
+            close(_fds[1]);
+        }
+        // Bytes the pipe holds before write() stops short (rounded up by the kernel to a page)
+        int setCapacity(int bytes) {
+#ifdef F_SETPIPE_SZ
+            return fcntl(_fds[1], F_SETPIPE_SZ, bytes);
+#else
+            return -1;
+#endif
+        }
+        int available() {
+            int count = 0;
+            if (ioctl(_fds[0], FIONREAD, &count) != 0) {
+                return 0;
+            }
+            return count + (_peeked >= 0 ? 1 : 0);
+        }
+        int read() {
+            if (_peeked >= 0) {
+                int c = _peeked;
+                _peeked = -1;
+                return c;
+            }
+            uint8_t c;
+            return (::read(_fds[0], &c, 1) == 1) ? c : -1;
+        }
+        int peek() {
+            if (_peeked < 0) {
+                _peeked = read();
+            }
+            return _peeked;
+        }
+        size_t write(uint8_t c) {
+            return write(&c, 1);
+        }
+        size_t write(const uint8_t *buffer, size_t size) {
+            size_t count = 0;
+            while (count < size) {
+                ssize_t written = ::write(_fds[1], buffer + count, size - count);
+                if (written <= 0) {
+                    break;
+                }
+                count += written;
+            }
+            return count;
+        }
+        using Print::write;
+    private:
+        int _fds[2];
+        int _peeked = -1;
+};
+
+#endif // _HOST_PIPE_STREAM_H
@@ -0,0 +1,18 @@
+#!/bin/sh
+# Build an example sketch for the host, against the simulated chip and filesystem.
+# Run from the library root:  sh tools/host/build-sketch.sh examples/benchmark [output]
+# The program runs setup() then loop() once, e.g. ./benchmark > results.csv
+set -e
+
+if [ $# -lt 1 ]; then
+    echo "usage: $0 <sketch directory> [output]" >&2
+    exit 2
+fi
+SKETCH=${1%/}
+NAME=$(basename "$SKETCH")
+OUTPUT=${2:-$NAME}
+CXX=${CXX:-g++}
+FLAGS="-std=gnu++11 -O2 -Wall -Wno-write-strings -Wno-unused-parameter -pthread -DQSPI_FLASH_USE_STD_MUTEX -Itools/host -I. $CXXFLAGS"
+SOURCES="QSPI_Flash.cpp Path.cpp FlashCRC32.cpp FlashKeyValueStore.cpp FlashTimeSeries.cpp FlashReader.cpp FlashConsistencyChecker.cpp tools/host/HostArduino.cpp tools/host/HostFileSystem.cpp tools/host/HostFreeRTOS.cpp tools/host/HostMain.cpp"
+
+$CXX $FLAGS -o "$OUTPUT" -x c++ "$SKETCH/$NAME.ino" -x none $SOURCES